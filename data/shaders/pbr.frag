@@ -27,6 +27,13 @@ uniform sampler2D lut_tex;
 
 layout(location = 0) out vec4 frag_color_out;
 
+// Materials whose maps are left at their defaults are drawn by variants
+// that do not sample them:
+// NO_NORMAL_MAP: shade with the vertex normal
+// NO_OCCLUSION_MAP: no ambient occlusion
+// NO_EMISSION_MAP: emission is emission_factor
+// NO_METALLIC_ROUGHNESS_MAP: metallic and roughness are their factors
+
 vec3 srgb_to_linear(vec3 srgb) {
   return pow(srgb, vec3(2.2));
 }
@@ -40,26 +47,43 @@ vec3 safe_normalize(vec3 v) {
   return dot(v, v) == 0 ? v : normalize(v);
 }
 
+#ifndef NO_NORMAL_MAP
 vec3 decode_normal_ts() {
-  vec3 normal = texture(normal_tex, uv0_vs).xyz * 2.0 - 1.0;
+  // z is rebuilt from x and y, two channel normal maps do not store it
+  vec2 xy = texture(normal_tex, uv0_vs).xy * 2.0 - 1.0;
+  vec3 normal = vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0)));
   return safe_normalize(normal * vec3(normal_scale, normal_scale, 1.0));
 }
 
+#endif
+
 vec3 get_normal_vs() {
+#ifdef NO_NORMAL_MAP
+  return safe_normalize(normal_vs);
+#else
   vec3 normal_ts = decode_normal_ts();
   // avoid NAN when tangent is not present
   return normal_ts.x * safe_normalize(tangent_vs) +
          normal_ts.y * safe_normalize(bitangent_vs) +
          normal_ts.z * safe_normalize(normal_vs);
+#endif
 }
 
 vec3 occlude_color(vec3 unocclude_color) {
+#ifdef NO_OCCLUSION_MAP
+  return unocclude_color;
+#else
   float occlusion = texture(occlusion_tex, uv0_vs).r;
   return mix(unocclude_color, unocclude_color * occlusion, occlusion_strength);
+#endif
 }
 
 vec3 get_emission() {
+#ifdef NO_EMISSION_MAP
+  return emission_factor;
+#else
   return srgb_to_linear(texture(emission_tex, uv0_vs).xyz) * emission_factor;
+#endif
 }
 
 float PI = 3.14159;
@@ -164,9 +188,14 @@ void main() {
   // see
   // https://github.com/KhronosGroup/glTF/tree/master/specification/2.0#reference-pbrmetallicroughness
   // for gltf metallic roughness packing rule.
+#ifdef NO_METALLIC_ROUGHNESS_MAP
+  brdf.metallic = metallic_factor;
+  brdf.perceptual_roughness = roughness_factor;
+#else
   vec4 metallic_roughness = texture(metallic_roughness_tex, uv0_vs);
   brdf.metallic = metallic_roughness.b * metallic_factor;
   brdf.perceptual_roughness = metallic_roughness.g * roughness_factor;
+#endif
 
   float NoV = clamp(dot(n_vs, v_vs), 0.0, 1.0);
   float NoL = clamp(dot(n_vs, l_vs), 0.0, 1.0);
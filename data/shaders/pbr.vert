@@ -1,8 +1,10 @@
 #version 330 core
 
-layout(location = 0) in vec3 position_os;
-layout(location = 1) in vec3 normal_os;
-layout(location = 2) in vec4 tangent_os;
+// packed vertices store normal and tangent as octahedral xy and the tangent
+// sign in position.w, see Mesh::PackedVertex
+layout(location = 0) in vec4 position_in;
+layout(location = 1) in vec3 normal_in;
+layout(location = 2) in vec4 tangent_in;
 layout(location = 3) in vec2 uv0_os;
 
 out vec3 position_vs;
@@ -33,13 +35,36 @@ layout(std140) uniform Transform {
   mat4 MV;
   mat4 I_MV;
   mat4 P;
+  vec3 position_scale;
+  int packed_vertex;
+  vec3 position_offset;
 };
 
+vec3 octahedral_decode(vec2 e) {
+  vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  if (v.z < 0) {
+    v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0 ? 1.0 : -1.0,
+                                    v.y >= 0 ? 1.0 : -1.0);
+  }
+  return normalize(v);
+}
+
 vec3 safe_normalize(vec3 v) {
   return dot(v, v) == 0 ? v : normalize(v);
 }
 
 void main() {
+  vec3 position_os = position_in.xyz;
+  vec3 normal_os = normal_in;
+  vec4 tangent_os = tangent_in;
+  if (packed_vertex != 0) {
+    position_os = position_in.xyz * position_scale + position_offset;
+    normal_os = octahedral_decode(normal_in.xy);
+    float tangent_sign = round(position_in.w * 2.0 - 1.0);
+    tangent_os = vec4(octahedral_decode(tangent_in.xy) * abs(tangent_sign),
+                      tangent_sign);
+  }
+
   position_vs = transform_position(MV, position_os).xyz;
   normal_vs = safe_normalize(transform_normal(I_MV, normal_os));
   // use safe normalize to avoid NAN when tangent is not present
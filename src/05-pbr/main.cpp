@@ -1,13 +1,22 @@
 #include "../common/application.hpp"
+#include "../common/bvh.hpp"
 #include "../common/framebuffer.hpp"
+#include "../common/frustum_culling.hpp"
+#include "../common/geometry_pool.hpp"
 #include "../common/gltf.hpp"
 #include "../common/profile.h"
+#include "../common/program_registry.hpp"
+#include "../common/program_reloader.hpp"
+#include "../common/render_queue.hpp"
 #include "../common/renderer.hpp"
 #include "../common/shader.hpp"
+#include "../common/texture_registry.hpp"
+#include "../common/texture_streamer.hpp"
 #include "../common/utils.hpp"
 #include "material.hpp"
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <algorithm>
 #include <glm/glm.hpp>
 #include <imgui/imgui.h>
 #include <iostream>
@@ -22,8 +31,27 @@ public:
 private:
   void init() override {
     _camera = std::make_unique<ModelViewerCamera>();
-    _scene = std::make_unique<Gltf>("FlightHelmet/FlightHelmet.gltf");
-    _tone_mapping_material = std::make_unique<ToneMappingMaterial>();
+    _texture_streamer = std::make_unique<TextureStreamer>();
+    _geometry_pool = std::make_unique<GeometryPool>();
+    _texture_registry = std::make_unique<TextureRegistry>();
+    _program_reloader = std::make_unique<ProgramReloader>();
+    _program_registry =
+        std::make_unique<ProgramRegistry>(_program_reloader.get());
+    // programs build while the scene loads
+    _program_registry->request("shaders/blit.vert",
+                               "shaders/aces_tonemapping.frag");
+    _program_registry->request("shaders/blit.vert",
+                               "shaders/pre_compute_env_brdf.frag");
+    GltfSettings scene_settings{};
+    scene_settings.texture_streamer = _texture_streamer.get();
+    scene_settings.texture_registry = _texture_registry.get();
+    scene_settings.compress_textures = true;
+    scene_settings.pack_vertices = true;
+    scene_settings.geometry_pool = _geometry_pool.get();
+    _scene = std::make_unique<Gltf>("FlightHelmet/FlightHelmet.gltf",
+                                    &scene_settings);
+    _tone_mapping_material =
+        std::make_unique<ToneMappingMaterial>(_program_registry.get());
     _renderer = std::make_unique<Renderer>();
 
     auto init_mat = [&](PbrMaterial *pbr_mat, Gltf::Material *mat) {
@@ -56,17 +84,42 @@ private:
       }
     };
 
+    // maps left at the default textures are not sampled
+    auto features = [&](Gltf::Material *mat) {
+      uint32_t features = 0;
+      if (!_scene->is_default_texture(mat->normal)) {
+        features |= PbrMaterial::NormalMap;
+      }
+      if (!_scene->is_default_texture(mat->occlusion)) {
+        features |= PbrMaterial::OcclusionMap;
+      }
+      if (!_scene->is_default_texture(mat->emission)) {
+        features |= PbrMaterial::EmissionMap;
+      }
+      if (!_scene->is_default_texture(mat->metallic_roughness)) {
+        features |= PbrMaterial::MetallicRoughnessMap;
+      }
+      return features;
+    };
     for (auto &mat : _scene->materials) {
-      auto pbr_mat = std::make_unique<PbrMaterial>(false);
+      PbrMaterial::request_programs(_program_registry.get(),
+                                    features(mat.get()));
+    }
+
+    for (auto &mat : _scene->materials) {
+      auto pbr_mat = std::make_unique<PbrMaterial>(
+          _program_registry.get(), false, features(mat.get()));
       init_mat(pbr_mat.get(), mat.get());
-      auto base_color_mat = std::make_unique<PbrMaterial>(true);
+      auto base_color_mat =
+          std::make_unique<PbrMaterial>(_program_registry.get(), true);
       init_mat(base_color_mat.get(), mat.get());
 
       _pbr_materials.emplace_back(std::move(pbr_mat));
       _base_color_materials.emplace_back(std::move(base_color_mat));
     }
 
-    _env_brdf_material = std::make_unique<PrecomputeEnvBrdfMaterial>();
+    _env_brdf_material =
+        std::make_unique<PrecomputeEnvBrdfMaterial>(_program_registry.get());
     calculate_env_brdf_lut();
   }
 
@@ -84,6 +137,19 @@ private:
       ss << "(" << frame_time * 1000.0f << "ms)";
       ImGui::Text("%s", ss.str().c_str());
     }
+    if (!_scene->idle()) {
+      ImGui::Text("Loading scene");
+    }
+    if (!_texture_streamer->idle()) {
+      ImGui::Text("Streaming textures: %.1f MB left",
+                  (float)_texture_streamer->pending_bytes() / (1 << 20));
+    }
+    ImGui::Text("Programs: %zu", _program_registry->program_count());
+    if (_texture_registry->shared_count() > 0) {
+      ImGui::Text("Textures shared: %zu (%.1f MB saved)",
+                  _texture_registry->shared_count(),
+                  (float)_texture_registry->saved_bytes() / (1 << 20));
+    }
     if (ImGui::Button("Screen Shot")) {
       request_screen_shot();
     }
@@ -95,6 +161,53 @@ private:
       _camera->draw_ui();
       ImGui::PopID();
     }
+    if (ImGui::CollapsingHeader("Frustum Culling")) {
+      ImGui::PushID(id++);
+      ImGui::Checkbox("Enabled", &_frustum_culling);
+      ImGui::Checkbox("Hierarchy", &_bvh_culling);
+      ImGui::Text("Primitives culled: %zu / %zu",
+                  _culled_primitives,
+                  _draw_culler.size());
+      if (_frustum_culling && _bvh_culling) {
+        ImGui::Text("Nodes visited: %zu / %zu",
+                    _bvh_stats.visited_nodes,
+                    _draw_bvh.node_count());
+      }
+      ImGui::PopID();
+    }
+    if (ImGui::CollapsingHeader("Render Queue")) {
+      ImGui::PushID(id++);
+      ImGui::Checkbox("Sort", &_sort_draws);
+      if (_sort_draws) {
+        auto &stats = _render_queue.stats();
+        ImGui::Text("Program changes: %zu -> %zu",
+                    stats.submitted.programs,
+                    stats.sorted.programs);
+        ImGui::Text("Material changes: %zu -> %zu",
+                    stats.submitted.materials,
+                    stats.sorted.materials);
+        ImGui::Text("Cull state changes: %zu -> %zu",
+                    stats.submitted.states,
+                    stats.sorted.states);
+      }
+      ImGui::PopID();
+    }
+    if (ImGui::CollapsingHeader("Meshlet Culling")) {
+      ImGui::PushID(id++);
+      ImGui::Checkbox("Enabled", &_meshlet_culling);
+      ImGui::Text("Meshlets culled: %zu / %zu",
+                  _cull_stats.culled_meshlets,
+                  _cull_stats.meshlet_count);
+      ImGui::Text("Triangles culled: %.1f%%", _cull_stats.culled_percentage());
+      ImGui::PopID();
+    }
+    if (ImGui::CollapsingHeader("Level Of Detail")) {
+      ImGui::PushID(id++);
+      ImGui::Checkbox("Enabled", &_lod_selection);
+      ImGui::SliderFloat("Pixel Error", &_lod_pixel_error, 0.1f, 16.0f);
+      ImGui::Text("Triangles drawn: %zu", _lod_triangles);
+      ImGui::PopID();
+    }
     if (ImGui::CollapsingHeader("Tone Mapping")) {
       ImGui::PushID(id++);
       ImGui::SliderFloat(
@@ -142,6 +255,65 @@ private:
     glGenerateMipmap(GL_TEXTURE_2D);
   }
 
+  // world space boxes of every primitive of every draw, in draw order
+  void update_draw_bounds() {
+    _draw_boxes.clear();
+    _box_primitives.clear();
+    for (uint32_t i = 0; i < _scene->draws.size(); i++) {
+      auto &draw = _scene->draws[i];
+      auto &primitives = _scene->meshes[draw.index];
+      for (uint32_t j = 0; j < primitives.size(); j++) {
+        _draw_boxes.push_back(
+            transform_aabb(primitives[j].mesh->bounds(), draw.transform));
+        _box_primitives.emplace_back(i, j);
+      }
+    }
+    _draw_culler.clear();
+    for (auto &box : _draw_boxes) {
+      _draw_culler.add(box);
+    }
+    _draw_bvh.build(_draw_boxes);
+  }
+
+  // visible primitives of every pass, with the box index as item
+  void queue_draws(const glm::mat4 &view) {
+    MICROPROFILE_SCOPEI("Main", "Render Queue", 0x8844AA);
+    _render_queue.clear();
+    auto queue_pass =
+        [&](uint32_t pass,
+            PbrMaterial::Mode mode,
+            const std::vector<std::unique_ptr<PbrMaterial>> &materials) {
+          for (uint32_t i = 0; i < _draw_boxes.size(); i++) {
+            if (!_visible_boxes[i]) {
+              continue;
+            }
+            auto [draw_index, prim_index] = _box_primitives[i];
+            auto &draw = _scene->draws[draw_index];
+            auto &prim = _scene->meshes[draw.index][prim_index];
+            auto *mat = materials[prim.material].get();
+            if (mat->mode != mode) {
+              continue;
+            }
+            auto center = (_draw_boxes[i].min + _draw_boxes[i].max) * 0.5f;
+            DrawPacket packet{};
+            packet.pass = pass;
+            packet.back_to_front = mode == PbrMaterial::Blend;
+            packet.program = mat->program().get();
+            packet.state = mat->double_sided;
+            packet.material = (uint32_t)prim.material;
+            packet.depth = -(view * glm::vec4(center, 1.0f)).z;
+            packet.item = i;
+            _render_queue.add(packet);
+          }
+        };
+    queue_pass(OpaquePass, PbrMaterial::Opaque, _pbr_materials);
+    queue_pass(TintPass, PbrMaterial::Blend, _base_color_materials);
+    queue_pass(LitPass, PbrMaterial::Blend, _pbr_materials);
+    if (_sort_draws) {
+      _render_queue.sort();
+    }
+  }
+
   void draw_scene() {
     glm::vec3 env_radiance = _env_color * _env_strength;
     glClearColor(env_radiance.x, env_radiance.y, env_radiance.z, 1.0);
@@ -155,31 +327,75 @@ private:
 
     glm::mat4 view = _camera->view();
     glm::mat4 projection = _camera->projection(aspect);
+    _cull_stats = {};
+    _lod_triangles = 0;
+    float pixel_size = _camera->pixel_size(_screen_fb_height);
+    for (auto &draw : _scene->draws) {
+      _scene->request_mesh(draw.index);
+    }
+    {
+      MICROPROFILE_SCOPEI("Main", "Frustum Culling", 0x44AA44);
+      // primitives of lazy scenes appear as they finish loading
+      if (_draw_bounds_loading) {
+        update_draw_bounds();
+        _draw_bounds_loading = !_scene->idle();
+      }
+      _bvh_stats = {};
+      if (!_frustum_culling) {
+        _visible_boxes.assign(_draw_culler.size(), 1);
+      } else if (_bvh_culling) {
+        _draw_bvh.cull(projection * view, _visible_boxes, &_bvh_stats);
+      } else {
+        _draw_culler.cull(projection * view, _visible_boxes);
+      }
+      _culled_primitives = (size_t)std::count(
+          _visible_boxes.begin(), _visible_boxes.end(), (uint8_t)0);
+    }
+    queue_draws(view);
 
-    auto draw_mode =
-        [&](PbrMaterial::Mode mode,
+    auto draw_pass =
+        [&](uint32_t pass,
             const std::vector<std::unique_ptr<PbrMaterial>> &materials) {
-          for (auto &draw : _scene->draws) {
-            for (auto &prim : _scene->meshes[draw.index]) {
-              auto *mat = materials[prim.material].get();
-              if (mat->mode != mode) {
-                continue;
-              }
-              mat->model = draw.transform;
-              mat->view = view;
-              mat->projection = projection;
-
-              glm::vec3 light_dir_ws =
-                  polar_to_cartesian(_light_yaw, _light_pitch);
-              glm::vec3 light_dir_vs = view * glm::vec4(light_dir_ws, 0.0f);
-
-              mat->light_dir_vs = glm::normalize(light_dir_vs);
-              mat->light_radiance = _light_color * _light_strength;
-              mat->env_radiance = env_radiance;
-              mat->lut = _env_brdf_lut.get();
-
-              mat->use();
-              prim.mesh->draw();
+          for (auto &packet : _render_queue.packets()) {
+            if (packet.pass != pass) {
+              continue;
+            }
+            auto [draw_index, prim_index] = _box_primitives[packet.item];
+            auto &draw = _scene->draws[draw_index];
+            auto &prim = _scene->meshes[draw.index][prim_index];
+            auto *mat = materials[prim.material].get();
+            mat->model = draw.transform;
+            mat->view = view;
+            mat->projection = projection;
+
+            glm::vec3 light_dir_ws =
+                polar_to_cartesian(_light_yaw, _light_pitch);
+            glm::vec3 light_dir_vs = view * glm::vec4(light_dir_ws, 0.0f);
+
+            mat->light_dir_vs = glm::normalize(light_dir_vs);
+            mat->light_radiance = _light_color * _light_strength;
+            mat->env_radiance = env_radiance;
+            mat->lut = _env_brdf_lut.get();
+            mat->mesh = prim.mesh.get();
+
+            mat->use();
+            auto model_view = view * draw.transform;
+            size_t lod = 0;
+            if (_lod_selection) {
+              lod = prim.mesh->select_lod(
+                  model_view, pixel_size, _lod_pixel_error);
+            }
+            if (!prim.mesh->lods().empty()) {
+              _lod_triangles += prim.mesh->lods()[lod].index_count / 3;
+            }
+            // meshlets only cover the full detail level
+            if (_meshlet_culling && lod == 0) {
+              prim.mesh->draw_culled(model_view,
+                                     projection,
+                                     !mat->double_sided,
+                                     &_cull_stats);
+            } else {
+              prim.mesh->draw_lod(lod);
             }
           }
         };
@@ -189,7 +405,7 @@ private:
       MICROPROFILE_SCOPEI("Main", "Opaque Render", 0x122277);
       glDisable(GL_BLEND);
       glDepthMask(GL_TRUE);
-      draw_mode(PbrMaterial::Opaque, _pbr_materials);
+      draw_pass(OpaquePass, _pbr_materials);
     }
     {
       MICROPROFILE_SCOPEGPUI("Transparent Tint", 0x17AAFF);
@@ -199,14 +415,14 @@ private:
       glDepthMask(GL_FALSE);
       glBlendFunc(GL_ZERO, GL_SRC_COLOR);
       // tint objects covered by transparent ones
-      draw_mode(PbrMaterial::Blend, _base_color_materials);
+      draw_pass(TintPass, _base_color_materials);
     }
 
     {
       MICROPROFILE_SCOPEGPUI("Transparent Lit", 0xBB8122);
       MICROPROFILE_SCOPEI("Main", "Transparent Lit", 0xBB8122);
       glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-      draw_mode(PbrMaterial::Blend, _pbr_materials);
+      draw_pass(LitPass, _pbr_materials);
     }
   }
 
@@ -250,6 +466,9 @@ private:
   }
 
   void update() override {
+    _scene->update();
+    _texture_streamer->update();
+    _program_reloader->update();
     update_frame_buffer();
     draw_ui();
     draw();
@@ -262,6 +481,27 @@ private:
   float _env_strength = 1.0f;
   glm::vec3 _env_color = glm::vec3(1.0, 1.0, 1.0);
 
+  bool _frustum_culling = true;
+  bool _bvh_culling = true;
+  FrustumCuller _draw_culler;
+  Bvh _draw_bvh;
+  BvhCullStats _bvh_stats{};
+  // world space box of every primitive of every draw, and the indices of
+  // the draw and primitive it belongs to
+  std::vector<Aabb> _draw_boxes;
+  std::vector<std::pair<uint32_t, uint32_t>> _box_primitives;
+  bool _draw_bounds_loading = true;
+  std::vector<uint8_t> _visible_boxes;
+  size_t _culled_primitives = 0;
+  enum Pass : uint32_t { OpaquePass, TintPass, LitPass };
+  bool _sort_draws = true;
+  RenderQueue _render_queue;
+  bool _meshlet_culling = true;
+  MeshletCullStats _cull_stats{};
+  bool _lod_selection = true;
+  float _lod_pixel_error = 1.0f;
+  size_t _lod_triangles = 0;
+
   std::vector<std::unique_ptr<PbrMaterial>> _pbr_materials;
   std::vector<std::unique_ptr<PbrMaterial>> _base_color_materials;
   std::unique_ptr<ToneMappingMaterial> _tone_mapping_material{};
@@ -278,6 +518,11 @@ private:
 
   std::unique_ptr<Renderer> _renderer;
   std::unique_ptr<ModelViewerCamera> _camera;
+  std::unique_ptr<TextureStreamer> _texture_streamer;
+  std::unique_ptr<GeometryPool> _geometry_pool;
+  std::unique_ptr<TextureRegistry> _texture_registry;
+  std::unique_ptr<ProgramReloader> _program_reloader;
+  std::unique_ptr<ProgramRegistry> _program_registry;
   std::unique_ptr<Gltf> _scene;
 };
 
@@ -5,6 +5,9 @@ struct TransformBlock {
   glm::mat4 MV;
   glm::mat4 I_MV;
   glm::mat4 P;
+  glm::vec3 position_scale;
+  int32_t packed_vertex;
+  glm::vec4 position_offset; // use glm::vec4 for padding
 };
 
 struct ParamsBlock {
@@ -18,47 +21,82 @@ struct ParamsBlock {
   glm::vec4 light_radiance;  // use glm::vec4 for padding
   glm::vec4 env_radiance;    // use glm::vec4 for padding
 };
+std::vector<std::string> feature_defines(uint32_t features) {
+  std::vector<std::string> defines;
+  if ((features & PbrMaterial::NormalMap) == 0) {
+    defines.emplace_back("NO_NORMAL_MAP");
+  }
+  if ((features & PbrMaterial::OcclusionMap) == 0) {
+    defines.emplace_back("NO_OCCLUSION_MAP");
+  }
+  if ((features & PbrMaterial::EmissionMap) == 0) {
+    defines.emplace_back("NO_EMISSION_MAP");
+  }
+  if ((features & PbrMaterial::MetallicRoughnessMap) == 0) {
+    defines.emplace_back("NO_METALLIC_ROUGHNESS_MAP");
+  }
+  return defines;
+}
 } // namespace
 
-PbrMaterial::PbrMaterial(bool show_base_color) {
-  const char *frag_file =
-      show_base_color ? "shaders/pbr_base_color.frag" : "shaders/pbr.frag";
-  _program = Program::create_from_files("shaders/pbr.vert", frag_file);
-
-#define INIT_UNIFORM_LOCATION(name)                                            \
-  _##name##_location = glGetUniformLocation(_program->get(), #name "_tex")
-
-  INIT_UNIFORM_LOCATION(base_color);
-  INIT_UNIFORM_LOCATION(metallic_roughness);
-  INIT_UNIFORM_LOCATION(normal);
-  INIT_UNIFORM_LOCATION(occlusion);
-  INIT_UNIFORM_LOCATION(emission);
-  INIT_UNIFORM_LOCATION(lut);
-
-#undef INIT_UNIFORM_LOCATION
+PbrMaterial::PbrMaterial(ProgramRegistry *programs,
+                         bool show_base_color,
+                         uint32_t features)
+    : _features(show_base_color ? 0 : features) {
+  // the base color program samples no other maps and has no variants
+  if (show_base_color) {
+    _program =
+        programs->get("shaders/pbr.vert", "shaders/pbr_base_color.frag");
+  } else {
+    _program = programs->get(
+        "shaders/pbr.vert", "shaders/pbr.frag", feature_defines(features));
+  }
 
-  GLuint transform_index = glGetUniformBlockIndex(_program->get(), "Transform");
-  glUniformBlockBinding(_program->get(), transform_index, 0);
-  GLuint params_index = glGetUniformBlockIndex(_program->get(), "Params");
-  glUniformBlockBinding(_program->get(), params_index, 1);
+  // set up once per program, later materials only find them bound
+  _program->bind_sampler("base_color_tex", 0);
+  _program->bind_sampler("metallic_roughness_tex", 1);
+  _program->bind_sampler("normal_tex", 2);
+  _program->bind_sampler("occlusion_tex", 3);
+  _program->bind_sampler("emission_tex", 4);
+  _program->bind_sampler("lut_tex", 5);
+  _program->bind_uniform_block("Transform", 0);
+  _program->bind_uniform_block("Params", 1);
 
   _transform_buffer = std::make_unique<Buffer>(nullptr, sizeof(TransformBlock));
   _params_buffer = std::make_unique<Buffer>(nullptr, sizeof(ParamsBlock));
 }
 
+const Program &PbrMaterial::program() const {
+  return *_program;
+}
+
+void PbrMaterial::request_programs(ProgramRegistry *programs,
+                                   uint32_t features) {
+  programs->request(
+      "shaders/pbr.vert", "shaders/pbr.frag", feature_defines(features));
+  programs->request("shaders/pbr.vert", "shaders/pbr_base_color.frag");
+}
+
 void PbrMaterial::use() {
   glUseProgram(_program->get());
 
 #define ASSIGN_TEXTURE(index, name)                                            \
   glActiveTexture(GL_TEXTURE0 + index);                                        \
-  glBindTexture(GL_TEXTURE_2D, name != nullptr ? name->get() : 0);             \
-  glUniform1i(_##name##_location, index)
+  glBindTexture(GL_TEXTURE_2D, name != nullptr ? name->get() : 0)
 
   ASSIGN_TEXTURE(0, base_color);
-  ASSIGN_TEXTURE(1, metallic_roughness);
-  ASSIGN_TEXTURE(2, normal);
-  ASSIGN_TEXTURE(3, occlusion);
-  ASSIGN_TEXTURE(4, emission);
+  if (_features & MetallicRoughnessMap) {
+    ASSIGN_TEXTURE(1, metallic_roughness);
+  }
+  if (_features & NormalMap) {
+    ASSIGN_TEXTURE(2, normal);
+  }
+  if (_features & OcclusionMap) {
+    ASSIGN_TEXTURE(3, occlusion);
+  }
+  if (_features & EmissionMap) {
+    ASSIGN_TEXTURE(4, emission);
+  }
   ASSIGN_TEXTURE(5, lut);
 
 #undef ASSIGN_TEXTURE
@@ -68,6 +106,11 @@ void PbrMaterial::use() {
   transform_block.MV = view * model;
   transform_block.I_MV = glm::inverse(transform_block.MV);
   transform_block.P = projection;
+  if (mesh != nullptr && mesh->packed()) {
+    transform_block.position_scale = mesh->position_scale();
+    transform_block.packed_vertex = 1;
+    transform_block.position_offset = glm::vec4(mesh->position_offset(), 0.0f);
+  }
   glBindBuffer(GL_UNIFORM_BUFFER, _transform_buffer->get());
   glBufferSubData(
       GL_UNIFORM_BUFFER, 0, sizeof(TransformBlock), &transform_block);
@@ -99,32 +142,35 @@ void PbrMaterial::use() {
   }
 }
 
-ToneMappingMaterial::ToneMappingMaterial() {
-  _program = Program::create_from_files("shaders/blit.vert",
-                                        "shaders/aces_tonemapping.frag");
-  _transform_location = glGetUniformLocation(_program->get(), "transform");
-  _image_location = glGetUniformLocation(_program->get(), "main_tex");
-  _exposure_location = glGetUniformLocation(_program->get(), "exposure");
+ToneMappingMaterial::ToneMappingMaterial(ProgramRegistry *programs) {
+  _program =
+      programs->get("shaders/blit.vert", "shaders/aces_tonemapping.frag");
+  _program->bind_sampler("main_tex", 0);
 }
 
 void ToneMappingMaterial::use() {
   glUseProgram(_program->get());
   glm::mat4 transform = projection * model * view;
-  glUniformMatrix4fv(_transform_location, 1, false, (GLfloat *)&transform);
+  glUniformMatrix4fv(_program->uniform_location("transform"),
+                     1,
+                     false,
+                     (GLfloat *)&transform);
   glActiveTexture(GL_TEXTURE0);
   glBindTexture(GL_TEXTURE_2D, main_tex != nullptr ? main_tex->get() : 0);
-  glUniform1i(_image_location, 0);
-  glUniform1f(_exposure_location, exposure);
+  glUniform1f(_program->uniform_location("exposure"), exposure);
 }
 
-PrecomputeEnvBrdfMaterial::PrecomputeEnvBrdfMaterial() {
-  _program = Program::create_from_files("shaders/blit.vert",
-                                        "shaders/pre_compute_env_brdf.frag");
-  _transform_location = glGetUniformLocation(_program->get(), "transform");
+PrecomputeEnvBrdfMaterial::PrecomputeEnvBrdfMaterial(
+    ProgramRegistry *programs) {
+  _program =
+      programs->get("shaders/blit.vert", "shaders/pre_compute_env_brdf.frag");
 }
 
 void PrecomputeEnvBrdfMaterial::use() {
   glUseProgram(_program->get());
   glm::mat4 transform = projection * model * view;
-  glUniformMatrix4fv(_transform_location, 1, false, (GLfloat *)&transform);
+  glUniformMatrix4fv(_program->uniform_location("transform"),
+                     1,
+                     false,
+                     (GLfloat *)&transform);
 }
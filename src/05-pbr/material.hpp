@@ -1,5 +1,6 @@
 #pragma once
 
+#include "../common/program_registry.hpp"
 #include "../common/renderer.hpp"
 #include "../common/shader.hpp"
 #include "../common/texture.hpp"
@@ -7,6 +8,15 @@
 class PbrMaterial : public IMaterial {
 public:
   enum Mode { Opaque, Blend };
+  // Maps sampled by the program of a material. Maps left out are not bound
+  // and read as their defaults, see pbr.frag.
+  enum Feature : uint32_t {
+    NormalMap = 1 << 0,
+    OcclusionMap = 1 << 1,
+    EmissionMap = 1 << 2,
+    MetallicRoughnessMap = 1 << 3,
+    AllFeatures = (1 << 4) - 1,
+  };
 
   Mode mode;
   bool double_sided;
@@ -22,22 +32,27 @@ public:
   Texture2D *emission;
   glm::vec3 emission_factor;
   Texture2D *lut;
+  // mesh drawn next, for dequantizing packed vertices
+  const Mesh *mesh = nullptr;
 
   glm::vec3 light_dir_vs;
   glm::vec3 light_radiance;
   glm::vec3 env_radiance;
 
-  explicit PbrMaterial(bool show_base_color);
+  PbrMaterial(ProgramRegistry *programs,
+              bool show_base_color,
+              uint32_t features = AllFeatures);
   void use() override;
+  // materials of equal programs can be drawn without switching programs
+  const Program &program() const;
+
+  // start building the programs of all feature sets before making any
+  // material
+  static void request_programs(ProgramRegistry *programs, uint32_t features);
 
 private:
-  std::unique_ptr<Program> _program;
-  GLint _base_color_location;
-  GLint _metallic_roughness_location;
-  GLint _normal_location;
-  GLint _occlusion_location;
-  GLint _emission_location;
-  GLint _lut_location;
+  uint32_t _features;
+  std::shared_ptr<Program> _program;
 
   std::unique_ptr<Buffer> _transform_buffer;
   std::unique_ptr<Buffer> _params_buffer;
@@ -47,22 +62,18 @@ class ToneMappingMaterial : public IMaterial {
 public:
   float exposure = 1.0f;
 
-  ToneMappingMaterial();
+  explicit ToneMappingMaterial(ProgramRegistry *programs);
   void use() override;
 
 private:
-  std::unique_ptr<Program> _program;
-  GLint _transform_location;
-  GLint _image_location;
-  GLint _exposure_location;
+  std::shared_ptr<Program> _program;
 };
 
 class PrecomputeEnvBrdfMaterial : public IMaterial {
 public:
-  PrecomputeEnvBrdfMaterial();
+  explicit PrecomputeEnvBrdfMaterial(ProgramRegistry *programs);
   void use() override;
 
 private:
-  std::unique_ptr<Program> _program;
-  GLint _transform_location;
+  std::shared_ptr<Program> _program;
 };
@@ -3,6 +3,7 @@
 #include "utils.hpp"
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+#include <cmath>
 #include <ctime>
 #include <glm/gtc/matrix_transform.hpp>
 #include <imgui/imgui.h>
@@ -276,6 +277,10 @@ glm::mat4 ModelViewerCamera::projection(float aspect) const {
   return glm::perspective(_field_of_view, aspect, 0.01f, 100.0f);
 }
 
+float ModelViewerCamera::pixel_size(int viewport_height) const {
+  return 2.0f * std::tan(_field_of_view * 0.5f) / (float)viewport_height;
+}
+
 glm::mat4 ModelViewerCamera::view() const {
   glm::vec3 pos = position();
   glm::mat4 view =
@@ -70,6 +70,8 @@ public:
   glm::mat4 view() const;
   glm::mat4 projection(float aspect) const;
   glm::vec3 position() const;
+  // height of a pixel at distance 1 from the camera
+  float pixel_size(int viewport_height) const;
 
 private:
   float _focus_height = 0.25f;
@@ -0,0 +1,540 @@
+#include "block_compression.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define BLOCK_COMPRESSION_SSE2
+#include <emmintrin.h>
+#endif
+
+GLenum block_format_to_gl(BlockFormat format) {
+  switch (format) {
+  case BlockFormat::BC1:
+    return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+  case BlockFormat::BC3:
+    return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+  case BlockFormat::BC4:
+    return GL_COMPRESSED_RED_RGTC1;
+  case BlockFormat::BC5:
+    return GL_COMPRESSED_RG_RGTC2;
+  case BlockFormat::BC7:
+    return GL_COMPRESSED_RGBA_BPTC_UNORM;
+  }
+  throw std::runtime_error("invalid block format");
+}
+
+bool compressed_format_supported(GLenum gl_format) {
+  switch (gl_format) {
+  case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+  case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+    return GLEW_EXT_texture_compression_s3tc;
+  case GL_COMPRESSED_RED_RGTC1:
+  case GL_COMPRESSED_RG_RGTC2:
+    return GLEW_VERSION_3_0 || GLEW_ARB_texture_compression_rgtc;
+  case GL_COMPRESSED_RGBA_BPTC_UNORM:
+    return GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc;
+  default:
+    return false;
+  }
+}
+
+size_t compressed_block_bytes(GLenum gl_format) {
+  switch (gl_format) {
+  case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+  case GL_COMPRESSED_RED_RGTC1:
+    return 8;
+  case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+  case GL_COMPRESSED_RG_RGTC2:
+  case GL_COMPRESSED_RGBA_BPTC_UNORM:
+    return 16;
+  default:
+    throw std::runtime_error("unsupported compressed texture format");
+  }
+}
+
+namespace {
+// one array per channel, so four texels are compared at once
+struct Block {
+  alignas(16) float channels[4][16];
+};
+
+void load_block(const uint8_t *rgba,
+                int width,
+                int height,
+                int block_x,
+                int block_y,
+                Block &block) {
+  for (int y = 0; y < 4; y++) {
+    int src_y = std::min(block_y * 4 + y, height - 1);
+    for (int x = 0; x < 4; x++) {
+      int src_x = std::min(block_x * 4 + x, width - 1);
+      auto texel = rgba + ((size_t)src_y * width + src_x) * 4;
+      for (int c = 0; c < 4; c++) {
+        block.channels[c][y * 4 + x] = texel[c];
+      }
+    }
+  }
+}
+
+// Pick the closest palette entry for every texel comparing the first
+// channel_count channels. Returns the summed squared error.
+float fit_indices(const Block &block,
+                  const float (*palette)[4],
+                  int palette_size,
+                  int channel_count,
+                  uint8_t *indices) {
+  float total = 0.0f;
+#ifdef BLOCK_COMPRESSION_SSE2
+  for (int i = 0; i < 16; i += 4) {
+    auto best = _mm_set1_ps(FLT_MAX);
+    auto best_index = _mm_setzero_si128();
+    for (int p = 0; p < palette_size; p++) {
+      auto error = _mm_setzero_ps();
+      for (int c = 0; c < channel_count; c++) {
+        auto d = _mm_sub_ps(_mm_load_ps(&block.channels[c][i]),
+                            _mm_set1_ps(palette[p][c]));
+        error = _mm_add_ps(error, _mm_mul_ps(d, d));
+      }
+      auto closer = _mm_castps_si128(_mm_cmplt_ps(error, best));
+      best = _mm_min_ps(error, best);
+      best_index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(p)),
+                                _mm_andnot_si128(closer, best_index));
+    }
+    alignas(16) int32_t lane_index[4];
+    alignas(16) float lane_error[4];
+    _mm_store_si128(reinterpret_cast<__m128i *>(lane_index), best_index);
+    _mm_store_ps(lane_error, best);
+    for (int k = 0; k < 4; k++) {
+      indices[i + k] = (uint8_t)lane_index[k];
+      total += lane_error[k];
+    }
+  }
+#else
+  for (int i = 0; i < 16; i++) {
+    float best = FLT_MAX;
+    for (int p = 0; p < palette_size; p++) {
+      float error = 0.0f;
+      for (int c = 0; c < channel_count; c++) {
+        auto d = block.channels[c][i] - palette[p][c];
+        error += d * d;
+      }
+      if (error < best) {
+        best = error;
+        indices[i] = (uint8_t)p;
+      }
+    }
+    total += best;
+  }
+#endif
+  return total;
+}
+
+// endpoints of the extent of the texels along their principal axis
+void principal_endpoints(const Block &block,
+                         int channel_count,
+                         float *e0,
+                         float *e1) {
+  float mean[4]{};
+  float axis[4]{};
+  for (int c = 0; c < channel_count; c++) {
+    float min = 255.0f, max = 0.0f;
+    for (int i = 0; i < 16; i++) {
+      mean[c] += block.channels[c][i];
+      min = std::min(min, block.channels[c][i]);
+      max = std::max(max, block.channels[c][i]);
+    }
+    mean[c] /= 16.0f;
+    axis[c] = max - min;
+  }
+
+  float cov[4][4]{};
+  for (int i = 0; i < 16; i++) {
+    for (int a = 0; a < channel_count; a++) {
+      for (int b = a; b < channel_count; b++) {
+        cov[a][b] += (block.channels[a][i] - mean[a]) *
+                     (block.channels[b][i] - mean[b]);
+      }
+    }
+  }
+  for (int a = 0; a < channel_count; a++) {
+    for (int b = 0; b < a; b++) {
+      cov[a][b] = cov[b][a];
+    }
+  }
+
+  // power iteration, the extent per channel is a good first guess
+  for (int iter = 0; iter < 8; iter++) {
+    float next[4]{};
+    float scale = 0.0f;
+    for (int a = 0; a < channel_count; a++) {
+      for (int b = 0; b < channel_count; b++) {
+        next[a] += cov[a][b] * axis[b];
+      }
+      scale = std::max(scale, std::abs(next[a]));
+    }
+    if (scale < 1e-6f) {
+      break;
+    }
+    for (int a = 0; a < channel_count; a++) {
+      axis[a] = next[a] / scale;
+    }
+  }
+
+  float length = 0.0f;
+  for (int c = 0; c < channel_count; c++) {
+    length += axis[c] * axis[c];
+  }
+  float t_min = 0.0f, t_max = 0.0f;
+  if (length > 1e-12f) {
+    length = std::sqrt(length);
+    for (int c = 0; c < channel_count; c++) {
+      axis[c] /= length;
+    }
+    t_min = FLT_MAX;
+    t_max = -FLT_MAX;
+    for (int i = 0; i < 16; i++) {
+      float t = 0.0f;
+      for (int c = 0; c < channel_count; c++) {
+        t += (block.channels[c][i] - mean[c]) * axis[c];
+      }
+      t_min = std::min(t_min, t);
+      t_max = std::max(t_max, t);
+    }
+  }
+  for (int c = 0; c < channel_count; c++) {
+    e0[c] = std::clamp(mean[c] + axis[c] * t_min, 0.0f, 255.0f);
+    e1[c] = std::clamp(mean[c] + axis[c] * t_max, 0.0f, 255.0f);
+  }
+}
+
+// Least squares fit of both endpoints given the interpolation weight of e1
+// for every texel. Fails if all texels use the same weight.
+bool refine_endpoints(const Block &block,
+                      int channel_count,
+                      const float *weights,
+                      float *e0,
+                      float *e1) {
+  float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+  float ax[4]{}, bx[4]{};
+  for (int i = 0; i < 16; i++) {
+    float b = weights[i];
+    float a = 1.0f - b;
+    aa += a * a;
+    ab += a * b;
+    bb += b * b;
+    for (int c = 0; c < channel_count; c++) {
+      ax[c] += a * block.channels[c][i];
+      bx[c] += b * block.channels[c][i];
+    }
+  }
+  float det = aa * bb - ab * ab;
+  if (std::abs(det) < 1e-6f) {
+    return false;
+  }
+  for (int c = 0; c < channel_count; c++) {
+    e0[c] = std::clamp((bb * ax[c] - ab * bx[c]) / det, 0.0f, 255.0f);
+    e1[c] = std::clamp((aa * bx[c] - ab * ax[c]) / det, 0.0f, 255.0f);
+  }
+  return true;
+}
+
+class BitWriter {
+public:
+  explicit BitWriter(uint8_t *out) : _out(out) {}
+
+  void write(uint32_t value, int bits) {
+    for (int i = 0; i < bits; i++, _pos++) {
+      if ((value >> i) & 1) {
+        _out[_pos >> 3] |= (uint8_t)(1 << (_pos & 7));
+      }
+    }
+  }
+
+private:
+  uint8_t *_out;
+  int _pos = 0;
+};
+
+uint16_t quantize_565(const float *color) {
+  auto r = (uint32_t)std::lround(color[0] * 31.0f / 255.0f);
+  auto g = (uint32_t)std::lround(color[1] * 63.0f / 255.0f);
+  auto b = (uint32_t)std::lround(color[2] * 31.0f / 255.0f);
+  return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+void expand_565(uint16_t value, float *color) {
+  uint32_t r = (value >> 11) & 31;
+  uint32_t g = (value >> 5) & 63;
+  uint32_t b = value & 31;
+  color[0] = (float)((r << 3) | (r >> 2));
+  color[1] = (float)((g << 2) | (g >> 4));
+  color[2] = (float)((b << 3) | (b >> 2));
+  color[3] = 255.0f;
+}
+
+// BC1 in four color mode, which is also the color part of BC3
+void encode_bc1(const Block &block, uint8_t *out) {
+  // weight of c1 for the indices 0 to 3
+  const float weights[] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+
+  float e0[4], e1[4];
+  principal_endpoints(block, 3, e0, e1);
+  float best_error = FLT_MAX;
+  uint16_t best_c0 = 0, best_c1 = 0;
+  uint8_t best_indices[16]{};
+  for (int iter = 0; iter < 2; iter++) {
+    auto c0 = quantize_565(e0);
+    auto c1 = quantize_565(e1);
+    // c0 > c1 selects four color mode
+    if (c0 < c1) {
+      std::swap(c0, c1);
+    }
+    float palette[4][4];
+    expand_565(c0, palette[0]);
+    expand_565(c1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+      palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+      palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+    }
+    uint8_t indices[16];
+    auto error = fit_indices(block, palette, c0 == c1 ? 1 : 4, 3, indices);
+    if (error < best_error) {
+      best_error = error;
+      best_c0 = c0;
+      best_c1 = c1;
+      std::memcpy(best_indices, indices, sizeof(indices));
+    }
+
+    float texel_weights[16];
+    for (int i = 0; i < 16; i++) {
+      texel_weights[i] = weights[indices[i]];
+    }
+    float r0[4], r1[4];
+    if (!refine_endpoints(block, 3, texel_weights, r0, r1)) {
+      break;
+    }
+    // the refined endpoints refer to the palette after the swap
+    std::copy(r0, r0 + 3, e0);
+    std::copy(r1, r1 + 3, e1);
+  }
+
+  std::memset(out, 0, 8);
+  BitWriter writer(out);
+  writer.write(best_c0, 16);
+  writer.write(best_c1, 16);
+  for (int i = 0; i < 16; i++) {
+    writer.write(best_indices[i], 2);
+  }
+}
+
+// single channel with eight interpolated values, BC4 and both halves of BC5
+void encode_bc4(const Block &block, int channel, uint8_t *out) {
+  Block single{};
+  std::memcpy(single.channels[0], block.channels[channel], sizeof(float) * 16);
+
+  float e0 = 0.0f, e1 = 255.0f;
+  for (int i = 0; i < 16; i++) {
+    e0 = std::max(e0, single.channels[0][i]);
+    e1 = std::min(e1, single.channels[0][i]);
+  }
+
+  float best_error = FLT_MAX;
+  int best_a0 = 0, best_a1 = 0;
+  uint8_t best_indices[16]{};
+  for (int iter = 0; iter < 2; iter++) {
+    auto a0 = (int)std::lround(e0);
+    auto a1 = (int)std::lround(e1);
+    // a0 > a1 selects eight value mode
+    if (a0 < a1) {
+      std::swap(a0, a1);
+    }
+    float palette[8][4]{};
+    palette[0][0] = (float)a0;
+    palette[1][0] = (float)a1;
+    for (int i = 2; i < 8; i++) {
+      palette[i][0] = (float)((8 - i) * a0 + (i - 1) * a1) / 7.0f;
+    }
+    uint8_t indices[16];
+    auto error = fit_indices(single, palette, a0 == a1 ? 1 : 8, 1, indices);
+    if (error < best_error) {
+      best_error = error;
+      best_a0 = a0;
+      best_a1 = a1;
+      std::memcpy(best_indices, indices, sizeof(indices));
+    }
+
+    float texel_weights[16];
+    for (int i = 0; i < 16; i++) {
+      auto index = indices[i];
+      texel_weights[i] = index <= 1 ? (float)index : (float)(index - 1) / 7.0f;
+    }
+    if (!refine_endpoints(single, 1, texel_weights, &e0, &e1)) {
+      break;
+    }
+  }
+
+  std::memset(out, 0, 8);
+  BitWriter writer(out);
+  writer.write(best_a0, 8);
+  writer.write(best_a1, 8);
+  for (int i = 0; i < 16; i++) {
+    writer.write(best_indices[i], 3);
+  }
+}
+
+// 7 bit endpoint per channel plus a p-bit shared by all channels
+void quantize_bc7_endpoint(const float *color, uint32_t *value, uint32_t *p) {
+  float best_error = FLT_MAX;
+  for (uint32_t bit = 0; bit < 2; bit++) {
+    uint32_t q[4];
+    float error = 0.0f;
+    for (int c = 0; c < 4; c++) {
+      q[c] = (uint32_t)std::clamp(
+          (int)std::lround((color[c] - (float)bit) / 2.0f), 0, 127);
+      auto d = (float)((q[c] << 1) | bit) - color[c];
+      error += d * d;
+    }
+    if (error < best_error) {
+      best_error = error;
+      std::copy(q, q + 4, value);
+      *p = bit;
+    }
+  }
+}
+
+// BC7 mode 6, a single subset with 4 bit indices and RGBA endpoints
+void encode_bc7(const Block &block, uint8_t *out) {
+  const uint32_t weights[] = {
+      0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+  float e0[4], e1[4];
+  principal_endpoints(block, 4, e0, e1);
+  float best_error = FLT_MAX;
+  uint32_t best_q[2][4]{};
+  uint32_t best_p[2]{};
+  uint8_t best_indices[16]{};
+  for (int iter = 0; iter < 2; iter++) {
+    uint32_t q[2][4], p[2];
+    quantize_bc7_endpoint(e0, q[0], &p[0]);
+    quantize_bc7_endpoint(e1, q[1], &p[1]);
+    float palette[16][4];
+    for (int i = 0; i < 16; i++) {
+      for (int c = 0; c < 4; c++) {
+        auto a = (q[0][c] << 1) | p[0];
+        auto b = (q[1][c] << 1) | p[1];
+        palette[i][c] =
+            (float)(((64 - weights[i]) * a + weights[i] * b + 32) >> 6);
+      }
+    }
+    uint8_t indices[16];
+    auto error = fit_indices(block, palette, 16, 4, indices);
+    if (error < best_error) {
+      best_error = error;
+      std::memcpy(best_q, q, sizeof(q));
+      std::memcpy(best_p, p, sizeof(p));
+      std::memcpy(best_indices, indices, sizeof(indices));
+    }
+
+    float texel_weights[16];
+    for (int i = 0; i < 16; i++) {
+      texel_weights[i] = (float)weights[indices[i]] / 64.0f;
+    }
+    if (!refine_endpoints(block, 4, texel_weights, e0, e1)) {
+      break;
+    }
+  }
+
+  // the most significant bit of the first index is implied to be 0, the
+  // weights are symmetric so swapping the endpoints flips the indices
+  if (best_indices[0] >= 8) {
+    std::swap(best_q[0], best_q[1]);
+    std::swap(best_p[0], best_p[1]);
+    for (auto &index : best_indices) {
+      index = (uint8_t)(15 - index);
+    }
+  }
+
+  std::memset(out, 0, 16);
+  BitWriter writer(out);
+  writer.write(1 << 6, 7);
+  for (int c = 0; c < 4; c++) {
+    writer.write(best_q[0][c], 7);
+    writer.write(best_q[1][c], 7);
+  }
+  writer.write(best_p[0], 1);
+  writer.write(best_p[1], 1);
+  writer.write(best_indices[0], 3);
+  for (int i = 1; i < 16; i++) {
+    writer.write(best_indices[i], 4);
+  }
+}
+
+void encode_block(const Block &block, BlockFormat format, uint8_t *out) {
+  switch (format) {
+  case BlockFormat::BC1:
+    encode_bc1(block, out);
+    break;
+  case BlockFormat::BC3:
+    encode_bc4(block, 3, out);
+    encode_bc1(block, out + 8);
+    break;
+  case BlockFormat::BC4:
+    encode_bc4(block, 0, out);
+    break;
+  case BlockFormat::BC5:
+    encode_bc4(block, 0, out);
+    encode_bc4(block, 1, out + 8);
+    break;
+  case BlockFormat::BC7:
+    encode_bc7(block, out);
+    break;
+  }
+}
+} // namespace
+
+std::vector<uint8_t> compress_blocks(const uint8_t *rgba,
+                                     int width,
+                                     int height,
+                                     BlockFormat format) {
+  auto block_bytes = compressed_block_bytes(block_format_to_gl(format));
+  int blocks_x = (width + 3) / 4;
+  int blocks_y = (height + 3) / 4;
+  std::vector<uint8_t> blocks(block_bytes * blocks_x * blocks_y);
+  ThreadPool::global().parallel_for(blocks_y, [&](size_t y) {
+    Block block;
+    auto row = blocks.data() + block_bytes * blocks_x * y;
+    for (int x = 0; x < blocks_x; x++) {
+      load_block(rgba, width, height, x, (int)y, block);
+      encode_block(block, format, row + block_bytes * x);
+    }
+  });
+  return blocks;
+}
+
+MipChain compress_mip_chain(const MipChain &chain, BlockFormat format) {
+  if (chain.type != GL_UNSIGNED_BYTE || chain.channels != 4 ||
+      chain.compressed_format != GL_NONE) {
+    throw std::runtime_error("block compression needs an RGBA8 mip chain");
+  }
+  auto &top = chain.levels[0];
+  auto compressed = mip_chain_layout(chain.type,
+                                     chain.channels,
+                                     block_format_to_gl(format),
+                                     top.width,
+                                     top.height,
+                                     (int)chain.levels.size());
+  compressed.data.resize(compressed.size());
+  for (size_t i = 0; i < chain.levels.size(); i++) {
+    auto &level = chain.levels[i];
+    auto blocks =
+        compress_blocks(chain.level_data(i), level.width, level.height, format);
+    std::memcpy(compressed.data.data() + compressed.levels[i].offset,
+                blocks.data(),
+                blocks.size());
+  }
+  return compressed;
+}
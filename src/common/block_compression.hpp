@@ -0,0 +1,31 @@
+#pragma once
+
+#include "mipmap.hpp"
+#include <GL/glew.h>
+#include <cstdint>
+#include <vector>
+
+enum class BlockFormat {
+  BC1, // RGB, 4 bpp
+  BC3, // RGBA, 8 bpp
+  BC4, // R, 4 bpp
+  BC5, // RG, 8 bpp
+  BC7, // RGBA, 8 bpp, only mode 6 is produced
+};
+
+GLenum block_format_to_gl(BlockFormat format);
+// whether the driver can sample a compressed GL format
+bool compressed_format_supported(GLenum gl_format);
+// bytes of one 4x4 block of a compressed GL format
+size_t compressed_block_bytes(GLenum gl_format);
+
+// Encode tightly packed RGBA8 texels into 4x4 blocks, row by row. Edge blocks
+// of images that are not a multiple of 4 repeat the last row and column.
+// Blocks are encoded in parallel on the global thread pool.
+std::vector<uint8_t> compress_blocks(const uint8_t *rgba,
+                                     int width,
+                                     int height,
+                                     BlockFormat format);
+
+// compress every level of an RGBA8 mip chain
+MipChain compress_mip_chain(const MipChain &chain, BlockFormat format);
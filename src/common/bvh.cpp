@@ -0,0 +1,226 @@
+#include "bvh.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <limits>
+#include <numeric>
+
+namespace {
+const uint32_t max_leaf_size = 4;
+const int bin_count = 16;
+
+Aabb empty_box() {
+  return Aabb{glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX)};
+}
+
+void grow(Aabb &box, const Aabb &other) {
+  box.min = glm::min(box.min, other.min);
+  box.max = glm::max(box.max, other.max);
+}
+
+// in double, unbounded boxes overflow floats
+double surface_area(const Aabb &box) {
+  glm::dvec3 size = box.max - box.min;
+  return 2.0 * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+int center_bin(float center, float min, float scale) {
+  return std::min((int)((center - min) * scale), bin_count - 1);
+}
+
+// Drops the planes box is completely in front of from plane_mask, false when
+// it is completely behind one of them.
+bool clip_box(const Aabb &box, const glm::vec4 *planes, uint32_t &plane_mask) {
+  for (int i = 0; i < 6; i++) {
+    if ((plane_mask & (1u << i)) == 0) {
+      continue;
+    }
+    glm::vec3 normal = planes[i];
+    auto positive = glm::greaterThan(normal, glm::vec3(0.0f));
+    auto furthest = glm::mix(box.min, box.max, positive);
+    if (glm::dot(normal, furthest) + planes[i].w < 0.0f) {
+      return false;
+    }
+    auto nearest = glm::mix(box.max, box.min, positive);
+    if (glm::dot(normal, nearest) + planes[i].w >= 0.0f) {
+      plane_mask &= ~(1u << i);
+    }
+  }
+  return true;
+}
+} // namespace
+
+void Bvh::build(const std::vector<Aabb> &boxes) {
+  _boxes = boxes;
+  _items.resize(boxes.size());
+  std::iota(_items.begin(), _items.end(), 0);
+  _nodes.clear();
+  if (boxes.empty()) {
+    return;
+  }
+
+  std::vector<glm::vec3> centers(boxes.size());
+  for (size_t i = 0; i < boxes.size(); i++) {
+    centers[i] = (boxes[i].min + boxes[i].max) * 0.5f;
+  }
+  _nodes.push_back(Node{{}, 0, (uint32_t)boxes.size(), 0});
+  split(0, centers);
+  refit();
+}
+
+void Bvh::split(uint32_t index, const std::vector<glm::vec3> &centers) {
+  auto first = _nodes[index].first;
+  auto count = _nodes[index].count;
+  if (count <= max_leaf_size) {
+    return;
+  }
+  auto begin = _items.begin() + first;
+  auto end = begin + count;
+
+  Aabb center_bounds = empty_box();
+  for (auto it = begin; it != end; ++it) {
+    center_bounds.min = glm::min(center_bounds.min, centers[*it]);
+    center_bounds.max = glm::max(center_bounds.max, centers[*it]);
+  }
+
+  // the bin boundary with the smallest areas of the children weighted by
+  // their box counts, over all axes
+  double best_cost = std::numeric_limits<double>::infinity();
+  int best_axis = -1;
+  int best_bin = 0;
+  for (int axis = 0; axis < 3; axis++) {
+    float min = center_bounds.min[axis];
+    float extent = center_bounds.max[axis] - min;
+    if (extent <= 0.0f) {
+      continue;
+    }
+    float scale = bin_count / extent;
+    Aabb bin_bounds[bin_count];
+    uint32_t bin_counts[bin_count] = {};
+    for (auto &bounds : bin_bounds) {
+      bounds = empty_box();
+    }
+    for (auto it = begin; it != end; ++it) {
+      int bin = center_bin(centers[*it][axis], min, scale);
+      grow(bin_bounds[bin], _boxes[*it]);
+      bin_counts[bin]++;
+    }
+
+    // cost of the bins from each boundary on
+    double right_costs[bin_count];
+    Aabb right = empty_box();
+    uint32_t right_count = 0;
+    for (int bin = bin_count - 1; bin > 0; bin--) {
+      grow(right, bin_bounds[bin]);
+      right_count += bin_counts[bin];
+      right_costs[bin] = right_count > 0 ? surface_area(right) * right_count
+                                         : 0.0;
+    }
+    Aabb left = empty_box();
+    uint32_t left_count = 0;
+    for (int bin = 1; bin < bin_count; bin++) {
+      grow(left, bin_bounds[bin - 1]);
+      left_count += bin_counts[bin - 1];
+      if (left_count == 0 || left_count == count) {
+        continue;
+      }
+      double cost = surface_area(left) * left_count + right_costs[bin];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_bin = bin;
+      }
+    }
+  }
+
+  auto middle = begin + count / 2;
+  if (best_axis >= 0) {
+    float min = center_bounds.min[best_axis];
+    float scale = bin_count / (center_bounds.max[best_axis] - min);
+    middle = std::partition(begin, end, [&](uint32_t item) {
+      return center_bin(centers[item][best_axis], min, scale) < best_bin;
+    });
+  }
+  // otherwise all centers coincide, halving keeps the leaves small
+
+  auto left_count = (uint32_t)(middle - begin);
+  auto left = (uint32_t)_nodes.size();
+  _nodes[index].left = left;
+  _nodes.push_back(Node{{}, first, left_count, 0});
+  _nodes.push_back(Node{{}, first + left_count, count - left_count, 0});
+  split(left, centers);
+  split(left + 1, centers);
+}
+
+void Bvh::set(uint32_t index, const Aabb &box) {
+  _boxes[index] = box;
+}
+
+void Bvh::refit() {
+  // children come after their parents
+  for (size_t i = _nodes.size(); i-- > 0;) {
+    auto &node = _nodes[i];
+    node.bounds = empty_box();
+    if (node.left == 0) {
+      for (uint32_t j = 0; j < node.count; j++) {
+        grow(node.bounds, _boxes[_items[node.first + j]]);
+      }
+    } else {
+      grow(node.bounds, _nodes[node.left].bounds);
+      grow(node.bounds, _nodes[node.left + 1].bounds);
+    }
+  }
+}
+
+size_t Bvh::size() const {
+  return _boxes.size();
+}
+
+size_t Bvh::node_count() const {
+  return _nodes.size();
+}
+
+void Bvh::cull(const glm::mat4 &view_projection,
+               std::vector<uint8_t> &visible,
+               BvhCullStats *stats) const {
+  visible.assign(_boxes.size(), 0);
+  if (_nodes.empty()) {
+    return;
+  }
+  glm::vec4 planes[6];
+  frustum_planes(view_projection, planes);
+  cull_node(0, planes, 0x3f, visible, stats);
+}
+
+void Bvh::cull_node(uint32_t index,
+                    const glm::vec4 *planes,
+                    uint32_t plane_mask,
+                    std::vector<uint8_t> &visible,
+                    BvhCullStats *stats) const {
+  auto &node = _nodes[index];
+  if (stats != nullptr) {
+    stats->visited_nodes++;
+  }
+  if (!clip_box(node.bounds, planes, plane_mask)) {
+    return;
+  }
+  // inside of all planes, so is everything below
+  if (plane_mask == 0) {
+    for (uint32_t i = 0; i < node.count; i++) {
+      visible[_items[node.first + i]] = 1;
+    }
+    return;
+  }
+  if (node.left != 0) {
+    cull_node(node.left, planes, plane_mask, visible, stats);
+    cull_node(node.left + 1, planes, plane_mask, visible, stats);
+    return;
+  }
+  for (uint32_t i = 0; i < node.count; i++) {
+    auto item = _items[node.first + i];
+    auto mask = plane_mask;
+    visible[item] = clip_box(_boxes[item], planes, mask);
+  }
+  if (stats != nullptr) {
+    stats->tested_boxes += node.count;
+  }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "frustum_culling.hpp"
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+struct BvhCullStats {
+  size_t visited_nodes = 0;
+  // boxes of leaves crossing the frustum, tested one by one
+  size_t tested_boxes = 0;
+};
+
+// Bounding volume hierarchy over boxes, split by the surface area heuristic
+// over binned centers. Frustum culling accepts or rejects whole subtrees
+// where a node is fully inside or outside and only tests the boxes of leaves
+// crossing the frustum.
+class Bvh {
+public:
+  // replaces the hierarchy, box i keeps index i in the results of cull
+  void build(const std::vector<Aabb> &boxes);
+  // Replace the box of index, e.g. after its object moved. The hierarchy is
+  // only valid again after refit.
+  void set(uint32_t index, const Aabb &box);
+  // Grow and shrink the nodes around their boxes without changing the tree,
+  // which gets slower to cull the further boxes move from where they were
+  // built.
+  void refit();
+
+  size_t size() const;
+  size_t node_count() const;
+
+  // visible[i] is 1 when box i intersects the frustum of view_projection, 0
+  // otherwise, as with FrustumCuller::cull.
+  void cull(const glm::mat4 &view_projection,
+            std::vector<uint8_t> &visible,
+            BvhCullStats *stats = nullptr) const;
+
+private:
+  struct Node {
+    Aabb bounds;
+    // range of _items under the node
+    uint32_t first;
+    uint32_t count;
+    // index of the first child, the second follows it, 0 for leaves
+    uint32_t left;
+  };
+
+  void split(uint32_t index, const std::vector<glm::vec3> &centers);
+  void cull_node(uint32_t index,
+                 const glm::vec4 *planes,
+                 uint32_t plane_mask,
+                 std::vector<uint8_t> &visible,
+                 BvhCullStats *stats) const;
+
+  std::vector<Aabb> _boxes;
+  // box indices ordered so that every node covers a contiguous range
+  std::vector<uint32_t> _items;
+  // parents come before their children
+  std::vector<Node> _nodes;
+};
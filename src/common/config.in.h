@@ -1,3 +1,4 @@
 #pragma once
 
-#define DATA_PATH "${CMAKE_SOURCE_DIR}/data"
\ No newline at end of file
+#define DATA_PATH "${CMAKE_SOURCE_DIR}/data"
+#define CACHE_PATH "${CMAKE_BINARY_DIR}/cache"
\ No newline at end of file
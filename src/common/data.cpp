@@ -1,17 +1,145 @@
 #include "data.hpp"
 #include <config.h>
-#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const fs::path &path) {
+#ifdef _WIN32
+  _file = CreateFileW(path.c_str(),
+                      GENERIC_READ,
+                      FILE_SHARE_READ,
+                      nullptr,
+                      OPEN_EXISTING,
+                      FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                      nullptr);
+  if (_file == INVALID_HANDLE_VALUE) {
+    _file = nullptr;
+    throw std::runtime_error("failed to open " + path.string());
+  }
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(_file, &file_size)) {
+    release();
+    throw std::runtime_error("failed to get size of " + path.string());
+  }
+  _size = static_cast<size_t>(file_size.QuadPart);
+  if (_size == 0) {
+    return;
+  }
+  _mapping = CreateFileMappingW(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (_mapping == nullptr) {
+    release();
+    throw std::runtime_error("failed to map " + path.string());
+  }
+  _data = static_cast<const uint8_t *>(
+      MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+  if (_data == nullptr) {
+    release();
+    throw std::runtime_error("failed to map " + path.string());
+  }
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("failed to open " + path.string());
+  }
+  struct stat st {};
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error("failed to get size of " + path.string());
+  }
+  _size = static_cast<size_t>(st.st_size);
+  if (_size == 0) {
+    close(fd);
+    return;
+  }
+  void *ptr = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps its own reference to the file
+  close(fd);
+  if (ptr == MAP_FAILED) {
+    _size = 0;
+    throw std::runtime_error("failed to map " + path.string());
+  }
+  _data = static_cast<const uint8_t *>(ptr);
+#endif
+}
+
+MappedFile::~MappedFile() {
+  release();
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept {
+  *this = std::move(other);
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+  if (this != &other) {
+    release();
+    std::swap(_data, other._data);
+    std::swap(_size, other._size);
+#ifdef _WIN32
+    std::swap(_file, other._file);
+    std::swap(_mapping, other._mapping);
+#endif
+  }
+  return *this;
+}
+
+void MappedFile::release() {
+#ifdef _WIN32
+  if (_data != nullptr) {
+    UnmapViewOfFile(_data);
+  }
+  if (_mapping != nullptr) {
+    CloseHandle(_mapping);
+  }
+  if (_file != nullptr) {
+    CloseHandle(_file);
+  }
+  _file = nullptr;
+  _mapping = nullptr;
+#else
+  if (_data != nullptr) {
+    munmap(const_cast<uint8_t *>(_data), _size);
+  }
+#endif
+  _data = nullptr;
+  _size = 0;
+}
+
+const uint8_t *MappedFile::data() const {
+  return _data;
+}
+
+size_t MappedFile::size() const {
+  return _size;
+}
 
 fs::path Data::data_path() {
   return DATA_PATH;
 }
 
+fs::path Data::cache_path() {
+  return CACHE_PATH;
+}
+
 std::vector<uint8_t> Data::load(const fs::path &name) {
-  auto full_path = resolve(name);
-  std::ifstream ifs(full_path);
-  return {std::istreambuf_iterator<char>(ifs), {}};
+  auto file = map(name);
+  return {file.data(), file.data() + file.size()};
+}
+
+MappedFile Data::map(const fs::path &name) {
+  return MappedFile(resolve(name));
 }
 
 fs::path Data::resolve(const fs::path &name) {
   return data_path() / name;
-}
\ No newline at end of file
+}
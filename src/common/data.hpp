@@ -1,13 +1,44 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
 #include <vector>
 
 namespace fs = std::filesystem;
 
+// Read-only memory mapping of a whole file. The mapping is released when the
+// object is destroyed.
+class MappedFile {
+public:
+  MappedFile() = default;
+  explicit MappedFile(const fs::path &path);
+  ~MappedFile();
+
+  MappedFile(MappedFile &&other) noexcept;
+  MappedFile &operator=(MappedFile &&other) noexcept;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const uint8_t *data() const;
+  size_t size() const;
+
+private:
+  void release();
+
+  const uint8_t *_data{};
+  size_t _size{};
+#ifdef _WIN32
+  void *_file{};
+  void *_mapping{};
+#endif
+};
+
 class Data {
 public:
   static fs::path data_path();
+  static fs::path cache_path();
   static std::vector<uint8_t> load(const fs::path &name);
+  // read-only view of a file in the data folder without copying it
+  static MappedFile map(const fs::path &name);
   static fs::path resolve(const fs::path& name);
-};
\ No newline at end of file
+};
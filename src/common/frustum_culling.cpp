@@ -0,0 +1,120 @@
+#include "frustum_culling.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define FRUSTUM_CULLING_SSE2
+#include <emmintrin.h>
+#endif
+
+Aabb Aabb::unbounded() {
+  // finite so transforming it does not produce NaNs
+  return Aabb{glm::vec3(-1e30f), glm::vec3(1e30f)};
+}
+
+Aabb transform_aabb(const Aabb &box, const glm::mat4 &transform) {
+  auto center = (box.min + box.max) * 0.5f;
+  auto extent = (box.max - box.min) * 0.5f;
+  auto new_center = glm::vec3(transform * glm::vec4(center, 1.0f));
+  // each axis of the box grows by the extents projected onto it
+  glm::vec3 new_extent{0.0f};
+  for (int i = 0; i < 3; i++) {
+    new_extent += glm::abs(glm::vec3(transform[i])) * extent[i];
+  }
+  return Aabb{new_center - new_extent, new_center + new_extent};
+}
+
+void frustum_planes(const glm::mat4 &view_projection, glm::vec4 planes[6]) {
+  // from the rows of the clip transform
+  auto clip = glm::transpose(view_projection);
+  planes[0] = clip[3] + clip[0];
+  planes[1] = clip[3] - clip[0];
+  planes[2] = clip[3] + clip[1];
+  planes[3] = clip[3] - clip[1];
+  planes[4] = clip[3] + clip[2];
+  planes[5] = clip[3] - clip[2];
+}
+
+uint32_t FrustumCuller::add(const Aabb &box) {
+  if (_count == _min_x.size()) {
+    for (auto *v : {&_min_x, &_min_y, &_min_z, &_max_x, &_max_y, &_max_z}) {
+      v->resize(_count + 4, 0.0f);
+    }
+  }
+  auto index = (uint32_t)_count++;
+  set(index, box);
+  return index;
+}
+
+void FrustumCuller::set(uint32_t index, const Aabb &box) {
+  _min_x[index] = box.min.x;
+  _min_y[index] = box.min.y;
+  _min_z[index] = box.min.z;
+  _max_x[index] = box.max.x;
+  _max_y[index] = box.max.y;
+  _max_z[index] = box.max.z;
+}
+
+void FrustumCuller::clear() {
+  for (auto *v : {&_min_x, &_min_y, &_min_z, &_max_x, &_max_y, &_max_z}) {
+    v->clear();
+  }
+  _count = 0;
+}
+
+size_t FrustumCuller::size() const {
+  return _count;
+}
+
+void FrustumCuller::cull(const glm::mat4 &view_projection,
+                         std::vector<uint8_t> &visible) const {
+  glm::vec4 planes[6];
+  frustum_planes(view_projection, planes);
+  // A box is outside when its corner furthest along the normal of a plane is
+  // behind it. Which corner that is only depends on the signs of the normal,
+  // so every plane reads one of the min and max arrays per axis.
+  const float *corners[6][3];
+  for (int i = 0; i < 6; i++) {
+    corners[i][0] = planes[i].x > 0.0f ? _max_x.data() : _min_x.data();
+    corners[i][1] = planes[i].y > 0.0f ? _max_y.data() : _min_y.data();
+    corners[i][2] = planes[i].z > 0.0f ? _max_z.data() : _min_z.data();
+  }
+
+  auto padded_count = _min_x.size();
+  visible.resize(padded_count);
+#ifdef FRUSTUM_CULLING_SSE2
+  __m128 normals[6][4];
+  for (int i = 0; i < 6; i++) {
+    for (int j = 0; j < 4; j++) {
+      normals[i][j] = _mm_set1_ps(planes[i][j]);
+    }
+  }
+  for (size_t i = 0; i < padded_count; i += 4) {
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (int p = 0; p < 6; p++) {
+      auto x = _mm_loadu_ps(corners[p][0] + i);
+      auto y = _mm_loadu_ps(corners[p][1] + i);
+      auto z = _mm_loadu_ps(corners[p][2] + i);
+      auto distance =
+          _mm_add_ps(_mm_add_ps(_mm_mul_ps(normals[p][0], x),
+                                _mm_mul_ps(normals[p][1], y)),
+                     _mm_add_ps(_mm_mul_ps(normals[p][2], z), normals[p][3]));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, _mm_setzero_ps()));
+    }
+    int mask = _mm_movemask_ps(inside);
+    for (int j = 0; j < 4; j++) {
+      visible[i + j] = (uint8_t)((mask >> j) & 1);
+    }
+  }
+#else
+  for (size_t i = 0; i < padded_count; i++) {
+    bool inside = true;
+    for (int p = 0; p < 6; p++) {
+      auto &plane = planes[p];
+      inside &= (plane.x * corners[p][0][i] + plane.y * corners[p][1][i]) +
+                    (plane.z * corners[p][2][i] + plane.w) >=
+                0.0f;
+    }
+    visible[i] = inside;
+  }
+#endif
+  visible.resize(_count);
+}
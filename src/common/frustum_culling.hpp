@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+// axis aligned bounding box
+struct Aabb {
+  glm::vec3 min{0.0f};
+  glm::vec3 max{0.0f};
+
+  // large enough to never be culled, for meshes of unknown extent
+  static Aabb unbounded();
+};
+
+// the box around box after transform
+Aabb transform_aabb(const Aabb &box, const glm::mat4 &transform);
+
+// World space planes of the frustum of view_projection, pointing inwards. The
+// normals are not normalized.
+void frustum_planes(const glm::mat4 &view_projection, glm::vec4 planes[6]);
+
+// Boxes of many objects stored as structure of arrays and tested against a
+// view frustum four at a time.
+class FrustumCuller {
+public:
+  // index of the box in the results of cull
+  uint32_t add(const Aabb &box);
+  // replace the box of index, e.g. after its object moved
+  void set(uint32_t index, const Aabb &box);
+  void clear();
+  size_t size() const;
+
+  // visible[i] is 1 when box i intersects the frustum of view_projection, 0
+  // otherwise. Boxes crossing a plane outside of the frustum count as visible.
+  void cull(const glm::mat4 &view_projection,
+            std::vector<uint8_t> &visible) const;
+
+private:
+  // padded to a multiple of 4
+  std::vector<float> _min_x;
+  std::vector<float> _min_y;
+  std::vector<float> _min_z;
+  std::vector<float> _max_x;
+  std::vector<float> _max_y;
+  std::vector<float> _max_z;
+  size_t _count = 0;
+};
@@ -0,0 +1,126 @@
+#include "geometry_pool.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+size_t align_up(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+GLuint create_buffer(size_t size) {
+  GLuint id;
+  glGenBuffers(1, &id);
+  // the copy target keeps the element buffer of the bound vertex array
+  glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+  glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STATIC_DRAW);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  return id;
+}
+
+void upload(GLuint buffer, size_t offset, const void *data, size_t size) {
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+} // namespace
+
+GeometryPool::GeometryPool(size_t vertex_chunk_size, size_t index_chunk_size)
+    : _vertex_chunk_size(vertex_chunk_size),
+      _index_chunk_size(index_chunk_size) {}
+
+GeometryPool::~GeometryPool() {
+  for (auto &chunk : _chunks) {
+    for (auto &format : chunk.vertex_arrays) {
+      glDeleteVertexArrays(1, &format.second);
+    }
+    glDeleteBuffers(1, &chunk.vertex_buffer);
+    glDeleteBuffers(1, &chunk.index_buffer);
+  }
+}
+
+GeometryPool::Allocation GeometryPool::allocate(FormatSetup format,
+                                                const void *vertices,
+                                                size_t vertex_size,
+                                                uint32_t vertex_count,
+                                                const void *indices,
+                                                size_t index_size) {
+  if (vertex_size == 0) {
+    throw std::runtime_error("geometry pool vertex size is 0");
+  }
+  auto vertex_bytes = vertex_size * vertex_count;
+  if (indices == nullptr) {
+    index_size = 0;
+  }
+
+  // base vertices count in whole vertices of the format
+  size_t chunk_index = 0;
+  size_t vertex_offset = 0, index_offset = 0;
+  for (; chunk_index < _chunks.size(); chunk_index++) {
+    auto &chunk = _chunks[chunk_index];
+    vertex_offset = align_up(chunk.vertex_used, vertex_size);
+    index_offset = align_up(chunk.index_used, sizeof(uint32_t));
+    if (vertex_offset + vertex_bytes <= chunk.vertex_capacity &&
+        index_offset + index_size <= chunk.index_capacity) {
+      break;
+    }
+  }
+  if (chunk_index == _chunks.size()) {
+    Chunk chunk{};
+    chunk.vertex_capacity = std::max(_vertex_chunk_size, vertex_bytes);
+    chunk.index_capacity = std::max(_index_chunk_size, index_size);
+    chunk.vertex_buffer = create_buffer(chunk.vertex_capacity);
+    chunk.index_buffer = create_buffer(chunk.index_capacity);
+    _chunks.push_back(std::move(chunk));
+    vertex_offset = index_offset = 0;
+  }
+
+  auto &chunk = _chunks[chunk_index];
+  upload(chunk.vertex_buffer, vertex_offset, vertices, vertex_bytes);
+  if (index_size > 0) {
+    upload(chunk.index_buffer, index_offset, indices, index_size);
+  }
+  chunk.vertex_used = vertex_offset + vertex_bytes;
+  chunk.index_used = index_offset + index_size;
+  chunk.live_allocations++;
+
+  Allocation allocation;
+  allocation.vertex_array = vertex_array(chunk, format);
+  allocation.base_vertex = (GLint)(vertex_offset / vertex_size);
+  allocation.index_offset = index_offset;
+  allocation.chunk = (uint32_t)chunk_index;
+  return allocation;
+}
+
+void GeometryPool::release(const Allocation &allocation) {
+  if (allocation.chunk >= _chunks.size()) {
+    return;
+  }
+  auto &chunk = _chunks[allocation.chunk];
+  if (chunk.live_allocations > 0 && --chunk.live_allocations == 0) {
+    chunk.vertex_used = 0;
+    chunk.index_used = 0;
+  }
+}
+
+size_t GeometryPool::chunk_count() const {
+  return _chunks.size();
+}
+
+GLuint GeometryPool::vertex_array(Chunk &chunk, FormatSetup format) {
+  for (auto &entry : chunk.vertex_arrays) {
+    if (entry.first == format) {
+      return entry.second;
+    }
+  }
+
+  GLuint id;
+  glGenVertexArrays(1, &id);
+  glBindVertexArray(id);
+  glBindBuffer(GL_ARRAY_BUFFER, chunk.vertex_buffer);
+  format();
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, chunk.index_buffer);
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  chunk.vertex_arrays.emplace_back(format, id);
+  return id;
+}
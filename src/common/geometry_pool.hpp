@@ -0,0 +1,66 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Sub-allocates the vertices and indices of many meshes from a few large
+// buffers. Every chunk of buffers has one vertex array per vertex format, so
+// meshes of the same format in a chunk draw without switching vertex arrays
+// and address their range with a base vertex and an index offset.
+class GeometryPool {
+public:
+  // Points the attributes of the bound vertex array at vertices of one
+  // format, starting at offset 0 of the buffer bound to GL_ARRAY_BUFFER.
+  // Formats are told apart by their setup function.
+  using FormatSetup = void (*)();
+
+  struct Allocation {
+    GLuint vertex_array = 0;
+    GLint base_vertex = 0;
+    // in bytes
+    size_t index_offset = 0;
+    uint32_t chunk = ~0u;
+  };
+
+  explicit GeometryPool(size_t vertex_chunk_size = 32 << 20,
+                        size_t index_chunk_size = 8 << 20);
+  ~GeometryPool();
+
+  GeometryPool(const GeometryPool &) = delete;
+  GeometryPool &operator=(const GeometryPool &) = delete;
+
+  // Upload vertices and index_size bytes of indices into the first chunk
+  // with room for them, a new chunk is added when none has. indices may be
+  // null.
+  Allocation allocate(FormatSetup format,
+                      const void *vertices,
+                      size_t vertex_size,
+                      uint32_t vertex_count,
+                      const void *indices,
+                      size_t index_size);
+  // ranges are bump allocated, a chunk is reused once all of its
+  // allocations are released
+  void release(const Allocation &allocation);
+
+  size_t chunk_count() const;
+
+private:
+  struct Chunk {
+    GLuint vertex_buffer{};
+    GLuint index_buffer{};
+    size_t vertex_capacity{};
+    size_t index_capacity{};
+    size_t vertex_used{};
+    size_t index_used{};
+    uint32_t live_allocations{};
+    std::vector<std::pair<FormatSetup, GLuint>> vertex_arrays;
+  };
+
+  GLuint vertex_array(Chunk &chunk, FormatSetup format);
+
+  size_t _vertex_chunk_size;
+  size_t _index_chunk_size;
+  std::vector<Chunk> _chunks;
+};
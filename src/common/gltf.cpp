@@ -1,60 +1,590 @@
 #include "gltf.hpp"
+#include "block_compression.hpp"
 #include "data.hpp"
+#include "gltf_cache.hpp"
+#include "gltf_parser.hpp"
+#include "mesh_optimizer.hpp"
+#include "texture_registry.hpp"
+#include "texture_streamer.hpp"
+#include "thread_pool.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <chrono>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <iostream>
+#include <numeric>
 #include <sstream>
+#include <stb_image.h>
 #include <tiny_gltf.h>
+#include <unordered_map>
 
-Gltf::Gltf(const fs::path &name) {
+Gltf::Gltf(const fs::path &name, GltfSettings *settings) {
+  GltfSettings default_settings{};
+  if (settings == nullptr) {
+    settings = &default_settings;
+  }
+  _settings = *settings;
+
+  if (_settings.native_accessors || _settings.lazy_loading) {
+    _settings.use_cache = false;
+  }
+  if (_settings.use_cache) {
+    auto cache = GltfCache::open(cache_file(name));
+    if (cache != nullptr && load_cache(*cache)) {
+      return;
+    }
+  }
   load_model(name);
 }
 
-void Gltf::load_model(const fs::path &name) {
-  tinygltf::TinyGLTF loader;
+fs::path Gltf::cache_file(const fs::path &name) const {
+  // every setting that changes the cooked data gets its own cache file
+  std::vector<std::string> tokens;
+  if (_settings.compress_textures) {
+    tokens.push_back("bc");
+  }
+  if (!_settings.weld_vertices) {
+    tokens.push_back("noweld");
+  } else {
+    auto &weld = _settings.weld_settings;
+    auto epsilons = {weld.position_epsilon,
+                     weld.normal_epsilon,
+                     weld.tangent_epsilon,
+                     weld.uv_epsilon,
+                     weld.color_epsilon};
+    if (std::any_of(epsilons.begin(), epsilons.end(), [](float e) {
+          return e != 0.0f;
+        })) {
+      std::ostringstream ss;
+      ss << "weld" << std::hex << hash_bytes(&weld, sizeof(weld));
+      tokens.push_back(ss.str());
+    }
+  }
+  if (!_settings.optimize_meshes) {
+    tokens.push_back("noopt");
+  }
+  if (_settings.lod_count != GltfSettings{}.lod_count) {
+    tokens.push_back("lod" + std::to_string(std::max(_settings.lod_count, 1)));
+  }
+
+  std::string variant;
+  for (auto &token : tokens) {
+    variant += (variant.empty() ? "" : ".") + token;
+  }
+  return GltfCache::cache_file(name, variant);
+}
+
+namespace {
+void decode_image(tinygltf::Image &image, const fs::path &base_dir) {
+  // parse_gltf leaves image files alone, they are decoded straight from a
+  // mapping
+  MappedFile file;
+  const uint8_t *bytes = image.image.data();
+  auto size = static_cast<int>(image.image.size());
+  if (!image.as_is) {
+    auto path = uri_to_path(base_dir, image.uri);
+    std::error_code ec;
+    if (!fs::exists(path, ec)) {
+      // same as tinygltf, a missing image is not fatal
+      std::cout << "warn: image file not found: " << path.string()
+                << std::endl;
+      return;
+    }
+    file = MappedFile(path);
+    bytes = file.data();
+    size = static_cast<int>(file.size());
+  }
+
+  // same as the default loader of tinygltf, always expand to 4 channels
+  const int req_comp = 4;
+  int w = 0, h = 0, comp = 0;
+  int bits = 8;
+  int pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+  uint8_t *data = nullptr;
+  if (stbi_is_16_bit_from_memory(bytes, size)) {
+    data = reinterpret_cast<uint8_t *>(
+        stbi_load_16_from_memory(bytes, size, &w, &h, &comp, req_comp));
+    if (data) {
+      bits = 16;
+      pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT;
+    }
+  }
+  if (!data) {
+    data = stbi_load_from_memory(bytes, size, &w, &h, &comp, req_comp);
+  }
+  if (!data) {
+    throw std::runtime_error("failed to decode image \"" + image.name +
+                             "\"");
+  }
+  // images from buffer views may declare their size up front
+  if ((image.width > 0 && image.width != w) ||
+      (image.height > 0 && image.height != h)) {
+    stbi_image_free(data);
+    throw std::runtime_error("image size mismatch for \"" + image.name +
+                             "\"");
+  }
+
+  image.width = w;
+  image.height = h;
+  image.component = req_comp;
+  image.bits = bits;
+  image.pixel_type = pixel_type;
+  image.image.assign(data, data + (size_t)w * h * req_comp * (bits / 8));
+  image.as_is = false;
+  stbi_image_free(data);
+}
+
+void decode_images(tinygltf::Model &model, const fs::path &base_dir) {
+  ThreadPool::global().parallel_for(model.images.size(), [&](size_t i) {
+    auto &image = model.images[i];
+    if (image.as_is || (image.image.empty() && !image.uri.empty() &&
+                        !is_data_uri(image.uri))) {
+      decode_image(image, base_dir);
+    }
+  });
+}
+
+bool image_missing(const tinygltf::Model &model,
+                   const tinygltf::Texture &tex) {
+  return tex.source < 0 || model.images[tex.source].image.empty();
+}
+
+GLenum image_data_type(const tinygltf::Image &image) {
+  return image.bits == 16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+}
+
+// material slots a texture is bound to
+enum TextureSlot : uint32_t {
+  SlotColor = 1 << 0,
+  SlotNormal = 1 << 1,
+  SlotOcclusion = 1 << 2,
+  SlotMetallicRoughness = 1 << 3,
+};
+
+struct TextureUsage {
+  uint32_t slots = 0;
+  // base color of an alpha masked material
+  bool alpha_tested = false;
+  float alpha_cutoff = 0.5f;
+};
+
+std::vector<TextureUsage> texture_usage(const tinygltf::Model &model) {
+  std::vector<TextureUsage> usage(model.textures.size());
+  auto use = [&](int index, uint32_t slot) {
+    if (index >= 0 && index < (int)usage.size()) {
+      usage[index].slots |= slot;
+    }
+  };
+  for (auto &mat : model.materials) {
+    auto &pbr = mat.pbrMetallicRoughness;
+    use(pbr.baseColorTexture.index, SlotColor);
+    use(pbr.metallicRoughnessTexture.index, SlotMetallicRoughness);
+    use(mat.normalTexture.index, SlotNormal);
+    use(mat.occlusionTexture.index, SlotOcclusion);
+    use(mat.emissiveTexture.index, SlotColor);
+
+    auto base_color = pbr.baseColorTexture.index;
+    if (mat.alphaMode == "MASK" && base_color >= 0 &&
+        base_color < (int)usage.size()) {
+      usage[base_color].alpha_tested = true;
+      usage[base_color].alpha_cutoff = (float)mat.alphaCutoff;
+    }
+  }
+  return usage;
+}
+
+// Base color and emission are sRGB encoded, normal maps need unit length on
+// every level. Textures shared by different kinds of slots are filtered as
+// plain data.
+MipSettings mip_settings(const TextureUsage &usage) {
+  MipSettings settings{};
+  if (usage.slots == SlotNormal) {
+    settings.normal_map = true;
+  } else if (usage.slots == SlotColor) {
+    settings.srgb = true;
+    settings.preserve_alpha_coverage = usage.alpha_tested;
+    settings.alpha_cutoff = usage.alpha_cutoff;
+  }
+  return settings;
+}
+
+// Normal maps keep x and y only, the shader reconstructs z. Occlusion and
+// metallic roughness are opaque and live in R, G and B. Anything else, also
+// textures shared by different kinds of slots, needs all four channels.
+bool choose_block_format(uint32_t slots, BlockFormat &format) {
+  if (slots == 0) {
+    return false;
+  }
+  std::vector<BlockFormat> candidates;
+  if (slots == SlotNormal) {
+    candidates = {BlockFormat::BC5};
+  } else if (slots == SlotOcclusion) {
+    candidates = {BlockFormat::BC4};
+  } else if ((slots & ~(SlotOcclusion | SlotMetallicRoughness)) == 0) {
+    candidates = {BlockFormat::BC1};
+  } else {
+    candidates = {BlockFormat::BC7, BlockFormat::BC3};
+  }
+  for (auto candidate : candidates) {
+    if (compressed_format_supported(block_format_to_gl(candidate))) {
+      format = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+// how a decoded image is filtered and encoded for the slots it is bound to
+struct CookSettings {
+  MipSettings mip{};
+  bool compress = false;
+  BlockFormat format = BlockFormat::BC1;
+};
+
+CookSettings cook_settings(const tinygltf::Image &image,
+                           const TextureUsage &usage,
+                           bool compress) {
+  CookSettings settings;
+  settings.mip = mip_settings(usage);
+  settings.compress = compress && image_data_type(image) == GL_UNSIGNED_BYTE &&
+                      image.component == 4 &&
+                      choose_block_format(usage.slots, settings.format);
+  return settings;
+}
+
+MipChain cook_texture(const tinygltf::Image &image,
+                      const CookSettings &settings) {
+  auto mip = settings.mip;
+  auto chain = build_mip_chain(image.image.data(),
+                               image_data_type(image),
+                               image.width,
+                               image.height,
+                               image.component,
+                               &mip);
+  if (settings.compress) {
+    chain = compress_mip_chain(chain, settings.format);
+  }
+  return chain;
+}
+
+// Images of equal texels cooked alike give equal chains, whichever slots
+// they are bound to. texel_hash is the hash of the image data.
+uint64_t content_key(uint64_t texel_hash,
+                     int width,
+                     int height,
+                     int channels,
+                     GLenum type,
+                     const CookSettings &settings) {
+  uint32_t params[] = {(uint32_t)width,
+                       (uint32_t)height,
+                       (uint32_t)channels,
+                       type,
+                       settings.mip.srgb,
+                       settings.mip.normal_map,
+                       settings.mip.preserve_alpha_coverage,
+                       0,
+                       settings.compress ? (uint32_t)settings.format + 1 : 0};
+  std::memcpy(&params[7], &settings.mip.alpha_cutoff, sizeof(float));
+  return hash_bytes(params, sizeof(params), texel_hash);
+}
+
+// sampler state lives in the texture object, only textures that also
+// sample alike can be shared
+uint64_t texture_key(uint64_t content_key, const TextureSettings &settings) {
+  uint32_t params[8] = {settings.wrap_s,
+                        settings.wrap_t,
+                        settings.min_filter,
+                        settings.max_filter};
+  std::memcpy(
+      &params[4], &settings.border_color, sizeof(settings.border_color));
+  return hash_bytes(params, sizeof(params), content_key);
+}
+
+// whether decode_image finds something to decode, without decoding it
+bool image_present(const tinygltf::Image &image, const fs::path &base_dir) {
+  if (!image.image.empty()) {
+    return true;
+  }
+  std::error_code ec;
+  return !image.uri.empty() && !is_data_uri(image.uri) &&
+         fs::exists(uri_to_path(base_dir, image.uri), ec);
+}
+
+TextureSettings texture_settings(const tinygltf::Model &model,
+                                 const tinygltf::Texture &tex) {
+  TextureSettings settings{};
+  if (tex.sampler >= 0) {
+    auto &sampler = model.samplers[tex.sampler];
+
+    settings.wrap_s = sampler.wrapS;
+    settings.wrap_t = sampler.wrapT;
+
+    if (sampler.minFilter > 0) {
+      settings.min_filter = sampler.minFilter;
+    }
+    if (sampler.magFilter > 0) {
+      settings.max_filter = sampler.magFilter;
+    }
+  }
+  return settings;
+}
+// Bounds of a vec3 accessor from its min and max, which glTF requires for
+// positions. They are stored unnormalized, though some exporters write them
+// normalized already.
+bool accessor_bounds(const tinygltf::Accessor &accessor, Aabb &bounds) {
+  if (accessor.minValues.size() != 3 || accessor.maxValues.size() != 3) {
+    return false;
+  }
+  for (int i = 0; i < 3; i++) {
+    bounds.min[i] = (float)accessor.minValues[i];
+    bounds.max[i] = (float)accessor.maxValues[i];
+  }
+  if (!accessor.normalized) {
+    return true;
+  }
+  float range = 1.0f;
+  switch (accessor.componentType) {
+  case TINYGLTF_COMPONENT_TYPE_BYTE:
+    range = 127.0f;
+    break;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+    range = 255.0f;
+    break;
+  case TINYGLTF_COMPONENT_TYPE_SHORT:
+    range = 32767.0f;
+    break;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+    range = 65535.0f;
+    break;
+  }
+  auto largest = glm::max(glm::abs(bounds.min), glm::abs(bounds.max));
+  if (glm::max(largest.x, glm::max(largest.y, largest.z)) > 1.0f) {
+    bounds.min = glm::max(bounds.min / range, glm::vec3(-1.0f));
+    bounds.max /= range;
+  }
+  return true;
+}
+} // namespace
+
+// the parsed file of a lazy scene and what is loading from it
+struct Gltf::LazyState {
+  struct MeshJob {
+    int index;
+    std::vector<MeshData> data;
+    std::future<void> done;
+  };
+  struct TextureJob {
+    int index;
+    MipChain chain;
+    std::future<void> done;
+  };
+
   tinygltf::Model model;
-  std::string err;
-  std::string warn;
+  fs::path base_dir;
+  std::vector<TextureUsage> texture_usage;
+  std::vector<bool> mesh_requested;
+  std::vector<bool> texture_requested;
+  // jobs write their results in place, so they must not move
+  std::vector<std::unique_ptr<MeshJob>> mesh_jobs;
+  std::vector<std::unique_ptr<TextureJob>> texture_jobs;
+};
 
+Gltf::~Gltf() {
+  // jobs read the model and write into the state
+  if (_lazy != nullptr) {
+    for (auto &job : _lazy->mesh_jobs) {
+      job->done.wait();
+    }
+    for (auto &job : _lazy->texture_jobs) {
+      job->done.wait();
+    }
+  }
+}
+
+void Gltf::load_model(const fs::path &name) {
   auto model_path = Data::resolve(name);
-  bool ret = false;
   auto extension = model_path.extension();
-  auto model_path_str = model_path.string();
-  if (extension == ".gltf") {
-    ret = loader.LoadASCIIFromFile(&model, &err, &warn, model_path_str.c_str());
-  } else if (extension == ".glb") {
-    ret =
-        loader.LoadBinaryFromFile(&model, &err, &warn, model_path_str.c_str());
-  } else {
+  if (extension != ".gltf" && extension != ".glb") {
     std::stringstream ss;
     ss << "invalid file extension for GLTF: " << extension
        << ", should be .gltf or .glb";
     throw std::runtime_error(ss.str());
   }
-  if (!warn.empty()) {
-    std::cout << "Warn: " << warn << std::endl;
-  }
-  if (!err.empty()) {
-    throw std::runtime_error("failed to load " + model_path.string() + ": " +
-                             err);
-  }
-  if (!ret) {
-    throw std::runtime_error("failed to parse " + model_path.string());
-  }
+  tinygltf::Model model;
+  parse_gltf(model_path, model);
 
   if (model.scenes.size() == 0) {
     return;
   }
 
-  load_meshes(model);
-  load_textures(model);
+  auto base_dir = model_path.parent_path();
+  if (_settings.lazy_loading) {
+    _lazy = std::make_unique<LazyState>();
+    _lazy->model = std::move(model);
+    _lazy->base_dir = base_dir;
+    init_lazy(_lazy->model);
+    return;
+  }
+
+  // decode images on worker threads while meshes are uploaded, only the
+  // texture upload itself needs the GL thread
+  auto decoding = ThreadPool::global().submit(
+      [&model, base_dir] { decode_images(model, base_dir); });
+  std::vector<MeshData> mesh_data;
+  try {
+    if (_settings.native_accessors) {
+      create_native_meshes(model);
+    } else {
+      mesh_data = load_meshes(model);
+      create_meshes(mesh_data);
+    }
+  } catch (...) {
+    decoding.wait();
+    throw;
+  }
+  decoding.get();
+  auto cooked_textures = load_textures(model);
   load_materials(model);
   load_scene(model);
+
+  if (_settings.use_cache) {
+    try {
+      write_cache(name, model, mesh_data, cooked_textures);
+    } catch (std::exception &e) {
+      std::cout << "warn: failed to write scene cache: " << e.what()
+                << std::endl;
+    }
+  }
+}
+
+bool Gltf::load_cache(const GltfCache &cache) {
+  auto &contents = cache.contents();
+  // the cache may be cooked on a machine with a different driver
+  for (auto &image : contents.images) {
+    if (image.compressed_format != GL_NONE &&
+        !compressed_format_supported(image.compressed_format)) {
+      return false;
+    }
+  }
+
+  meshes.resize(contents.mesh_count);
+  for (auto &prim : contents.primitives) {
+    auto indices = prim.index_count == 0 ? nullptr : prim.indices;
+    meshes[prim.mesh].emplace_back(
+        Primitive{create_mesh(prim.vertices,
+                              prim.vertex_count,
+                              indices,
+                              prim.index_count,
+                              prim.index_type,
+                              prim.meshlets,
+                              prim.meshlet_count,
+                              prim.lods,
+                              prim.lod_count),
+                  prim.material});
+  }
+
+  std::vector<TextureData> texture_data;
+  for (auto &tex : contents.textures) {
+    auto &image = contents.images[tex.image];
+    texture_data.push_back(TextureData{mip_chain_layout(image.type,
+                                                        image.channels,
+                                                        image.compressed_format,
+                                                        image.width,
+                                                        image.height,
+                                                        image.level_count),
+                                       image.texels,
+                                       tex.settings,
+                                       image.content_key});
+  }
+  create_textures(texture_data);
+  add_default_textures();
+
+  for (auto &mat : contents.materials) {
+    materials.emplace_back(std::make_unique<Material>(mat));
+  }
+  draws = contents.draws;
+  return true;
+}
+
+void Gltf::write_cache(const fs::path &name,
+                       tinygltf::Model &model,
+                       const std::vector<MeshData> &mesh_data,
+                       const CookedTextures &cooked_textures) {
+  GltfCache::Contents contents{};
+  contents.mesh_count = (uint32_t)mesh_data.size();
+  for (uint32_t i = 0; i < contents.mesh_count; i++) {
+    for (auto &prim : mesh_data[i]) {
+      contents.primitives.push_back(
+          GltfCache::Primitive{i,
+                               prim.material,
+                               prim.vertices.data(),
+                               (uint32_t)prim.vertices.size(),
+                               prim.index_data(),
+                               prim.index_count(),
+                               prim.index_type(),
+                               prim.meshlets.data(),
+                               (uint32_t)prim.meshlets.size(),
+                               prim.lods.data(),
+                               (uint32_t)prim.lods.size()});
+    }
+  }
+  // the same image may be filtered and encoded differently for different
+  // slots, textures only share chains that cooked alike
+  for (size_t i = 0; i < cooked_textures.chains.size(); i++) {
+    auto &chain = cooked_textures.chains[i];
+    contents.images.push_back(GltfCache::Image{chain.levels[0].width,
+                                               chain.levels[0].height,
+                                               chain.channels,
+                                               chain.type,
+                                               chain.compressed_format,
+                                               (int)chain.levels.size(),
+                                               chain.data.data(),
+                                               chain.data.size(),
+                                               cooked_textures.content_keys[i]});
+  }
+  for (size_t i = 0; i < model.textures.size(); i++) {
+    contents.textures.push_back(
+        GltfCache::Texture{cooked_textures.texture_chains[i],
+                           texture_settings(model, model.textures[i])});
+  }
+  for (auto &mat : materials) {
+    contents.materials.push_back(*mat);
+  }
+  contents.draws = draws;
+
+  auto model_path = Data::resolve(name);
+  std::vector<fs::path> sources = {model_path};
+  auto add_source = [&](const std::string &uri) {
+    if (uri.empty() || is_data_uri(uri)) {
+      return;
+    }
+    sources.push_back(uri_to_path(model_path.parent_path(), uri));
+  };
+  for (auto &buffer : model.buffers) {
+    add_source(buffer.uri);
+  }
+  for (auto &image : model.images) {
+    add_source(image.uri);
+  }
+
+  GltfCache::write(cache_file(name), sources, contents);
 }
 
 void Gltf::load_materials(tinygltf::Model &model) {
-  auto tex = [](int index, int default_index) {
-    return index < 0 ? default_index : index;
+  auto missing = [&](const tinygltf::Texture &tex) {
+    // images of lazy scenes are not decoded yet, only their files are known
+    if (_lazy != nullptr) {
+      return tex.source < 0 ||
+             !image_present(model.images[tex.source], _lazy->base_dir);
+    }
+    return image_missing(model, tex);
+  };
+  auto tex = [&](int index, int default_index) {
+    if (index < 0 || missing(model.textures[index])) {
+      return default_index;
+    }
+    return index;
   };
   for (auto &mat : model.materials) {
     auto &pbr = mat.pbrMetallicRoughness;
@@ -86,42 +616,133 @@ void Gltf::load_materials(tinygltf::Model &model) {
   }
 }
 
-void Gltf::load_textures(tinygltf::Model &model) {
+Gltf::CookedTextures Gltf::load_textures(tinygltf::Model &model) {
   // All textures are loaded linearly. Do gamma correction in shader if
   // necessary
-  for (auto &tex : model.textures) {
+  const uint8_t white[] = {255, 255, 255, 255};
+  auto usage = texture_usage(model);
+  std::vector<uint64_t> texel_hashes(model.images.size());
+  ThreadPool::global().parallel_for(texel_hashes.size(), [&](size_t i) {
+    auto &image = model.images[i].image;
+    texel_hashes[i] = hash_bytes(image.data(), image.size());
+  });
+
+  // keep indices stable, materials fall back to the default textures
+  auto texture_count = model.textures.size();
+  std::vector<CookSettings> cooking(texture_count);
+  std::vector<uint64_t> keys(texture_count);
+  for (size_t i = 0; i < texture_count; i++) {
+    auto &tex = model.textures[i];
+    if (image_missing(model, tex)) {
+      keys[i] = content_key(
+          hash_bytes(white, sizeof(white)), 1, 1, 4, GL_UNSIGNED_BYTE, {});
+      continue;
+    }
     auto &image = model.images[tex.source];
-    int width = image.width;
-    int height = image.height;
-    int channels = image.component;
-    GLenum type = GL_UNSIGNED_BYTE;
-    if (image.bits == 16) {
-      type = GL_UNSIGNED_SHORT;
+    cooking[i] = cook_settings(image, usage[i], _settings.compress_textures);
+    keys[i] = content_key(texel_hashes[tex.source],
+                          image.width,
+                          image.height,
+                          image.component,
+                          image_data_type(image),
+                          cooking[i]);
+  }
+
+  // the first texture of every key cooks its chain, unless every texture of
+  // the key is already shared through the registry
+  CookedTextures cooked;
+  std::unordered_map<uint64_t, int> chain_of_key;
+  std::vector<size_t> first_texture;
+  std::vector<bool> needed;
+  auto registry = _settings.texture_registry;
+  for (size_t i = 0; i < texture_count; i++) {
+    auto added = chain_of_key.emplace(keys[i], (int)first_texture.size());
+    if (added.second) {
+      cooked.content_keys.push_back(keys[i]);
+      first_texture.push_back(i);
+      needed.push_back(_settings.use_cache || registry == nullptr);
+    }
+    auto chain = added.first->second;
+    cooked.texture_chains.push_back(chain);
+    if (registry != nullptr &&
+        !registry->contains(texture_key(
+            keys[i], texture_settings(model, model.textures[i])))) {
+      needed[chain] = true;
+    }
+  }
+  cooked.chains.resize(first_texture.size());
+  ThreadPool::global().parallel_for(cooked.chains.size(), [&](size_t c) {
+    auto &tex = model.textures[first_texture[c]];
+    if (!needed[c]) {
+      return;
+    }
+    if (image_missing(model, tex)) {
+      cooked.chains[c] = build_mip_chain(white, GL_UNSIGNED_BYTE, 1, 1, 4);
+      return;
     }
+    cooked.chains[c] =
+        cook_texture(model.images[tex.source], cooking[first_texture[c]]);
+  });
 
-    TextureSettings settings{};
-    if (tex.sampler >= 0) {
-      auto &sampler = model.samplers[tex.sampler];
+  std::vector<TextureData> texture_data;
+  for (size_t i = 0; i < texture_count; i++) {
+    auto chain = cooked.texture_chains[i];
+    auto &source = cooked.chains[chain];
+    MipChain layout;
+    layout.type = source.type;
+    layout.channels = source.channels;
+    layout.compressed_format = source.compressed_format;
+    layout.levels = source.levels;
+    texture_data.push_back(
+        TextureData{std::move(layout),
+                    source.data.data(),
+                    texture_settings(model, model.textures[i]),
+                    cooked.content_keys[chain]});
+  }
+  create_textures(texture_data);
+  add_default_textures();
+  return cooked;
+}
 
-      settings.wrap_s = sampler.wrapS;
-      settings.wrap_t = sampler.wrapT;
+void Gltf::create_textures(const std::vector<TextureData> &texture_data) {
+  // without a registry of the settings textures are only shared within the
+  // scene
+  TextureRegistry scene_registry;
+  auto registry = _settings.texture_registry != nullptr
+                      ? _settings.texture_registry
+                      : &scene_registry;
+  auto saved_bytes = registry->saved_bytes();
+  auto shared_count = registry->shared_count();
 
-      if (sampler.minFilter > 0) {
-        settings.min_filter = sampler.minFilter;
-      }
-      if (sampler.magFilter > 0) {
-        settings.max_filter = sampler.magFilter;
+  auto streamer = _settings.texture_streamer;
+  for (auto &data : texture_data) {
+    auto settings = data.settings;
+    auto create = [&]() {
+      if (streamer == nullptr) {
+        return std::make_unique<Texture2D>(data.layout, data.texels, &settings);
       }
-    }
+      // the streamer owns the texels until they are uploaded
+      auto chain = data.layout;
+      chain.data.assign(data.texels, data.texels + chain.size());
+      auto texture = Texture2D::create_streamed(chain, &settings);
+      streamer->enqueue(texture.get(), std::move(chain));
+      return texture;
+    };
+    // chains skipped by load_textures are always shared
+    auto bytes = data.layout.levels.empty() ? 0 : data.layout.size();
+    textures.push_back(registry->acquire(
+        texture_key(data.content_key, settings), bytes, create));
+  }
 
-    textures.push_back(
-        std::make_unique<Texture2D>((uint8_t *)image.image.data(),
-                                    type,
-                                    width,
-                                    height,
-                                    channels,
-                                    &settings));
+  if (registry->shared_count() > shared_count) {
+    std::cout << "textures: " << registry->shared_count() - shared_count
+              << " of " << texture_data.size() << " shared, "
+              << (registry->saved_bytes() - saved_bytes) / 1024
+              << " KB not uploaded" << std::endl;
   }
+}
+
+void Gltf::add_default_textures() {
   auto add_default_tex = [&](uint8_t *color) {
     auto index = (uint32_t)(textures.size());
     textures.push_back(
@@ -134,7 +755,17 @@ void Gltf::load_textures(tinygltf::Model &model) {
   _default_normal_tex_index = add_default_tex(normal);
 }
 
-void Gltf::load_meshes(tinygltf::Model &model) {
+std::vector<Gltf::MeshData> Gltf::load_meshes(tinygltf::Model &model) {
+  std::vector<MeshData> mesh_data;
+  for (auto &mesh : model.meshes) {
+    mesh_data.emplace_back(decode_mesh(model, mesh));
+  }
+  process_mesh_data(mesh_data);
+  return mesh_data;
+}
+
+Gltf::MeshData Gltf::decode_mesh(tinygltf::Model &model,
+                                 const tinygltf::Mesh &mesh) {
   auto make_reader = [&](int accessor_index) {
     auto &accessor = model.accessors[accessor_index];
     auto &buffer_view = model.bufferViews[accessor.bufferView];
@@ -146,41 +777,40 @@ void Gltf::load_meshes(tinygltf::Model &model) {
     };
   };
 
-  for (auto &mesh : model.meshes) {
-    std::vector<Primitive> primitives;
-    primitives.reserve(mesh.primitives.size());
-    for (auto &prim : mesh.primitives) {
-      std::vector<Mesh::Vertex> vertices;
-      {
-        auto copy_attr =
-            [&](const std::string &attr_name, auto func, int accessor_type) {
-              auto it = prim.attributes.find(attr_name);
-              if (it == prim.attributes.end()) {
-                return;
-              }
-              auto accessor_index = it->second;
-              if (accessor_index < 0) {
-                return;
-              }
-              auto accessor = model.accessors[accessor_index];
-              if (accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT) {
-                std::cout << "warn: only support float vertex attribute"
-                          << std::endl;
-                return;
-              }
-              if (accessor.type != accessor_type) {
-                std::cout << "warn: accessor type not surpport for attribute "
-                          << attr_name << std::endl;
-                return;
-              }
-              if (accessor.count > vertices.size()) {
-                vertices.resize(accessor.count);
-              }
-              auto reader = make_reader(accessor_index);
-              for (int i = 0; i < accessor.count; i++) {
-                func(vertices[i], reader(i));
-              }
-            };
+  MeshData primitives;
+  primitives.reserve(mesh.primitives.size());
+  for (auto &prim : mesh.primitives) {
+    std::vector<Mesh::Vertex> vertices;
+    {
+      auto copy_attr =
+          [&](const std::string &attr_name, auto func, int accessor_type) {
+            auto it = prim.attributes.find(attr_name);
+            if (it == prim.attributes.end()) {
+              return;
+            }
+            auto accessor_index = it->second;
+            if (accessor_index < 0) {
+              return;
+            }
+            auto accessor = model.accessors[accessor_index];
+            if (accessor.componentType != TINYGLTF_COMPONENT_TYPE_FLOAT) {
+              std::cout << "warn: only support float vertex attribute"
+                        << std::endl;
+              return;
+            }
+            if (accessor.type != accessor_type) {
+              std::cout << "warn: accessor type not surpport for attribute "
+                        << attr_name << std::endl;
+              return;
+            }
+            if (accessor.count > vertices.size()) {
+              vertices.resize(accessor.count);
+            }
+            auto reader = make_reader(accessor_index);
+            for (int i = 0; i < accessor.count; i++) {
+              func(vertices[i], reader(i));
+            }
+          };
 
 #define COPY_ATTR(name, field, type)                                           \
   copy_attr(                                                                   \
@@ -190,72 +820,510 @@ void Gltf::load_meshes(tinygltf::Model &model) {
       },                                                                       \
       type)
 
-        // for all attributes see
-        // https://github.com/KhronosGroup/glTF/blob/master/specification/2.0/README.md
-        // we only copy what we need
-        COPY_ATTR("POSITION", position, TINYGLTF_TYPE_VEC3);
-        COPY_ATTR("NORMAL", normal, TINYGLTF_TYPE_VEC3);
-        COPY_ATTR("TANGENT", tangent, TINYGLTF_TYPE_VEC4);
-        COPY_ATTR("TEXCOORD_0", uv0, TINYGLTF_TYPE_VEC2);
-        COPY_ATTR("TEXCOORD_1", uv1, TINYGLTF_TYPE_VEC2);
-        COPY_ATTR("COLOR_0", color, TINYGLTF_TYPE_VEC4);
+      // for all attributes see
+      // https://github.com/KhronosGroup/glTF/blob/master/specification/2.0/README.md
+      // we only copy what we need
+      COPY_ATTR("POSITION", position, TINYGLTF_TYPE_VEC3);
+      COPY_ATTR("NORMAL", normal, TINYGLTF_TYPE_VEC3);
+      COPY_ATTR("TANGENT", tangent, TINYGLTF_TYPE_VEC4);
+      COPY_ATTR("TEXCOORD_0", uv0, TINYGLTF_TYPE_VEC2);
+      COPY_ATTR("TEXCOORD_1", uv1, TINYGLTF_TYPE_VEC2);
+      COPY_ATTR("COLOR_0", color, TINYGLTF_TYPE_VEC4);
 
 #undef COPY_ATTR
-      }
+    }
 
-      std::vector<uint32_t> indices;
-      {
-        auto accessor_index = prim.indices;
-        if (accessor_index >= 0) {
-          auto &accessor = model.accessors[accessor_index];
-          auto reader = make_reader(accessor_index);
-          indices.resize(accessor.count);
-          for (int i = 0; i < accessor.count; i++) {
-            switch (accessor.componentType) {
-            case TINYGLTF_COMPONENT_TYPE_BYTE:
-              indices[i] = *(int8_t *)reader(i);
-              break;
-            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-              indices[i] = *(uint8_t *)reader(i);
-              break;
-            case TINYGLTF_COMPONENT_TYPE_SHORT:
-              indices[i] = *(int16_t *)reader(i);
-              break;
-            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-              indices[i] = *(uint16_t *)reader(i);
-              break;
-            case TINYGLTF_COMPONENT_TYPE_INT:
-              indices[i] = *(int32_t *)reader(i);
-              break;
-            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-              indices[i] = *(uint32_t *)reader(i);
-              break;
-            default:
-              throw std::runtime_error("invalid type for indices");
-            }
+    std::vector<uint32_t> indices;
+    std::vector<uint16_t> short_indices;
+    {
+      auto accessor_index = prim.indices;
+      auto keep_short = [&](const tinygltf::Accessor &accessor) {
+        // nothing needs the indices widened, keep them as they are
+        return accessor.componentType ==
+                   TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT &&
+               !_settings.weld_vertices && !_settings.optimize_meshes &&
+               Mesh::index_type_for((uint32_t)vertices.size()) ==
+                   GL_UNSIGNED_SHORT;
+      };
+      if (accessor_index >= 0 && keep_short(model.accessors[accessor_index])) {
+        auto &accessor = model.accessors[accessor_index];
+        auto reader = make_reader(accessor_index);
+        short_indices.resize(accessor.count);
+        for (int i = 0; i < accessor.count; i++) {
+          short_indices[i] = *(uint16_t *)reader(i);
+        }
+        // out of range indices take the 32-bit path, which never narrows
+        // them and keeps them from the stages reading vertices
+        auto vertex_count = vertices.size();
+        if (!std::all_of(short_indices.begin(),
+                         short_indices.end(),
+                         [&](uint16_t i) { return i < vertex_count; })) {
+          std::cout << "warn: indices out of range" << std::endl;
+          indices.assign(short_indices.begin(), short_indices.end());
+          short_indices = {};
+        }
+      } else if (accessor_index >= 0) {
+        auto &accessor = model.accessors[accessor_index];
+        auto reader = make_reader(accessor_index);
+        indices.resize(accessor.count);
+        for (int i = 0; i < accessor.count; i++) {
+          switch (accessor.componentType) {
+          case TINYGLTF_COMPONENT_TYPE_BYTE:
+            indices[i] = *(int8_t *)reader(i);
+            break;
+          case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+            indices[i] = *(uint8_t *)reader(i);
+            break;
+          case TINYGLTF_COMPONENT_TYPE_SHORT:
+            indices[i] = *(int16_t *)reader(i);
+            break;
+          case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+            indices[i] = *(uint16_t *)reader(i);
+            break;
+          case TINYGLTF_COMPONENT_TYPE_INT:
+            indices[i] = *(int32_t *)reader(i);
+            break;
+          case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+            indices[i] = *(uint32_t *)reader(i);
+            break;
+          default:
+            throw std::runtime_error("invalid type for indices");
           }
         }
       }
+    }
+
+    primitives.emplace_back(PrimitiveData{std::move(vertices),
+                                          std::move(indices),
+                                          std::move(short_indices),
+                                          {},
+                                          {},
+                                          prim.material});
+  }
+  return primitives;
+}
 
-      if (indices.empty()) {
-        primitives.emplace_back(Primitive{
-            std::make_unique<Mesh>(
-                vertices.data(), (uint32_t)vertices.size(), nullptr, 0),
-            prim.material});
-      } else {
-        primitives.emplace_back(
-            Primitive{std::make_unique<Mesh>(vertices.data(),
-                                             (uint32_t)vertices.size(),
-                                             indices.data(),
-                                             (uint32_t)indices.size()),
-                      prim.material});
+void Gltf::process_mesh_data(std::vector<MeshData> &mesh_data) {
+  if (_settings.weld_vertices) {
+    weld_mesh_data(mesh_data);
+  }
+  if (_settings.optimize_meshes) {
+    optimize_mesh_data(mesh_data);
+  }
+  narrow_indices(mesh_data);
+  if (_settings.lod_count > 1) {
+    build_lod_data(mesh_data);
+  }
+  build_meshlet_data(mesh_data);
+}
+
+namespace {
+bool indices_in_range(const std::vector<uint32_t> &indices,
+                      size_t vertex_count) {
+  return std::all_of(indices.begin(), indices.end(), [&](uint32_t i) {
+    return i < vertex_count;
+  });
+}
+} // namespace
+
+void Gltf::weld_mesh_data(std::vector<MeshData> &mesh_data) {
+  std::vector<PrimitiveData *> primitives;
+  for (auto &data : mesh_data) {
+    for (auto &prim : data) {
+      if (prim.indices.empty() && prim.short_indices.empty()) {
+        // non-indexed primitives draw every vertex once in order
+        prim.indices.resize(prim.vertices.size());
+        std::iota(prim.indices.begin(), prim.indices.end(), 0);
+      }
+      if (prim.short_indices.empty() &&
+          indices_in_range(prim.indices, prim.vertices.size())) {
+        primitives.push_back(&prim);
       }
     }
+  }
+
+  std::vector<size_t> before(primitives.size());
+  std::vector<size_t> after(primitives.size());
+  ThreadPool::global().parallel_for(primitives.size(), [&](size_t i) {
+    auto &prim = *primitives[i];
+    size_t unique_count;
+    auto remap = weld_vertices_remap(prim.vertices.data(),
+                                     prim.vertices.size(),
+                                     &_settings.weld_settings,
+                                     unique_count);
+    for (auto &index : prim.indices) {
+      index = remap[index];
+    }
+    before[i] = prim.vertices.size();
+    after[i] = unique_count;
+    if (unique_count < prim.vertices.size()) {
+      prim.vertices = remap_vertices(prim.vertices, remap, unique_count);
+    }
+  });
+
+  auto total_before = std::accumulate(before.begin(), before.end(), size_t(0));
+  auto total_after = std::accumulate(after.begin(), after.end(), size_t(0));
+  if (total_after < total_before && _lazy == nullptr) {
+    std::cout << "vertex welding: " << total_before << " -> " << total_after
+              << " vertices" << std::endl;
+  }
+}
+
+void Gltf::optimize_mesh_data(std::vector<MeshData> &mesh_data) {
+  std::vector<PrimitiveData *> primitives;
+  for (auto &data : mesh_data) {
+    for (auto &prim : data) {
+      if (prim.indices.size() >= 3 &&
+          indices_in_range(prim.indices, prim.vertices.size())) {
+        primitives.push_back(&prim);
+      }
+    }
+  }
+
+  std::vector<VertexCacheStats> before(primitives.size());
+  std::vector<VertexCacheStats> after(primitives.size());
+  ThreadPool::global().parallel_for(primitives.size(), [&](size_t i) {
+    auto &prim = *primitives[i];
+    auto indices = prim.indices.data();
+    auto index_count = prim.indices.size();
+    auto vertex_count = prim.vertices.size();
+    before[i] = analyze_vertex_cache(indices, index_count, vertex_count);
+
+    optimize_vertex_cache(indices, index_count, vertex_count);
+    optimize_overdraw(indices,
+                      index_count,
+                      &prim.vertices[0].position.x,
+                      vertex_count,
+                      sizeof(Mesh::Vertex));
+    size_t unique_count;
+    auto remap = optimize_vertex_fetch_remap(
+        indices, index_count, vertex_count, unique_count);
+    prim.vertices = remap_vertices(prim.vertices, remap, unique_count);
+
+    after[i] = analyze_vertex_cache(indices, index_count, unique_count);
+  });
+
+  VertexCacheStats total_before, total_after;
+  for (size_t i = 0; i < primitives.size(); i++) {
+    total_before += before[i];
+    total_after += after[i];
+  }
+  if (total_before.triangle_count > 0 && _lazy == nullptr) {
+    std::cout << "mesh optimizer: ACMR " << total_before.acmr() << " -> "
+              << total_after.acmr() << ", ATVR " << total_before.atvr()
+              << " -> " << total_after.atvr() << std::endl;
+  }
+}
+
+void Gltf::narrow_indices(std::vector<MeshData> &mesh_data) {
+  auto narrow = [](PrimitiveData &prim) {
+    prim.short_indices.assign(prim.indices.begin(), prim.indices.end());
+    prim.indices = {};
+  };
+
+  for (auto &data : mesh_data) {
+    MeshData primitives;
+    for (auto &prim : data) {
+      auto vertex_count = prim.vertices.size();
+      if (prim.indices.empty() ||
+          !indices_in_range(prim.indices, vertex_count)) {
+        primitives.push_back(std::move(prim));
+        continue;
+      }
+      if (Mesh::index_type_for((uint32_t)vertex_count) == GL_UNSIGNED_SHORT) {
+        narrow(prim);
+        primitives.push_back(std::move(prim));
+        continue;
+      }
+
+      // sub-meshes with their own vertices, drawn with the same material
+      auto starts = split_by_vertex_count(
+          prim.indices.data(), prim.indices.size(), vertex_count, 0x10000);
+      starts.push_back(prim.indices.size());
+      for (size_t i = 0; i + 1 < starts.size(); i++) {
+        PrimitiveData part{};
+        part.indices.assign(prim.indices.begin() + starts[i],
+                            prim.indices.begin() + starts[i + 1]);
+        size_t unique_count;
+        auto remap = optimize_vertex_fetch_remap(part.indices.data(),
+                                                 part.indices.size(),
+                                                 vertex_count,
+                                                 unique_count);
+        part.vertices = remap_vertices(prim.vertices, remap, unique_count);
+        part.material = prim.material;
+        narrow(part);
+        primitives.push_back(std::move(part));
+      }
+    }
+    data = std::move(primitives);
+  }
+}
+
+void Gltf::build_lod_data(std::vector<MeshData> &mesh_data) {
+  std::vector<PrimitiveData *> primitives;
+  for (auto &data : mesh_data) {
+    for (auto &prim : data) {
+      // indices that are out of range were never narrowed
+      if (!prim.short_indices.empty()) {
+        primitives.push_back(&prim);
+      }
+    }
+  }
+
+  // stop when a level would be too small to matter or the seams and
+  // borders keep the simplifier from getting anywhere
+  const size_t min_triangles = 64;
+  const float min_reduction = 0.85f;
+  std::vector<std::vector<size_t>> triangle_counts(primitives.size());
+  ThreadPool::global().parallel_for(primitives.size(), [&](size_t i) {
+    auto &prim = *primitives[i];
+    auto &short_indices = prim.short_indices;
+    std::vector<uint32_t> indices(short_indices.begin(), short_indices.end());
+    prim.lods = {MeshLod{0, (uint32_t)indices.size(), 0.0f}};
+    triangle_counts[i].push_back(indices.size() / 3);
+
+    float error = 0.0f;
+    for (int lod = 1; lod < _settings.lod_count; lod++) {
+      auto target = indices.size() / 6 * 3;
+      if (target / 3 < min_triangles) {
+        break;
+      }
+      float lod_error;
+      auto simplified = simplify(indices.data(),
+                                 indices.size(),
+                                 prim.vertices.data(),
+                                 prim.vertices.size(),
+                                 target,
+                                 lod_error);
+      if (simplified.size() > indices.size() * min_reduction) {
+        break;
+      }
+      optimize_vertex_cache(
+          simplified.data(), simplified.size(), prim.vertices.size());
+      // every level is simplified from the previous one
+      error += lod_error;
+      prim.lods.push_back(MeshLod{(uint32_t)short_indices.size(),
+                                  (uint32_t)simplified.size(),
+                                  error});
+      short_indices.insert(
+          short_indices.end(), simplified.begin(), simplified.end());
+      triangle_counts[i].push_back(simplified.size() / 3);
+      indices = std::move(simplified);
+    }
+  });
+
+  std::vector<size_t> totals;
+  for (auto &counts : triangle_counts) {
+    totals.resize(std::max(totals.size(), counts.size()));
+    for (size_t lod = 0; lod < totals.size(); lod++) {
+      // primitives without a level draw their coarsest one
+      totals[lod] += counts[std::min(lod, counts.size() - 1)];
+    }
+  }
+  if (totals.size() > 1 && _lazy == nullptr) {
+    std::cout << "LOD triangles:";
+    for (auto total : totals) {
+      std::cout << " " << total;
+    }
+    std::cout << std::endl;
+  }
+}
+
+void Gltf::build_meshlet_data(std::vector<MeshData> &mesh_data) {
+  std::vector<PrimitiveData *> primitives;
+  for (auto &data : mesh_data) {
+    for (auto &prim : data) {
+      // indices that are out of range were never narrowed
+      if (!prim.short_indices.empty() ||
+          (!prim.indices.empty() &&
+           indices_in_range(prim.indices, prim.vertices.size()))) {
+        primitives.push_back(&prim);
+      }
+    }
+  }
 
+  ThreadPool::global().parallel_for(primitives.size(), [&](size_t i) {
+    auto &prim = *primitives[i];
+    auto positions = &prim.vertices[0].position.x;
+    // only the full detail level is culled
+    auto index_count =
+        prim.lods.empty() ? prim.index_count() : prim.lods[0].index_count;
+    if (!prim.short_indices.empty()) {
+      prim.meshlets = build_meshlets(prim.short_indices.data(),
+                                     index_count,
+                                     positions,
+                                     prim.vertices.size(),
+                                     sizeof(Mesh::Vertex));
+    } else {
+      prim.meshlets = build_meshlets(prim.indices.data(),
+                                     index_count,
+                                     positions,
+                                     prim.vertices.size(),
+                                     sizeof(Mesh::Vertex));
+    }
+  });
+}
+
+const void *Gltf::PrimitiveData::index_data() const {
+  if (!short_indices.empty()) {
+    return short_indices.data();
+  }
+  return indices.empty() ? nullptr : indices.data();
+}
+
+uint32_t Gltf::PrimitiveData::index_count() const {
+  return (uint32_t)(short_indices.empty() ? indices.size()
+                                          : short_indices.size());
+}
+
+GLenum Gltf::PrimitiveData::index_type() const {
+  return short_indices.empty() ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+}
+
+void Gltf::create_meshes(const std::vector<MeshData> &mesh_data) {
+  for (auto &data : mesh_data) {
+    meshes.emplace_back(create_primitives(data));
+  }
+}
+
+std::vector<Gltf::Primitive> Gltf::create_primitives(const MeshData &data) {
+  std::vector<Primitive> primitives;
+  primitives.reserve(data.size());
+  for (auto &prim : data) {
+    primitives.emplace_back(
+        Primitive{create_mesh(prim.vertices.data(),
+                              (uint32_t)prim.vertices.size(),
+                              prim.index_data(),
+                              prim.index_count(),
+                              prim.index_type(),
+                              prim.meshlets.data(),
+                              (uint32_t)prim.meshlets.size(),
+                              prim.lods.data(),
+                              (uint32_t)prim.lods.size()),
+                  prim.material});
+  }
+  return primitives;
+}
+
+void Gltf::create_native_meshes(tinygltf::Model &model) {
+  // buffer views are uploaded once, primitives share them
+  std::vector<std::shared_ptr<Buffer>> view_buffers(model.bufferViews.size());
+  auto view_buffer = [&](int view_index) {
+    auto &buffer = view_buffers[view_index];
+    if (buffer == nullptr) {
+      auto &view = model.bufferViews[view_index];
+      auto &data = model.buffers[view.buffer].data;
+      buffer = std::make_shared<Buffer>(&data[view.byteOffset],
+                                        view.byteLength);
+    }
+    return buffer;
+  };
+  auto usable = [&](const tinygltf::Accessor &accessor) {
+    if (accessor.bufferView < 0 || accessor.sparse.isSparse ||
+        accessor.ByteStride(model.bufferViews[accessor.bufferView]) < 0) {
+      std::cout << "warn: accessor can not be used in place" << std::endl;
+      return false;
+    }
+    return true;
+  };
+
+  // locations as in Mesh::Vertex
+  const std::pair<const char *, GLuint> locations[] = {{"POSITION", 0},
+                                                       {"NORMAL", 1},
+                                                       {"TANGENT", 2},
+                                                       {"TEXCOORD_0", 3},
+                                                       {"TEXCOORD_1", 4},
+                                                       {"COLOR_0", 5}};
+  for (auto &mesh : model.meshes) {
+    std::vector<Primitive> primitives;
+    primitives.reserve(mesh.primitives.size());
+    for (auto &prim : mesh.primitives) {
+      std::vector<VertexAttribute> attributes;
+      uint32_t vertex_count = 0;
+      for (auto &[attr_name, location] : locations) {
+        auto it = prim.attributes.find(attr_name);
+        if (it == prim.attributes.end() || it->second < 0) {
+          continue;
+        }
+        auto &accessor = model.accessors[it->second];
+        if (!usable(accessor)) {
+          continue;
+        }
+        auto &view = model.bufferViews[accessor.bufferView];
+        attributes.push_back(
+            VertexAttribute{location,
+                            tinygltf::GetNumComponentsInType(accessor.type),
+                            (GLenum)accessor.componentType,
+                            accessor.normalized,
+                            accessor.ByteStride(view),
+                            accessor.byteOffset,
+                            view_buffer(accessor.bufferView)});
+        vertex_count = std::max(vertex_count, (uint32_t)accessor.count);
+      }
+
+      std::shared_ptr<Buffer> index_buffer;
+      size_t index_offset = 0;
+      uint32_t index_count = 0;
+      GLenum index_type = GL_UNSIGNED_INT;
+      if (prim.indices >= 0 && usable(model.accessors[prim.indices])) {
+        auto &accessor = model.accessors[prim.indices];
+        index_buffer = view_buffer(accessor.bufferView);
+        index_offset = accessor.byteOffset;
+        index_count = (uint32_t)accessor.count;
+        index_type = (GLenum)accessor.componentType;
+      }
+      auto prim_mesh = std::make_unique<Mesh>(attributes,
+                                              vertex_count,
+                                              std::move(index_buffer),
+                                              index_offset,
+                                              index_count,
+                                              index_type);
+      auto position = prim.attributes.find("POSITION");
+      Aabb bounds;
+      if (position != prim.attributes.end() && position->second >= 0 &&
+          accessor_bounds(model.accessors[position->second], bounds)) {
+        prim_mesh->set_bounds(bounds);
+      }
+      primitives.emplace_back(Primitive{std::move(prim_mesh), prim.material});
+    }
     meshes.emplace_back(std::move(primitives));
   }
 }
 
+std::unique_ptr<Mesh> Gltf::create_mesh(const Mesh::Vertex *vertices,
+                                        uint32_t vertex_count,
+                                        const void *indices,
+                                        uint32_t index_count,
+                                        GLenum index_type,
+                                        const Meshlet *meshlets,
+                                        uint32_t meshlet_count,
+                                        const MeshLod *lods,
+                                        uint32_t lod_count) const {
+  std::unique_ptr<Mesh> mesh;
+  if (!_settings.pack_vertices) {
+    mesh = std::make_unique<Mesh>(vertices,
+                                  vertex_count,
+                                  indices,
+                                  index_count,
+                                  index_type,
+                                  _settings.geometry_pool);
+  } else {
+    glm::vec3 offset, scale;
+    auto packed = Mesh::pack_vertices(vertices, vertex_count, offset, scale);
+    mesh = std::make_unique<Mesh>(packed.data(),
+                                  vertex_count,
+                                  indices,
+                                  index_count,
+                                  index_type,
+                                  offset,
+                                  scale,
+                                  _settings.geometry_pool);
+  }
+  mesh->set_meshlets({meshlets, meshlets + meshlet_count});
+  mesh->set_lods({lods, lods + lod_count});
+  return mesh;
+}
+
 namespace {
 glm::mat4 gltf_node_local_transform(const tinygltf::Node &node) {
   glm::vec3 translation{0, 0, 0};
@@ -323,3 +1391,144 @@ void Gltf::load_node(tinygltf::Model &model,
     load_node(model, child_index, local_to_world);
   }
 }
+
+void Gltf::init_lazy(tinygltf::Model &model) {
+  // placeholders stand in until request_texture replaces their levels
+  const uint8_t white[] = {255, 255, 255, 255};
+  const uint8_t normal[] = {128, 128, 255, 255};
+  _lazy->texture_usage = texture_usage(model);
+  for (size_t i = 0; i < model.textures.size(); i++) {
+    auto settings = texture_settings(model, model.textures[i]);
+    auto color = _lazy->texture_usage[i].slots == SlotNormal ? normal : white;
+    textures.push_back(std::make_unique<Texture2D>(
+        color, GL_UNSIGNED_BYTE, 1, 1, 4, &settings));
+  }
+  add_default_textures();
+  load_materials(model);
+  load_scene(model);
+
+  _lazy->texture_requested.resize(model.textures.size());
+  _lazy->mesh_requested.resize(model.meshes.size());
+  if (_settings.native_accessors) {
+    // nothing to decode, the buffer views are uploaded as they are
+    create_native_meshes(model);
+  } else {
+    meshes.resize(model.meshes.size());
+  }
+}
+
+void Gltf::request_mesh(int index) {
+  if (_lazy == nullptr || index < 0 ||
+      index >= (int)_lazy->mesh_requested.size() ||
+      _lazy->mesh_requested[index]) {
+    return;
+  }
+  _lazy->mesh_requested[index] = true;
+
+  auto &mesh = _lazy->model.meshes[index];
+  for (auto &prim : mesh.primitives) {
+    if (prim.material < 0 || prim.material >= (int)materials.size()) {
+      continue;
+    }
+    auto &mat = *materials[prim.material];
+    for (auto tex : {mat.base_color,
+                     mat.metallic_roughness,
+                     mat.normal,
+                     mat.occlusion,
+                     mat.emission}) {
+      request_texture(tex);
+    }
+  }
+  if (_settings.native_accessors) {
+    return;
+  }
+
+  auto job = std::make_unique<LazyState::MeshJob>();
+  job->index = index;
+  job->done = ThreadPool::global().submit([this, job = job.get(), &mesh] {
+    job->data.emplace_back(decode_mesh(_lazy->model, mesh));
+    process_mesh_data(job->data);
+  });
+  _lazy->mesh_jobs.push_back(std::move(job));
+}
+
+void Gltf::request_texture(int index) {
+  // the default textures are not in the file
+  if (index < 0 || index >= (int)_lazy->texture_requested.size() ||
+      _lazy->texture_requested[index]) {
+    return;
+  }
+  _lazy->texture_requested[index] = true;
+
+  auto job = std::make_unique<LazyState::TextureJob>();
+  job->index = index;
+  job->done = ThreadPool::global().submit([this, job = job.get()] {
+    auto &model = _lazy->model;
+    auto &tex = model.textures[job->index];
+    // decode a copy, textures may share the image
+    auto image = model.images[tex.source];
+    if (image.as_is || (image.image.empty() && !image.uri.empty() &&
+                        !is_data_uri(image.uri))) {
+      decode_image(image, _lazy->base_dir);
+    }
+    if (image.image.empty()) {
+      return;
+    }
+    job->chain = cook_texture(image,
+                              cook_settings(image,
+                                            _lazy->texture_usage[job->index],
+                                            _settings.compress_textures));
+  });
+  _lazy->texture_jobs.push_back(std::move(job));
+}
+
+void Gltf::update() {
+  if (_lazy == nullptr) {
+    return;
+  }
+  // finished jobs are taken off the list, failed ones keep the placeholder
+  auto take_finished = [](auto &jobs, auto &&apply) {
+    auto it = std::remove_if(jobs.begin(), jobs.end(), [&](auto &job) {
+      if (job->done.wait_for(std::chrono::seconds(0)) !=
+          std::future_status::ready) {
+        return false;
+      }
+      try {
+        job->done.get();
+        apply(*job);
+      } catch (std::exception &e) {
+        std::cout << "warn: failed to load glTF resource: " << e.what()
+                  << std::endl;
+      }
+      return true;
+    });
+    jobs.erase(it, jobs.end());
+  };
+
+  take_finished(_lazy->mesh_jobs, [&](LazyState::MeshJob &job) {
+    meshes[job.index] = create_primitives(job.data[0]);
+  });
+  take_finished(_lazy->texture_jobs, [&](LazyState::TextureJob &job) {
+    if (job.chain.levels.empty()) {
+      return;
+    }
+    auto &texture = *textures[job.index];
+    auto streamer = _settings.texture_streamer;
+    if (streamer == nullptr) {
+      texture.reallocate(job.chain, job.chain.data.data());
+      return;
+    }
+    texture.reallocate(job.chain, nullptr);
+    streamer->enqueue(&texture, std::move(job.chain));
+  });
+}
+
+bool Gltf::idle() const {
+  return _lazy == nullptr ||
+         (_lazy->mesh_jobs.empty() && _lazy->texture_jobs.empty());
+}
+
+bool Gltf::is_default_texture(int index) const {
+  return index == (int)_white_tex_index ||
+         index == (int)_default_normal_tex_index;
+}
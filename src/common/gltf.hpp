@@ -2,16 +2,60 @@
 
 #include "data.hpp"
 #include "mesh.hpp"
+#include "mesh_optimizer.hpp"
 #include "texture.hpp"
 #include <memory>
 
 namespace tinygltf {
 class Model;
+struct Mesh;
 }
 
+class GltfCache;
+class TextureRegistry;
+class TextureStreamer;
+
+struct GltfSettings {
+  // cook the model into a binary cache on first load and load from it later
+  bool use_cache = true;
+  // upload textures progressively through the streamer instead of at load
+  TextureStreamer *texture_streamer = nullptr;
+  // Share textures of identical content with other scenes loaded through
+  // the registry. Within a scene they are always shared. Lazily loaded
+  // scenes keep textures of their own.
+  TextureRegistry *texture_registry = nullptr;
+  // encode textures to BC formats picked by the material slots they are used
+  // in, textures the driver can not sample compressed are kept as is
+  bool compress_textures = false;
+  // upload meshes as Mesh::PackedVertex, shaders need to dequantize them
+  bool pack_vertices = false;
+  // sub-allocate the meshes from the pool instead of giving each buffers of
+  // its own, the pool must outlive the scene
+  GeometryPool *geometry_pool = nullptr;
+  // merge duplicated vertices after decoding and index primitives that have
+  // no indices, weld_settings loosens what counts as a duplicate
+  bool weld_vertices = true;
+  WeldSettings weld_settings{};
+  // reorder triangles and vertices for the post-transform cache, overdraw
+  // and vertex fetch after decoding
+  bool optimize_meshes = true;
+  // detail levels per primitive including the full one, each simplified to
+  // half the triangles of the previous, 1 disables simplification
+  int lod_count = 4;
+  // Upload buffer views as they are and point the vertex attributes at them
+  // in the accessors' own formats, which accepts normalized integers and
+  // KHR_mesh_quantization data. None of the mesh processing above runs and
+  // the scene cache and the geometry pool are not used.
+  bool native_accessors = false;
+  // Keep the parsed file and decode meshes and textures only once a draw
+  // asks for them through Gltf::request_mesh. The scene cache is not used.
+  bool lazy_loading = false;
+};
+
 class Gltf {
 public:
-  Gltf(const fs::path &name);
+  Gltf(const fs::path &name, GltfSettings *settings = nullptr);
+  ~Gltf();
 
   struct Primitive {
     std::unique_ptr<Mesh> mesh;
@@ -42,19 +86,106 @@ public:
 
   std::vector<std::vector<Primitive>> meshes;
   std::vector<MeshDraw> draws;
-  std::vector<std::unique_ptr<Texture2D>> textures;
+  // textures of identical content and sampler state are the same object
+  std::vector<std::shared_ptr<Texture2D>> textures;
   std::vector<std::unique_ptr<Material>> materials;
 
+  // With lazy_loading, start loading a mesh and the textures of its
+  // materials in the background. Until update uploads them the mesh has no
+  // primitives and the textures are 1x1 placeholders, which keep their
+  // objects when filled in. Scenes loaded up front ignore it.
+  void request_mesh(int index);
+  // upload what finished loading, call once per frame on the GL thread
+  void update();
+  // nothing requested is still loading
+  bool idle() const;
+
+  // Whether a material slot points at one of the 1x1 textures standing in
+  // for missing maps, which shaders can skip sampling.
+  bool is_default_texture(int index) const;
+
 private:
+  struct LazyState;
+
+  struct PrimitiveData {
+    std::vector<Mesh::Vertex> vertices;
+    // the import stages work on 32-bit indices, they are moved to
+    // short_indices at the end when every vertex fits in 16 bits
+    std::vector<uint32_t> indices;
+    std::vector<uint16_t> short_indices;
+    std::vector<Meshlet> meshlets;
+    std::vector<MeshLod> lods;
+    int material;
+
+    const void *index_data() const;
+    uint32_t index_count() const;
+    GLenum index_type() const;
+  };
+  using MeshData = std::vector<PrimitiveData>;
+
+  // texels of all levels are laid out as described by layout
+  struct TextureData {
+    MipChain layout;
+    const uint8_t *texels;
+    TextureSettings settings;
+    // equal for equal texels and layouts
+    uint64_t content_key;
+  };
+
+  // textures cooking to the same chain share it
+  struct CookedTextures {
+    std::vector<MipChain> chains;
+    std::vector<uint64_t> content_keys;
+    // index into chains of every texture
+    std::vector<int> texture_chains;
+  };
+
+  fs::path cache_file(const fs::path &name) const;
   void load_model(const fs::path &name);
+  bool load_cache(const GltfCache &cache);
+  void write_cache(const fs::path &name,
+                   tinygltf::Model &model,
+                   const std::vector<MeshData> &mesh_data,
+                   const CookedTextures &cooked_textures);
   void load_materials(tinygltf::Model &model);
-  void load_textures(tinygltf::Model &model);
-  void load_meshes(tinygltf::Model &model);
+  // Chains already alive in the texture registry are not cooked again
+  // unless the cache needs them.
+  CookedTextures load_textures(tinygltf::Model &model);
+  void create_textures(const std::vector<TextureData> &texture_data);
+  void add_default_textures();
+  std::vector<MeshData> load_meshes(tinygltf::Model &model);
+  MeshData decode_mesh(tinygltf::Model &model, const tinygltf::Mesh &mesh);
+  // weld, optimize, narrow, simplify and cut into meshlets as configured
+  void process_mesh_data(std::vector<MeshData> &mesh_data);
+  void weld_mesh_data(std::vector<MeshData> &mesh_data);
+  void optimize_mesh_data(std::vector<MeshData> &mesh_data);
+  // split primitives too large for 16-bit indices and narrow the rest
+  void narrow_indices(std::vector<MeshData> &mesh_data);
+  // append simplified levels to the indices of every primitive
+  void build_lod_data(std::vector<MeshData> &mesh_data);
+  void build_meshlet_data(std::vector<MeshData> &mesh_data);
+  void create_meshes(const std::vector<MeshData> &mesh_data);
+  std::vector<Primitive> create_primitives(const MeshData &data);
+  void create_native_meshes(tinygltf::Model &model);
+  std::unique_ptr<Mesh> create_mesh(const Mesh::Vertex *vertices,
+                                    uint32_t vertex_count,
+                                    const void *indices,
+                                    uint32_t index_count,
+                                    GLenum index_type,
+                                    const Meshlet *meshlets,
+                                    uint32_t meshlet_count,
+                                    const MeshLod *lods,
+                                    uint32_t lod_count) const;
   void load_scene(tinygltf::Model &model);
   void load_node(tinygltf::Model &model,
                  int node_index,
                  const glm::mat4 &parent_to_world);
+  // placeholders, materials and draws of a lazy scene
+  void init_lazy(tinygltf::Model &model);
+  void request_texture(int index);
 
+  GltfSettings _settings;
   uint32_t _white_tex_index;
   uint32_t _default_normal_tex_index;
+  std::unique_ptr<LazyState> _lazy;
 };
\ No newline at end of file
@@ -0,0 +1,454 @@
+#include "gltf_cache.hpp"
+#include "mipmap.hpp"
+#include "utils.hpp"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+
+namespace {
+// bump whenever the layout of the file or the cooked data changes
+const uint32_t CACHE_VERSION = 9;
+const char CACHE_MAGIC[8] = {'O', 'G', 'L', 'S', 'C', 'E', 'N', 'E'};
+
+static_assert(std::is_trivially_copyable_v<Mesh::Vertex>);
+static_assert(std::is_trivially_copyable_v<Meshlet>);
+static_assert(std::is_trivially_copyable_v<MeshLod>);
+static_assert(std::is_trivially_copyable_v<Gltf::Material>);
+static_assert(std::is_trivially_copyable_v<Gltf::MeshDraw>);
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  // guard against layout changes of structs that are stored as raw bytes
+  uint32_t vertex_size;
+  uint32_t material_size;
+  uint32_t draw_size;
+  uint32_t source_count;
+  uint32_t mesh_count;
+  uint32_t primitive_count;
+  uint32_t texture_count;
+  uint32_t image_count;
+  uint32_t material_count;
+  uint32_t draw_count;
+  uint32_t padding;
+  uint64_t sources_offset;
+  uint64_t primitives_offset;
+  uint64_t textures_offset;
+  uint64_t images_offset;
+  uint64_t materials_offset;
+  uint64_t draws_offset;
+};
+
+// size of sources that did not exist when the cache was cooked
+const uint64_t MISSING_SOURCE = ~0ULL;
+
+// followed by path_size bytes of UTF-8 path, padded to 8 bytes
+struct SourceRecord {
+  uint64_t size;
+  int64_t mtime;
+  uint64_t hash;
+  uint32_t path_size;
+  uint32_t padding;
+};
+
+struct PrimitiveRecord {
+  uint32_t mesh;
+  int32_t material;
+  uint32_t vertex_count;
+  uint32_t index_count;
+  uint32_t index_type;
+  uint32_t meshlet_count;
+  uint32_t lod_count;
+  uint32_t padding;
+  uint64_t vertex_offset;
+  uint64_t index_offset;
+  uint64_t meshlet_offset;
+  uint64_t lod_offset;
+};
+
+struct TextureRecord {
+  int32_t image;
+  uint32_t wrap_s;
+  uint32_t wrap_t;
+  uint32_t min_filter;
+  uint32_t max_filter;
+  float border_color[4];
+};
+
+struct ImageRecord {
+  int32_t width;
+  int32_t height;
+  int32_t channels;
+  uint32_t type;
+  uint32_t compressed_format;
+  int32_t level_count;
+  uint64_t texel_offset;
+  uint64_t texel_size;
+  uint64_t content_key;
+};
+
+int64_t file_mtime(const fs::path &path) {
+  return static_cast<int64_t>(
+      fs::last_write_time(path).time_since_epoch().count());
+}
+
+uint64_t file_hash(const fs::path &path) {
+  MappedFile file(path);
+  return hash_bytes(file.data(), file.size());
+}
+
+class Writer {
+public:
+  explicit Writer(const fs::path &path)
+      : _ofs(path, std::ios::binary | std::ios::trunc) {
+    if (!_ofs) {
+      throw std::runtime_error("failed to open " + path.string());
+    }
+  }
+
+  uint64_t write(const void *data, size_t size) {
+    auto offset = _offset;
+    _ofs.write(static_cast<const char *>(data), (std::streamsize)size);
+    _offset += size;
+    return offset;
+  }
+
+  template <typename T> uint64_t write_array(const T *data, size_t count) {
+    align(16);
+    return write(data, sizeof(T) * count);
+  }
+
+  uint64_t offset() const {
+    return _offset;
+  }
+
+  void align(size_t alignment) {
+    static const char zeros[16]{};
+    auto padding = (alignment - _offset % alignment) % alignment;
+    write(zeros, padding);
+  }
+
+  void rewrite(uint64_t offset, const void *data, size_t size) {
+    _ofs.seekp((std::streamoff)offset);
+    _ofs.write(static_cast<const char *>(data), (std::streamsize)size);
+    _ofs.seekp((std::streamoff)_offset);
+  }
+
+  void close() {
+    _ofs.close();
+    if (!_ofs) {
+      throw std::runtime_error("failed to write scene cache");
+    }
+  }
+
+private:
+  std::ofstream _ofs;
+  uint64_t _offset = 0;
+};
+
+class Reader {
+public:
+  Reader(const uint8_t *data, size_t size) : _data(data), _size(size) {}
+
+  template <typename T>
+  const T *array(uint64_t offset, size_t count) const {
+    if (offset > _size || count > (_size - offset) / sizeof(T) ||
+        offset % alignof(T) != 0) {
+      throw std::runtime_error("corrupted scene cache");
+    }
+    return reinterpret_cast<const T *>(_data + offset);
+  }
+
+private:
+  const uint8_t *_data;
+  size_t _size;
+};
+
+bool sources_up_to_date(const Reader &reader, const Header &header) {
+  uint64_t offset = header.sources_offset;
+  for (uint32_t i = 0; i < header.source_count; i++) {
+    auto record = reader.array<SourceRecord>(offset, 1);
+    offset += sizeof(SourceRecord);
+    auto path_data = reader.array<char>(offset, record->path_size);
+    offset += (record->path_size + 7) / 8 * 8;
+
+    auto path = fs::u8path(path_data, path_data + record->path_size);
+    std::error_code ec;
+    auto size = fs::file_size(path, ec);
+    if (record->size == MISSING_SOURCE) {
+      if (!ec) {
+        return false;
+      }
+      continue;
+    }
+    if (ec || size != record->size) {
+      return false;
+    }
+    // touching a file without changing it only costs a rehash
+    if (file_mtime(path) != record->mtime &&
+        file_hash(path) != record->hash) {
+      return false;
+    }
+  }
+  return true;
+}
+} // namespace
+
+fs::path GltfCache::cache_file(const fs::path &name,
+                               const std::string &variant) {
+  auto path = Data::cache_path() / name;
+  if (!variant.empty()) {
+    path += "." + variant;
+  }
+  path += ".scene";
+  return path;
+}
+
+void GltfCache::write(const fs::path &path,
+                      const std::vector<fs::path> &sources,
+                      const Contents &contents) {
+  fs::create_directories(path.parent_path());
+  auto tmp_path = path;
+  tmp_path += ".tmp";
+
+  {
+    Writer writer(tmp_path);
+    Header header{};
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.vertex_size = sizeof(Mesh::Vertex);
+    header.material_size = sizeof(Gltf::Material);
+    header.draw_size = sizeof(Gltf::MeshDraw);
+    header.source_count = (uint32_t)sources.size();
+    header.mesh_count = contents.mesh_count;
+    header.primitive_count = (uint32_t)contents.primitives.size();
+    header.texture_count = (uint32_t)contents.textures.size();
+    header.image_count = (uint32_t)contents.images.size();
+    header.material_count = (uint32_t)contents.materials.size();
+    header.draw_count = (uint32_t)contents.draws.size();
+    writer.write(&header, sizeof(header));
+
+    writer.align(16);
+    header.sources_offset = writer.offset();
+    for (auto &source : sources) {
+      auto path_str = source.u8string();
+      SourceRecord record{};
+      std::error_code ec;
+      if (fs::exists(source, ec)) {
+        record.size = fs::file_size(source);
+        record.mtime = file_mtime(source);
+        record.hash = file_hash(source);
+      } else {
+        record.size = MISSING_SOURCE;
+      }
+      record.path_size = (uint32_t)path_str.size();
+      writer.write(&record, sizeof(record));
+      writer.write(path_str.data(), path_str.size());
+      writer.align(8);
+    }
+
+    std::vector<PrimitiveRecord> primitives;
+    for (auto &prim : contents.primitives) {
+      PrimitiveRecord record{};
+      record.mesh = prim.mesh;
+      record.material = prim.material;
+      record.vertex_count = prim.vertex_count;
+      record.index_count = prim.index_count;
+      record.index_type = prim.index_type;
+      record.vertex_offset =
+          writer.write_array(prim.vertices, prim.vertex_count);
+      record.index_offset = writer.write_array(
+          (const uint8_t *)prim.indices,
+          Mesh::index_size(prim.index_type) * prim.index_count);
+      record.meshlet_count = prim.meshlet_count;
+      record.meshlet_offset =
+          writer.write_array(prim.meshlets, prim.meshlet_count);
+      record.lod_count = prim.lod_count;
+      record.lod_offset = writer.write_array(prim.lods, prim.lod_count);
+      primitives.push_back(record);
+    }
+
+    std::vector<ImageRecord> images;
+    for (auto &image : contents.images) {
+      ImageRecord record{};
+      record.width = image.width;
+      record.height = image.height;
+      record.channels = image.channels;
+      record.type = image.type;
+      record.compressed_format = image.compressed_format;
+      record.level_count = image.level_count;
+      record.texel_offset = writer.write_array(image.texels, image.texel_size);
+      record.texel_size = image.texel_size;
+      record.content_key = image.content_key;
+      images.push_back(record);
+    }
+
+    std::vector<TextureRecord> textures;
+    for (auto &tex : contents.textures) {
+      TextureRecord record{};
+      record.image = tex.image;
+      record.wrap_s = tex.settings.wrap_s;
+      record.wrap_t = tex.settings.wrap_t;
+      record.min_filter = tex.settings.min_filter;
+      record.max_filter = tex.settings.max_filter;
+      for (int i = 0; i < 4; i++) {
+        record.border_color[i] = tex.settings.border_color[i];
+      }
+      textures.push_back(record);
+    }
+
+    header.primitives_offset =
+        writer.write_array(primitives.data(), primitives.size());
+    header.images_offset = writer.write_array(images.data(), images.size());
+    header.textures_offset =
+        writer.write_array(textures.data(), textures.size());
+    header.materials_offset = writer.write_array(contents.materials.data(),
+                                                 contents.materials.size());
+    header.draws_offset =
+        writer.write_array(contents.draws.data(), contents.draws.size());
+
+    writer.rewrite(0, &header, sizeof(header));
+    writer.close();
+  }
+
+  fs::rename(tmp_path, path);
+}
+
+std::unique_ptr<GltfCache> GltfCache::open(const fs::path &path) {
+  std::error_code ec;
+  if (!fs::exists(path, ec)) {
+    return nullptr;
+  }
+
+  try {
+    std::unique_ptr<GltfCache> cache(new GltfCache(MappedFile(path)));
+    Reader reader(cache->_file.data(), cache->_file.size());
+
+    auto header = reader.array<Header>(0, 1);
+    if (std::memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        header->version != CACHE_VERSION ||
+        header->vertex_size != sizeof(Mesh::Vertex) ||
+        header->material_size != sizeof(Gltf::Material) ||
+        header->draw_size != sizeof(Gltf::MeshDraw)) {
+      return nullptr;
+    }
+    if (!sources_up_to_date(reader, *header)) {
+      return nullptr;
+    }
+
+    auto &contents = cache->_contents;
+    contents.mesh_count = header->mesh_count;
+
+    auto primitives = reader.array<PrimitiveRecord>(header->primitives_offset,
+                                                    header->primitive_count);
+    for (uint32_t i = 0; i < header->primitive_count; i++) {
+      auto &record = primitives[i];
+      if (record.mesh >= header->mesh_count ||
+          (record.index_type != GL_UNSIGNED_SHORT &&
+           record.index_type != GL_UNSIGNED_INT)) {
+        throw std::runtime_error("corrupted scene cache");
+      }
+      Primitive prim{};
+      prim.mesh = record.mesh;
+      prim.material = record.material;
+      prim.vertex_count = record.vertex_count;
+      prim.vertices = reader.array<Mesh::Vertex>(record.vertex_offset,
+                                                 record.vertex_count);
+      prim.index_count = record.index_count;
+      prim.index_type = record.index_type;
+      prim.indices = reader.array<uint8_t>(
+          record.index_offset,
+          Mesh::index_size(prim.index_type) * prim.index_count);
+      prim.meshlet_count = record.meshlet_count;
+      prim.meshlets =
+          reader.array<Meshlet>(record.meshlet_offset, record.meshlet_count);
+      for (uint32_t j = 0; j < prim.meshlet_count; j++) {
+        auto &meshlet = prim.meshlets[j];
+        if (meshlet.index_offset > prim.index_count ||
+            meshlet.triangle_count * 3 >
+                prim.index_count - meshlet.index_offset) {
+          throw std::runtime_error("corrupted scene cache");
+        }
+      }
+      prim.lod_count = record.lod_count;
+      prim.lods = reader.array<MeshLod>(record.lod_offset, record.lod_count);
+      for (uint32_t j = 0; j < prim.lod_count; j++) {
+        auto &lod = prim.lods[j];
+        if (lod.index_offset > prim.index_count ||
+            lod.index_count > prim.index_count - lod.index_offset) {
+          throw std::runtime_error("corrupted scene cache");
+        }
+      }
+      contents.primitives.push_back(prim);
+    }
+
+    auto images =
+        reader.array<ImageRecord>(header->images_offset, header->image_count);
+    for (uint32_t i = 0; i < header->image_count; i++) {
+      auto &record = images[i];
+      if (record.width <= 0 || record.height <= 0 || record.level_count <= 0 ||
+          record.level_count > mip_level_count(record.width, record.height) ||
+          record.texel_size != mip_chain_layout(record.type,
+                                                record.channels,
+                                                record.compressed_format,
+                                                record.width,
+                                                record.height,
+                                                record.level_count)
+                                   .size()) {
+        throw std::runtime_error("corrupted scene cache");
+      }
+      Image image{};
+      image.width = record.width;
+      image.height = record.height;
+      image.channels = record.channels;
+      image.type = record.type;
+      image.compressed_format = record.compressed_format;
+      image.level_count = record.level_count;
+      image.texel_size = record.texel_size;
+      image.content_key = record.content_key;
+      image.texels =
+          reader.array<uint8_t>(record.texel_offset, record.texel_size);
+      contents.images.push_back(image);
+    }
+
+    auto textures = reader.array<TextureRecord>(header->textures_offset,
+                                                header->texture_count);
+    for (uint32_t i = 0; i < header->texture_count; i++) {
+      auto &record = textures[i];
+      if (record.image < 0 || record.image >= (int32_t)header->image_count) {
+        throw std::runtime_error("corrupted scene cache");
+      }
+      Texture tex{};
+      tex.image = record.image;
+      tex.settings.wrap_s = record.wrap_s;
+      tex.settings.wrap_t = record.wrap_t;
+      tex.settings.min_filter = record.min_filter;
+      tex.settings.max_filter = record.max_filter;
+      tex.settings.border_color = glm::vec4(record.border_color[0],
+                                            record.border_color[1],
+                                            record.border_color[2],
+                                            record.border_color[3]);
+      contents.textures.push_back(tex);
+    }
+
+    auto materials = reader.array<Gltf::Material>(header->materials_offset,
+                                                  header->material_count);
+    contents.materials.assign(materials, materials + header->material_count);
+    auto draws =
+        reader.array<Gltf::MeshDraw>(header->draws_offset, header->draw_count);
+    contents.draws.assign(draws, draws + header->draw_count);
+
+    return cache;
+  } catch (std::exception &e) {
+    std::cout << "warn: ignore scene cache " << path << ": " << e.what()
+              << std::endl;
+    return nullptr;
+  }
+}
+
+GltfCache::GltfCache(MappedFile file) : _file(std::move(file)) {}
+
+const GltfCache::Contents &GltfCache::contents() const {
+  return _contents;
+}
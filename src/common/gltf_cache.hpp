@@ -0,0 +1,76 @@
+#pragma once
+
+#include "data.hpp"
+#include "gltf.hpp"
+#include <memory>
+
+// Cooked form of a Gltf written to a single binary file. Loading it skips
+// JSON parsing, image decoding and accessor conversion, everything is uploaded
+// straight from the mapped file.
+class GltfCache {
+public:
+  struct Primitive {
+    uint32_t mesh;
+    int material;
+    const Mesh::Vertex *vertices;
+    uint32_t vertex_count;
+    const void *indices;
+    uint32_t index_count;
+    GLenum index_type;
+    const Meshlet *meshlets;
+    uint32_t meshlet_count;
+    const MeshLod *lods;
+    uint32_t lod_count;
+  };
+
+  struct Texture {
+    int image;
+    TextureSettings settings;
+  };
+
+  // a mip chain as laid out by mip_chain_layout
+  struct Image {
+    int width;
+    int height;
+    int channels;
+    GLenum type;
+    GLenum compressed_format;
+    int level_count;
+    const uint8_t *texels;
+    size_t texel_size;
+    // Gltf::TextureData::content_key of the chain
+    uint64_t content_key;
+  };
+
+  struct Contents {
+    uint32_t mesh_count{};
+    // grouped by mesh, in the order they are drawn
+    std::vector<Primitive> primitives;
+    std::vector<Texture> textures;
+    std::vector<Image> images;
+    std::vector<Gltf::Material> materials;
+    std::vector<Gltf::MeshDraw> draws;
+  };
+
+  // Where the cache of a model in the data folder lives. Models cooked with
+  // different settings are kept in separate files named by variant.
+  static fs::path cache_file(const fs::path &name, const std::string &variant);
+
+  // sources are the files the cache is cooked from, they are used to detect
+  // stale caches
+  static void write(const fs::path &path,
+                    const std::vector<fs::path> &sources,
+                    const Contents &contents);
+
+  // returns nullptr if the cache does not exist, has a different version or
+  // any of its sources changed
+  static std::unique_ptr<GltfCache> open(const fs::path &path);
+
+  const Contents &contents() const;
+
+private:
+  explicit GltfCache(MappedFile file);
+
+  MappedFile _file;
+  Contents _contents;
+};
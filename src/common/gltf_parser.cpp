@@ -0,0 +1,644 @@
+#include "gltf_parser.hpp"
+#include "meshopt_decoder.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <cstring>
+#include <json.hpp>
+#include <stdexcept>
+#include <tiny_gltf.h>
+
+using nlohmann::json;
+
+fs::path uri_to_path(const fs::path &base_dir, const std::string &uri) {
+  std::string decoded;
+  for (size_t i = 0; i < uri.size(); i++) {
+    if (uri[i] == '%' && i + 2 < uri.size()) {
+      decoded.push_back((char)std::stoi(uri.substr(i + 1, 2), nullptr, 16));
+      i += 2;
+    } else {
+      decoded.push_back(uri[i]);
+    }
+  }
+  return base_dir / fs::u8path(decoded);
+}
+
+bool is_data_uri(const std::string &uri) {
+  return uri.rfind("data:", 0) == 0;
+}
+
+namespace {
+template <typename T>
+T get(const json &object, const char *key, const T &fallback) {
+  auto it = object.find(key);
+  if (it == object.end() || it->is_null()) {
+    return fallback;
+  }
+  return it->get<T>();
+}
+
+int accessor_type(const std::string &type) {
+  if (type == "SCALAR") {
+    return TINYGLTF_TYPE_SCALAR;
+  } else if (type == "VEC2") {
+    return TINYGLTF_TYPE_VEC2;
+  } else if (type == "VEC3") {
+    return TINYGLTF_TYPE_VEC3;
+  } else if (type == "VEC4") {
+    return TINYGLTF_TYPE_VEC4;
+  } else if (type == "MAT2") {
+    return TINYGLTF_TYPE_MAT2;
+  } else if (type == "MAT3") {
+    return TINYGLTF_TYPE_MAT3;
+  } else if (type == "MAT4") {
+    return TINYGLTF_TYPE_MAT4;
+  }
+  throw std::runtime_error("invalid accessor type \"" + type + "\"");
+}
+
+tinygltf::Accessor parse_accessor(const json &e) {
+  tinygltf::Accessor accessor;
+  accessor.name = get(e, "name", std::string());
+  accessor.bufferView = get(e, "bufferView", -1);
+  accessor.byteOffset = get(e, "byteOffset", size_t(0));
+  accessor.normalized = get(e, "normalized", false);
+  accessor.componentType = get(e, "componentType", -1);
+  accessor.count = get(e, "count", size_t(0));
+  accessor.type = accessor_type(get(e, "type", std::string()));
+  accessor.minValues = get(e, "min", std::vector<double>());
+  accessor.maxValues = get(e, "max", std::vector<double>());
+  auto sparse = e.find("sparse");
+  if (sparse != e.end()) {
+    auto &indices = sparse->at("indices");
+    auto &values = sparse->at("values");
+    accessor.sparse.isSparse = true;
+    accessor.sparse.count = get(*sparse, "count", 0);
+    accessor.sparse.indices.bufferView = get(indices, "bufferView", -1);
+    accessor.sparse.indices.byteOffset = get(indices, "byteOffset", 0);
+    accessor.sparse.indices.componentType = get(indices, "componentType", -1);
+    accessor.sparse.values.bufferView = get(values, "bufferView", -1);
+    accessor.sparse.values.byteOffset = get(values, "byteOffset", 0);
+  }
+  return accessor;
+}
+
+tinygltf::BufferView parse_buffer_view(const json &e) {
+  tinygltf::BufferView view;
+  view.name = get(e, "name", std::string());
+  view.buffer = get(e, "buffer", -1);
+  view.byteOffset = get(e, "byteOffset", size_t(0));
+  view.byteLength = get(e, "byteLength", size_t(0));
+  view.byteStride = get(e, "byteStride", size_t(0));
+  view.target = get(e, "target", 0);
+  return view;
+}
+
+// a buffer view whose data is EXT_meshopt_compression encoded elsewhere
+struct CompressedView {
+  int view;
+  int buffer;
+  size_t byte_offset;
+  size_t byte_length;
+  size_t byte_stride;
+  size_t count;
+  MeshoptMode mode;
+  MeshoptFilter filter;
+};
+
+const json *meshopt_extension(const json &e) {
+  auto extensions = e.find("extensions");
+  if (extensions == e.end()) {
+    return nullptr;
+  }
+  auto it = extensions->find("EXT_meshopt_compression");
+  return it == extensions->end() ? nullptr : &*it;
+}
+
+CompressedView parse_compressed_view(const json &ext, int view) {
+  CompressedView compressed;
+  compressed.view = view;
+  compressed.buffer = get(ext, "buffer", -1);
+  compressed.byte_offset = get(ext, "byteOffset", size_t(0));
+  compressed.byte_length = get(ext, "byteLength", size_t(0));
+  compressed.byte_stride = get(ext, "byteStride", size_t(0));
+  compressed.count = get(ext, "count", size_t(0));
+  auto mode = get(ext, "mode", std::string());
+  if (mode == "ATTRIBUTES") {
+    compressed.mode = MeshoptMode::Attributes;
+  } else if (mode == "TRIANGLES") {
+    compressed.mode = MeshoptMode::Triangles;
+  } else if (mode == "INDICES") {
+    compressed.mode = MeshoptMode::Indices;
+  } else {
+    throw std::runtime_error("invalid meshopt mode \"" + mode + "\"");
+  }
+  auto filter = get(ext, "filter", std::string("NONE"));
+  if (filter == "NONE") {
+    compressed.filter = MeshoptFilter::None;
+  } else if (filter == "OCTAHEDRAL") {
+    compressed.filter = MeshoptFilter::Octahedral;
+  } else if (filter == "QUATERNION") {
+    compressed.filter = MeshoptFilter::Quaternion;
+  } else if (filter == "EXPONENTIAL") {
+    compressed.filter = MeshoptFilter::Exponential;
+  } else {
+    throw std::runtime_error("invalid meshopt filter \"" + filter + "\"");
+  }
+  return compressed;
+}
+
+tinygltf::Image parse_image(const json &e) {
+  tinygltf::Image image;
+  image.name = get(e, "name", std::string());
+  image.uri = get(e, "uri", std::string());
+  image.mimeType = get(e, "mimeType", std::string());
+  image.bufferView = get(e, "bufferView", -1);
+  return image;
+}
+
+tinygltf::Sampler parse_sampler(const json &e) {
+  tinygltf::Sampler sampler;
+  sampler.name = get(e, "name", std::string());
+  sampler.minFilter = get(e, "minFilter", -1);
+  sampler.magFilter = get(e, "magFilter", -1);
+  sampler.wrapS = get(e, "wrapS", TINYGLTF_TEXTURE_WRAP_REPEAT);
+  sampler.wrapT = get(e, "wrapT", TINYGLTF_TEXTURE_WRAP_REPEAT);
+  return sampler;
+}
+
+tinygltf::Texture parse_texture(const json &e) {
+  tinygltf::Texture texture;
+  texture.name = get(e, "name", std::string());
+  texture.sampler = get(e, "sampler", -1);
+  texture.source = get(e, "source", -1);
+  return texture;
+}
+
+template <typename Info>
+void parse_texture_info(const json &e, const char *key, Info &info) {
+  auto it = e.find(key);
+  if (it != e.end()) {
+    info.index = get(*it, "index", -1);
+    info.texCoord = get(*it, "texCoord", 0);
+  }
+}
+
+tinygltf::Material parse_material(const json &e) {
+  tinygltf::Material mat;
+  mat.name = get(e, "name", std::string());
+  auto pbr = e.find("pbrMetallicRoughness");
+  if (pbr != e.end()) {
+    auto &m = mat.pbrMetallicRoughness;
+    m.baseColorFactor = get(*pbr, "baseColorFactor", m.baseColorFactor);
+    m.metallicFactor = get(*pbr, "metallicFactor", 1.0);
+    m.roughnessFactor = get(*pbr, "roughnessFactor", 1.0);
+    parse_texture_info(*pbr, "baseColorTexture", m.baseColorTexture);
+    parse_texture_info(
+        *pbr, "metallicRoughnessTexture", m.metallicRoughnessTexture);
+  }
+  parse_texture_info(e, "normalTexture", mat.normalTexture);
+  parse_texture_info(e, "occlusionTexture", mat.occlusionTexture);
+  parse_texture_info(e, "emissiveTexture", mat.emissiveTexture);
+  auto normal = e.find("normalTexture");
+  if (normal != e.end()) {
+    mat.normalTexture.scale = get(*normal, "scale", 1.0);
+  }
+  auto occlusion = e.find("occlusionTexture");
+  if (occlusion != e.end()) {
+    mat.occlusionTexture.strength = get(*occlusion, "strength", 1.0);
+  }
+  mat.emissiveFactor =
+      get(e, "emissiveFactor", std::vector<double>{0.0, 0.0, 0.0});
+  mat.alphaMode = get(e, "alphaMode", std::string("OPAQUE"));
+  mat.alphaCutoff = get(e, "alphaCutoff", 0.5);
+  mat.doubleSided = get(e, "doubleSided", false);
+  return mat;
+}
+
+tinygltf::Mesh parse_mesh(const json &e) {
+  tinygltf::Mesh mesh;
+  mesh.name = get(e, "name", std::string());
+  auto primitives = e.find("primitives");
+  if (primitives == e.end()) {
+    return mesh;
+  }
+  for (auto &p : *primitives) {
+    tinygltf::Primitive prim;
+    prim.attributes = get(p, "attributes", std::map<std::string, int>());
+    prim.material = get(p, "material", -1);
+    prim.indices = get(p, "indices", -1);
+    prim.mode = get(p, "mode", TINYGLTF_MODE_TRIANGLES);
+    mesh.primitives.push_back(std::move(prim));
+  }
+  return mesh;
+}
+
+tinygltf::Node parse_node(const json &e) {
+  tinygltf::Node node;
+  node.name = get(e, "name", std::string());
+  node.mesh = get(e, "mesh", -1);
+  node.children = get(e, "children", std::vector<int>());
+  node.matrix = get(e, "matrix", std::vector<double>());
+  node.translation = get(e, "translation", std::vector<double>());
+  node.rotation = get(e, "rotation", std::vector<double>());
+  node.scale = get(e, "scale", std::vector<double>());
+  return node;
+}
+
+tinygltf::Scene parse_scene(const json &e) {
+  tinygltf::Scene scene;
+  scene.name = get(e, "name", std::string());
+  scene.nodes = get(e, "nodes", std::vector<int>());
+  return scene;
+}
+
+// Builds one element of a top level array at a time from SAX events and
+// hands it to the model, values outside those arrays are dropped as they
+// are read.
+class GltfSax final : public nlohmann::json_sax<json> {
+public:
+  explicit GltfSax(tinygltf::Model &model) : _model(model) {}
+
+  // byteLength of every buffer, tinygltf::Buffer has no room for it
+  std::vector<size_t> buffer_lengths;
+  // buffers that only stand in for EXT_meshopt_compression data
+  std::vector<bool> fallback_buffers;
+  std::vector<CompressedView> compressed_views;
+  std::string error;
+
+  bool null() override {
+    return value(json());
+  }
+  bool boolean(bool val) override {
+    return value(json(val));
+  }
+  bool number_integer(number_integer_t val) override {
+    return value(json(val));
+  }
+  bool number_unsigned(number_unsigned_t val) override {
+    return value(json(val));
+  }
+  bool number_float(number_float_t val, const string_t &) override {
+    return value(json(val));
+  }
+  bool string(string_t &val) override {
+    return value(json(std::move(val)));
+  }
+  bool start_object(std::size_t) override {
+    return start(json::object());
+  }
+  bool start_array(std::size_t) override {
+    return start(json::array());
+  }
+  bool end_object() override {
+    return end();
+  }
+  bool end_array() override {
+    return end();
+  }
+  bool key(string_t &val) override {
+    if (_skip_depth > 0) {
+      return true;
+    }
+    if (!_stack.empty()) {
+      _key = std::move(val);
+    } else if (_depth == 1) {
+      _top_key = std::move(val);
+    }
+    return true;
+  }
+  bool parse_error(std::size_t,
+                   const std::string &,
+                   const nlohmann::detail::exception &ex) override {
+    error = ex.what();
+    return false;
+  }
+
+private:
+  // depth 1 is the root object and 2 the top level arrays
+  bool in_collected_array() const {
+    return _depth == 2 && _collecting;
+  }
+
+  // extras and extensions of elements are never read, often they are most
+  // of what CAD exporters write per node. Buffers and buffer views keep
+  // their extensions for EXT_meshopt_compression.
+  bool skipped_member() const {
+    if (!_stack.back()->is_object()) {
+      return false;
+    }
+    if (_key == "extensions") {
+      return _stack.size() > 1 ||
+             (_top_key != "buffers" && _top_key != "bufferViews");
+    }
+    return _key == "extras";
+  }
+
+  json *insert(json &&val) {
+    auto &parent = *_stack.back();
+    if (parent.is_object()) {
+      return &(parent[_key] = std::move(val));
+    }
+    parent.push_back(std::move(val));
+    return &parent.back();
+  }
+
+  bool value(json &&val) {
+    if (_skip_depth > 0) {
+      return true;
+    }
+    if (!_stack.empty()) {
+      if (!skipped_member()) {
+        insert(std::move(val));
+      }
+    } else if (in_collected_array()) {
+      add_element(val);
+    } else if (_depth == 1 && _top_key == "scene") {
+      _model.defaultScene = val.get<int>();
+    }
+    return true;
+  }
+
+  bool start(json &&container) {
+    if (_skip_depth > 0) {
+      _depth++;
+      return true;
+    }
+    if (!_stack.empty() && skipped_member()) {
+      _skip_depth = _depth + 1;
+    } else if (!_stack.empty()) {
+      _stack.push_back(insert(std::move(container)));
+    } else if (in_collected_array()) {
+      _element = std::move(container);
+      _stack.push_back(&_element);
+    } else if (_depth == 1) {
+      _collecting = container.is_array() && collected(_top_key);
+    }
+    _depth++;
+    return true;
+  }
+
+  bool end() {
+    _depth--;
+    if (_skip_depth > 0) {
+      if (_depth < _skip_depth) {
+        _skip_depth = 0;
+      }
+      return true;
+    }
+    if (!_stack.empty()) {
+      _stack.pop_back();
+      if (_stack.empty()) {
+        add_element(_element);
+        _element = json();
+      }
+    }
+    return true;
+  }
+
+  static bool collected(const std::string &name) {
+    static const char *const names[] = {"accessors",
+                                        "bufferViews",
+                                        "buffers",
+                                        "images",
+                                        "materials",
+                                        "meshes",
+                                        "nodes",
+                                        "samplers",
+                                        "scenes",
+                                        "textures",
+                                        "extensionsUsed",
+                                        "extensionsRequired"};
+    for (auto n : names) {
+      if (name == n) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void add_element(const json &e) {
+    auto &name = _top_key;
+    if (name == "accessors") {
+      _model.accessors.push_back(parse_accessor(e));
+    } else if (name == "bufferViews") {
+      if (auto ext = meshopt_extension(e)) {
+        compressed_views.push_back(
+            parse_compressed_view(*ext, (int)_model.bufferViews.size()));
+      }
+      _model.bufferViews.push_back(parse_buffer_view(e));
+    } else if (name == "buffers") {
+      tinygltf::Buffer buffer;
+      buffer.name = get(e, "name", std::string());
+      buffer.uri = get(e, "uri", std::string());
+      _model.buffers.push_back(std::move(buffer));
+      buffer_lengths.push_back(get(e, "byteLength", size_t(0)));
+      auto ext = meshopt_extension(e);
+      fallback_buffers.push_back(ext && get(*ext, "fallback", false));
+    } else if (name == "images") {
+      _model.images.push_back(parse_image(e));
+    } else if (name == "materials") {
+      _model.materials.push_back(parse_material(e));
+    } else if (name == "meshes") {
+      _model.meshes.push_back(parse_mesh(e));
+    } else if (name == "nodes") {
+      _model.nodes.push_back(parse_node(e));
+    } else if (name == "samplers") {
+      _model.samplers.push_back(parse_sampler(e));
+    } else if (name == "scenes") {
+      _model.scenes.push_back(parse_scene(e));
+    } else if (name == "textures") {
+      _model.textures.push_back(parse_texture(e));
+    } else if (name == "extensionsUsed") {
+      _model.extensionsUsed.push_back(e.get<std::string>());
+    } else if (name == "extensionsRequired") {
+      _model.extensionsRequired.push_back(e.get<std::string>());
+    }
+  }
+
+  tinygltf::Model &_model;
+  int _depth = 0;
+  std::string _top_key;
+  bool _collecting = false;
+  json _element;
+  // open containers of _element, the innermost last
+  std::vector<json *> _stack;
+  std::string _key;
+  // depth of the skipped member being read, 0 when none is
+  int _skip_depth = 0;
+};
+
+struct GlbChunks {
+  const uint8_t *json = nullptr;
+  size_t json_size = 0;
+  const uint8_t *bin = nullptr;
+  size_t bin_size = 0;
+};
+
+GlbChunks read_glb(const uint8_t *data, size_t size) {
+  uint32_t header[3];
+  std::memcpy(header, data, sizeof(header));
+  if (header[1] != 2) {
+    throw std::runtime_error("unsupported GLB version " +
+                             std::to_string(header[1]));
+  }
+  size = std::min<size_t>(size, header[2]);
+
+  GlbChunks chunks;
+  size_t offset = sizeof(header);
+  while (offset + 8 <= size) {
+    uint32_t chunk[2];
+    std::memcpy(chunk, data + offset, sizeof(chunk));
+    offset += sizeof(chunk);
+    if (chunk[0] > size - offset) {
+      throw std::runtime_error("GLB chunk exceeds the file");
+    }
+    if (chunk[1] == 0x4E4F534A && chunks.json == nullptr) {
+      chunks.json = data + offset;
+      chunks.json_size = chunk[0];
+    } else if (chunk[1] == 0x004E4942 && chunks.bin == nullptr) {
+      chunks.bin = data + offset;
+      chunks.bin_size = chunk[0];
+    }
+    // chunks are 4-byte aligned
+    offset += (chunk[0] + 3) & ~3u;
+  }
+  if (chunks.json == nullptr) {
+    throw std::runtime_error("GLB has no JSON chunk");
+  }
+  return chunks;
+}
+
+void load_buffers(tinygltf::Model &model,
+                  const GltfSax &sax,
+                  const GlbChunks &glb,
+                  const fs::path &base_dir) {
+  for (size_t i = 0; i < model.buffers.size(); i++) {
+    auto &buffer = model.buffers[i];
+    auto length = sax.buffer_lengths[i];
+    auto name = "buffer " + std::to_string(i);
+    if (sax.fallback_buffers[i]) {
+      // only read through compressed views, which are decoded instead
+      continue;
+    } else if (buffer.uri.empty()) {
+      // only the first buffer of a GLB may live in its binary chunk
+      if (i != 0 || glb.bin == nullptr || glb.bin_size < length) {
+        throw std::runtime_error(name + " has no data");
+      }
+      buffer.data.assign(glb.bin, glb.bin + length);
+    } else if (is_data_uri(buffer.uri)) {
+      std::string mime_type;
+      if (!tinygltf::DecodeDataURI(
+              &buffer.data, mime_type, buffer.uri, length, true)) {
+        throw std::runtime_error("failed to decode the data URI of " + name);
+      }
+      buffer.uri.clear();
+    } else {
+      MappedFile file(uri_to_path(base_dir, buffer.uri));
+      if (file.size() < length) {
+        throw std::runtime_error(name + " is shorter than its byteLength");
+      }
+      buffer.data.assign(file.data(), file.data() + length);
+    }
+  }
+}
+
+// Decode all compressed views into one new buffer and point the views at
+// their part of it, so the rest of the loader never sees the compression.
+void decode_compressed_views(tinygltf::Model &model,
+                             const std::vector<CompressedView> &views) {
+  if (views.empty()) {
+    return;
+  }
+  std::vector<size_t> offsets(views.size());
+  size_t size = 0;
+  for (size_t i = 0; i < views.size(); i++) {
+    auto &view = views[i];
+    auto &source = model.buffers.at(view.buffer).data;
+    if (view.byte_offset + view.byte_length > source.size()) {
+      throw std::runtime_error("compressed data of buffer view " +
+                               std::to_string(view.view) +
+                               " exceeds its buffer");
+    }
+    offsets[i] = size;
+    size += (view.count * view.byte_stride + 3) & ~size_t(3);
+  }
+
+  tinygltf::Buffer decoded;
+  decoded.data.resize(size);
+  ThreadPool::global().parallel_for(views.size(), [&](size_t i) {
+    auto &view = views[i];
+    auto &source = model.buffers[view.buffer].data;
+    try {
+      meshopt_decode(decoded.data.data() + offsets[i],
+                     view.count,
+                     view.byte_stride,
+                     source.data() + view.byte_offset,
+                     view.byte_length,
+                     view.mode,
+                     view.filter);
+    } catch (std::exception &e) {
+      throw std::runtime_error("buffer view " + std::to_string(view.view) +
+                               ": " + e.what());
+    }
+  });
+
+  auto buffer_index = (int)model.buffers.size();
+  model.buffers.push_back(std::move(decoded));
+  for (size_t i = 0; i < views.size(); i++) {
+    auto &view = model.bufferViews.at(views[i].view);
+    view.buffer = buffer_index;
+    view.byteOffset = offsets[i];
+    view.byteLength = views[i].count * views[i].byte_stride;
+  }
+}
+
+void load_embedded_images(tinygltf::Model &model) {
+  for (auto &image : model.images) {
+    if (image.bufferView >= 0) {
+      auto &view = model.bufferViews.at(image.bufferView);
+      auto &data = model.buffers.at(view.buffer).data;
+      if (view.byteOffset + view.byteLength > data.size()) {
+        throw std::runtime_error("image \"" + image.name +
+                                 "\" exceeds its buffer");
+      }
+      auto begin = data.begin() + view.byteOffset;
+      image.image.assign(begin, begin + view.byteLength);
+      image.as_is = true;
+    } else if (is_data_uri(image.uri)) {
+      std::string mime_type;
+      if (!tinygltf::DecodeDataURI(
+              &image.image, mime_type, image.uri, 0, false)) {
+        throw std::runtime_error("failed to decode the data URI of image \"" +
+                                 image.name + "\"");
+      }
+      image.uri.clear();
+      image.as_is = true;
+    }
+  }
+}
+} // namespace
+
+void parse_gltf(const fs::path &path, tinygltf::Model &model) {
+  MappedFile file(path);
+  GlbChunks glb;
+  if (file.size() >= 12 && std::memcmp(file.data(), "glTF", 4) == 0) {
+    glb = read_glb(file.data(), file.size());
+  } else {
+    glb.json = file.data();
+    glb.json_size = file.size();
+  }
+
+  GltfSax sax(model);
+  try {
+    auto json_begin = reinterpret_cast<const char *>(glb.json);
+    if (!json::sax_parse(json_begin, json_begin + glb.json_size, &sax)) {
+      throw std::runtime_error(sax.error);
+    }
+    load_buffers(model, sax, glb, path.parent_path());
+    decode_compressed_views(model, sax.compressed_views);
+    load_embedded_images(model);
+  } catch (std::exception &e) {
+    throw std::runtime_error("failed to load " + path.string() + ": " +
+                             e.what());
+  }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "data.hpp"
+#include <string>
+
+namespace tinygltf {
+class Model;
+}
+
+// Read a .gltf or .glb file into model in one SAX pass over the JSON, no
+// document tree is built. Elements of the top level arrays are collected one
+// at a time and converted as soon as they end, so memory is bounded by the
+// largest element instead of the whole document. Only what Gltf reads is
+// kept, animations, skins, cameras, extras and extensions are skipped.
+// Buffers are loaded and EXT_meshopt_compression buffer views decoded into
+// an extra buffer. Images are not decoded: embedded ones are left in
+// image.image with as_is set, external ones only keep their uri.
+void parse_gltf(const fs::path &path, tinygltf::Model &model);
+
+// external files are referenced by URIs, which may be percent encoded
+fs::path uri_to_path(const fs::path &base_dir, const std::string &uri);
+bool is_data_uri(const std::string &uri);
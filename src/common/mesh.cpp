@@ -1,4 +1,8 @@
 #include "mesh.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <glm/gtc/packing.hpp>
 
 Buffer::Buffer(void *data, size_t size) {
   glGenBuffers(1, &_id);
@@ -29,29 +33,146 @@ GLuint VertexArray::get() const {
 
 Mesh::Mesh(const Vertex *vertices,
            uint32_t vertex_count,
-           const uint32_t *indices,
-           uint32_t index_count) {
+           const void *indices,
+           uint32_t index_count,
+           GLenum index_type,
+           GeometryPool *pool) {
+  init_buffers(vertices,
+               sizeof(Vertex),
+               vertex_count,
+               indices,
+               index_count,
+               index_type,
+               vertex_attributes,
+               pool);
+  if (vertices == nullptr || vertex_count == 0) {
+    return;
+  }
+
+  glm::vec3 min = vertices[0].position, max = vertices[0].position;
+  for (uint32_t i = 1; i < vertex_count; i++) {
+    min = glm::min(min, vertices[i].position);
+    max = glm::max(max, vertices[i].position);
+  }
+  _bounds = Aabb{min, max};
+  _bounds_center = (min + max) * 0.5f;
+  _bounds_radius = glm::length(max - min) * 0.5f;
+}
+
+Mesh::Mesh(const PackedVertex *vertices,
+           uint32_t vertex_count,
+           const void *indices,
+           uint32_t index_count,
+           GLenum index_type,
+           const glm::vec3 &position_offset,
+           const glm::vec3 &position_scale,
+           GeometryPool *pool)
+    : _packed(true),
+      _bounds{position_offset, position_offset + position_scale},
+      _bounds_center(position_offset + position_scale * 0.5f),
+      _bounds_radius(glm::length(position_scale) * 0.5f),
+      _position_offset(position_offset),
+      _position_scale(position_scale) {
+  init_buffers(vertices,
+               sizeof(PackedVertex),
+               vertex_count,
+               indices,
+               index_count,
+               index_type,
+               packed_vertex_attributes,
+               pool);
+}
+
+Mesh::Mesh(const std::vector<VertexAttribute> &attributes,
+           uint32_t vertex_count,
+           std::shared_ptr<Buffer> index_buffer,
+           size_t index_offset,
+           uint32_t index_count,
+           GLenum index_type)
+    : _draw_count(vertex_count),
+      _index_type(index_type),
+      _index_offset(index_offset),
+      _index_buffer(std::move(index_buffer)) {
   _vao = std::make_unique<VertexArray>();
+  _vertex_array = _vao->get();
+  glBindVertexArray(_vertex_array);
+  for (auto &attr : attributes) {
+    glBindBuffer(GL_ARRAY_BUFFER, attr.buffer->get());
+    glVertexAttribPointer(attr.location,
+                          attr.size,
+                          attr.type,
+                          attr.normalized,
+                          attr.stride,
+                          (void *)attr.offset);
+    glEnableVertexAttribArray(attr.location);
+    if (std::find(_attribute_buffers.begin(),
+                  _attribute_buffers.end(),
+                  attr.buffer) == _attribute_buffers.end()) {
+      _attribute_buffers.push_back(attr.buffer);
+    }
+  }
+  if (_index_buffer != nullptr) {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _index_buffer->get());
+    _draw_count = index_count;
+    _indexed = true;
+  }
+}
+
+Mesh::~Mesh() {
+  if (_pool != nullptr) {
+    _pool->release(_allocation);
+  }
+}
+
+void Mesh::init_buffers(const void *vertices,
+                        size_t vertex_size,
+                        uint32_t vertex_count,
+                        const void *indices,
+                        uint32_t index_count,
+                        GLenum index_type,
+                        GeometryPool::FormatSetup format,
+                        GeometryPool *pool) {
   if (vertices == nullptr) {
+    _vao = std::make_unique<VertexArray>();
+    _vertex_array = _vao->get();
     return;
   }
-  _vertex_buffer =
-      std::make_unique<Buffer>((void *)vertices, sizeof(Vertex) * vertex_count);
   _draw_count = vertex_count;
   if (indices != nullptr) {
-    _index_buffer = std::make_unique<Buffer>((void *)indices,
-                                             sizeof(uint32_t) * index_count);
     _draw_count = index_count;
-  } else {
-    _index_buffer = nullptr;
+    _index_type = index_type;
+    _indexed = true;
+  }
+  auto index_bytes = indices != nullptr ? index_size(index_type) * index_count
+                                        : 0;
+
+  if (pool != nullptr) {
+    _pool = pool;
+    _allocation = pool->allocate(
+        format, vertices, vertex_size, vertex_count, indices, index_bytes);
+    _vertex_array = _allocation.vertex_array;
+    _base_vertex = _allocation.base_vertex;
+    _index_offset = _allocation.index_offset;
+    return;
   }
 
-  glBindVertexArray(_vao->get());
+  _vao = std::make_unique<VertexArray>();
+  _vertex_array = _vao->get();
+  _vertex_buffer =
+      std::make_shared<Buffer>((void *)vertices, vertex_size * vertex_count);
+  if (indices != nullptr) {
+    _index_buffer = std::make_shared<Buffer>((void *)indices, index_bytes);
+  }
+
+  glBindVertexArray(_vertex_array);
   glBindBuffer(GL_ARRAY_BUFFER, _vertex_buffer->get());
+  format();
   if (indices != nullptr) {
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _index_buffer->get());
   }
+}
 
+void Mesh::vertex_attributes() {
 #define ENABLE_LOCATION(location, count, field)                                \
   glVertexAttribPointer(location,                                              \
                         count,                                                 \
@@ -71,15 +192,289 @@ Mesh::Mesh(const Vertex *vertices,
 #undef ENABLE_LOCATION
 }
 
+void Mesh::packed_vertex_attributes() {
+#define ENABLE_LOCATION(location, count, type, field)                          \
+  glVertexAttribPointer(location,                                              \
+                        count,                                                 \
+                        type,                                                  \
+                        type != GL_HALF_FLOAT,                                 \
+                        sizeof(PackedVertex),                                  \
+                        (void *)offsetof(PackedVertex, field));                \
+  glEnableVertexAttribArray(location)
+
+  ENABLE_LOCATION(0, 4, GL_UNSIGNED_SHORT, position);
+  ENABLE_LOCATION(1, 2, GL_SHORT, normal);
+  ENABLE_LOCATION(2, 2, GL_SHORT, tangent);
+  ENABLE_LOCATION(3, 2, GL_HALF_FLOAT, uv0);
+  ENABLE_LOCATION(4, 2, GL_HALF_FLOAT, uv1);
+  ENABLE_LOCATION(5, 4, GL_UNSIGNED_BYTE, color);
+
+#undef ENABLE_LOCATION
+}
+
+namespace {
+// map the unit sphere onto the [-1, 1] square, the lower hemisphere is
+// folded over the diagonals
+glm::vec2 octahedral_encode(const glm::vec3 &n) {
+  auto sum = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+  if (sum == 0.0f) {
+    return glm::vec2(0.0f);
+  }
+  glm::vec2 e(n.x / sum, n.y / sum);
+  if (n.z < 0.0f) {
+    e = (1.0f - glm::abs(glm::vec2(e.y, e.x))) *
+        glm::vec2(e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f);
+  }
+  return e;
+}
+
+int16_t quantize_snorm16(float v) {
+  return (int16_t)std::lround(glm::clamp(v, -1.0f, 1.0f) * 32767.0f);
+}
+
+uint16_t quantize_unorm16(float v) {
+  return (uint16_t)std::lround(glm::clamp(v, 0.0f, 1.0f) * 65535.0f);
+}
+} // namespace
+
+std::vector<Mesh::PackedVertex> Mesh::pack_vertices(const Vertex *vertices,
+                                                    uint32_t vertex_count,
+                                                    glm::vec3 &position_offset,
+                                                    glm::vec3 &position_scale) {
+  glm::vec3 min(0.0f), max(0.0f);
+  if (vertex_count > 0) {
+    min = max = vertices[0].position;
+  }
+  for (uint32_t i = 1; i < vertex_count; i++) {
+    min = glm::min(min, vertices[i].position);
+    max = glm::max(max, vertices[i].position);
+  }
+  position_offset = min;
+  position_scale = max - min;
+
+  std::vector<PackedVertex> packed(vertex_count);
+  for (uint32_t i = 0; i < vertex_count; i++) {
+    auto &v = vertices[i];
+    auto &p = packed[i];
+    for (int c = 0; c < 3; c++) {
+      auto extent = position_scale[c];
+      p.position[c] = quantize_unorm16(
+          extent > 0.0f ? (v.position[c] - min[c]) / extent : 0.0f);
+    }
+    // tangents without handedness are absent
+    p.position[3] = quantize_unorm16(glm::sign(v.tangent.w) * 0.5f + 0.5f);
+
+    auto normal = octahedral_encode(v.normal);
+    auto tangent = octahedral_encode(glm::vec3(v.tangent));
+    for (int c = 0; c < 2; c++) {
+      p.normal[c] = quantize_snorm16(normal[c]);
+      p.tangent[c] = quantize_snorm16(tangent[c]);
+      p.uv0[c] = glm::packHalf1x16(v.uv0[c]);
+      p.uv1[c] = glm::packHalf1x16(v.uv1[c]);
+    }
+    for (int c = 0; c < 4; c++) {
+      p.color[c] = (uint8_t)std::lround(glm::clamp(v.color[c], 0.0f, 1.0f) *
+                                        255.0f);
+    }
+  }
+  return packed;
+}
+
+GLenum Mesh::index_type_for(uint32_t vertex_count) {
+  return vertex_count <= 0x10000 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+size_t Mesh::index_size(GLenum index_type) {
+  switch (index_type) {
+  case GL_UNSIGNED_BYTE:
+    return sizeof(uint8_t);
+  case GL_UNSIGNED_SHORT:
+    return sizeof(uint16_t);
+  case GL_UNSIGNED_INT:
+    return sizeof(uint32_t);
+  default:
+    throw std::runtime_error("unsupported index type");
+  }
+}
+
 void Mesh::draw() {
+  draw_lod(0);
+}
+
+void Mesh::draw_lod(size_t lod) {
   if (_draw_count == 0) {
     return;
   }
-  glBindVertexArray(_vao->get());
-  if (_index_buffer != nullptr) {
-    glDrawElements(
-        GL_TRIANGLES, (GLsizei)_draw_count, GL_UNSIGNED_INT, nullptr);
+  glBindVertexArray(_vertex_array);
+  if (_indexed) {
+    auto range = lod_range(lod);
+    glDrawElementsBaseVertex(
+        GL_TRIANGLES,
+        (GLsizei)range.index_count,
+        _index_type,
+        (const void *)(_index_offset +
+                       range.index_offset * index_size(_index_type)),
+        _base_vertex);
   } else {
-    glDrawArrays(GL_TRIANGLES, 0, (GLsizei)_draw_count);
+    glDrawArrays(GL_TRIANGLES, _base_vertex, (GLsizei)_draw_count);
   }
 }
+
+float MeshletCullStats::culled_percentage() const {
+  return triangle_count == 0 ? 0.0f
+                             : 100.0f * culled_triangles / triangle_count;
+}
+
+void Mesh::draw_culled(const glm::mat4 &model_view,
+                       const glm::mat4 &projection,
+                       bool cull_backfaces,
+                       MeshletCullStats *stats) {
+  if (_meshlets.empty() || !_indexed) {
+    if (stats != nullptr) {
+      stats->triangle_count += lod_range(0).index_count / 3;
+    }
+    draw();
+    return;
+  }
+
+  // frustum planes in model space, from the rows of the clip transform
+  auto clip = glm::transpose(projection * model_view);
+  glm::vec4 planes[6] = {clip[3] + clip[0],
+                         clip[3] - clip[0],
+                         clip[3] + clip[1],
+                         clip[3] - clip[1],
+                         clip[3] + clip[2],
+                         clip[3] - clip[2]};
+  for (auto &plane : planes) {
+    plane /= glm::length(glm::vec3(plane));
+  }
+  auto camera = glm::vec3(glm::inverse(model_view)[3]);
+
+  _range_counts.clear();
+  _range_offsets.clear();
+  auto index_bytes = index_size(_index_type);
+  uint32_t range_end = ~0u;
+  size_t culled_meshlets = 0;
+  size_t culled_triangles = 0;
+  for (auto &meshlet : _meshlets) {
+    bool visible = true;
+    for (auto &plane : planes) {
+      if (glm::dot(glm::vec3(plane), meshlet.center) + plane.w <
+          -meshlet.radius) {
+        visible = false;
+        break;
+      }
+    }
+    if (visible && cull_backfaces && meshlet.cone_cutoff < 1.0f) {
+      auto view_dir = glm::normalize(meshlet.cone_apex - camera);
+      visible = glm::dot(view_dir, meshlet.cone_axis) < meshlet.cone_cutoff;
+    }
+    if (!visible) {
+      culled_meshlets++;
+      culled_triangles += meshlet.triangle_count;
+      continue;
+    }
+
+    // neighbouring survivors share one range
+    auto count = meshlet.triangle_count * 3;
+    if (meshlet.index_offset == range_end) {
+      _range_counts.back() += count;
+    } else {
+      _range_counts.push_back(count);
+      _range_offsets.push_back(
+          (const void *)(_index_offset + meshlet.index_offset * index_bytes));
+    }
+    range_end = meshlet.index_offset + count;
+  }
+
+  if (stats != nullptr) {
+    stats->meshlet_count += _meshlets.size();
+    stats->culled_meshlets += culled_meshlets;
+    stats->triangle_count += lod_range(0).index_count / 3;
+    stats->culled_triangles += culled_triangles;
+  }
+  if (_range_counts.empty()) {
+    return;
+  }
+  _range_base_vertices.assign(_range_counts.size(), _base_vertex);
+  glBindVertexArray(_vertex_array);
+  glMultiDrawElementsBaseVertex(GL_TRIANGLES,
+                                _range_counts.data(),
+                                _index_type,
+                                _range_offsets.data(),
+                                (GLsizei)_range_counts.size(),
+                                _range_base_vertices.data());
+}
+
+void Mesh::set_meshlets(std::vector<Meshlet> meshlets) {
+  _meshlets = std::move(meshlets);
+}
+
+const std::vector<Meshlet> &Mesh::meshlets() const {
+  return _meshlets;
+}
+
+void Mesh::set_lods(std::vector<MeshLod> lods) {
+  _lods = std::move(lods);
+}
+
+const std::vector<MeshLod> &Mesh::lods() const {
+  return _lods;
+}
+
+size_t Mesh::select_lod(const glm::mat4 &model_view,
+                        float pixel_size,
+                        float max_pixel_error) const {
+  if (_lods.size() < 2) {
+    return 0;
+  }
+  auto scale = std::max({glm::length(glm::vec3(model_view[0])),
+                         glm::length(glm::vec3(model_view[1])),
+                         glm::length(glm::vec3(model_view[2]))});
+  auto center = glm::vec3(model_view * glm::vec4(_bounds_center, 1.0f));
+  // the closest point of the bounds decides
+  auto distance =
+      std::max(glm::length(center) - _bounds_radius * scale, 1e-4f);
+  auto pixels_per_unit = scale / (distance * pixel_size);
+  for (size_t lod = _lods.size() - 1; lod > 0; lod--) {
+    if (_lods[lod].error * pixels_per_unit <= max_pixel_error) {
+      return lod;
+    }
+  }
+  return 0;
+}
+
+MeshLod Mesh::lod_range(size_t lod) const {
+  if (_lods.empty()) {
+    return MeshLod{0, _draw_count, 0.0f};
+  }
+  return _lods[std::min(lod, _lods.size() - 1)];
+}
+
+const Aabb &Mesh::bounds() const {
+  return _bounds;
+}
+
+void Mesh::set_bounds(const Aabb &bounds) {
+  _bounds = bounds;
+}
+
+bool Mesh::packed() const {
+  return _packed;
+}
+
+GLuint Mesh::vertex_array() const {
+  return _vertex_array;
+}
+
+GLenum Mesh::index_type() const {
+  return _index_type;
+}
+
+const glm::vec3 &Mesh::position_offset() const {
+  return _position_offset;
+}
+
+const glm::vec3 &Mesh::position_scale() const {
+  return _position_scale;
+}
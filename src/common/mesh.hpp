@@ -1,5 +1,7 @@
 #pragma once
 
+#include "frustum_culling.hpp"
+#include "geometry_pool.hpp"
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 #include <memory>
@@ -27,6 +29,49 @@ private:
   GLuint _id{};
 };
 
+// one vertex attribute as it is laid out in a buffer, see
+// glVertexAttribPointer
+struct VertexAttribute {
+  GLuint location;
+  GLint size;
+  GLenum type;
+  bool normalized;
+  GLsizei stride;
+  size_t offset;
+  std::shared_ptr<Buffer> buffer;
+};
+
+// A cluster of at most 64 vertices and 124 triangles, stored as a range of
+// the index buffer of its Mesh. Bounds are in model space.
+struct Meshlet {
+  uint32_t index_offset;
+  uint32_t triangle_count;
+  glm::vec3 center;
+  float radius;
+  // all triangles face away from cameras inside the cone, cone_cutoff is
+  // 1 when their normals spread too far to cull by
+  glm::vec3 cone_apex;
+  glm::vec3 cone_axis;
+  float cone_cutoff;
+};
+
+// A detail level stored as a range of the index buffer of its Mesh, error
+// is how far it deviates from the full detail surface in model units.
+struct MeshLod {
+  uint32_t index_offset;
+  uint32_t index_count;
+  float error;
+};
+
+struct MeshletCullStats {
+  size_t meshlet_count = 0;
+  size_t culled_meshlets = 0;
+  size_t triangle_count = 0;
+  size_t culled_triangles = 0;
+
+  float culled_percentage() const;
+};
+
 class Mesh {
 public:
   struct Vertex {
@@ -38,17 +83,134 @@ public:
     glm::vec4 color;    // location 5
   };
 
+  // Compact form of Vertex, 28 instead of 88 bytes. Positions are stored
+  // relative to the bounds of the mesh and need position_offset() and
+  // position_scale() to be restored.
+  struct PackedVertex {
+    uint16_t position[4]; // unorm, w is the tangent sign, 0.5 for none
+    int16_t normal[2];    // octahedral snorm
+    int16_t tangent[2];   // octahedral snorm
+    uint16_t uv0[2];      // half float
+    uint16_t uv1[2];      // half float
+    uint8_t color[4];     // unorm
+  };
+
+  // index_type is GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT.
+  // With a pool the vertices and indices are sub-allocated from it instead
+  // of getting buffers of their own, the pool must outlive the mesh.
   Mesh(const Vertex *vertices,
        uint32_t vertex_count,
-       const uint32_t *indices,
-       uint32_t index_count);
+       const void *indices,
+       uint32_t index_count,
+       GLenum index_type = GL_UNSIGNED_INT,
+       GeometryPool *pool = nullptr);
+
+  Mesh(const PackedVertex *vertices,
+       uint32_t vertex_count,
+       const void *indices,
+       uint32_t index_count,
+       GLenum index_type,
+       const glm::vec3 &position_offset,
+       const glm::vec3 &position_scale,
+       GeometryPool *pool = nullptr);
 
+  // Draw vertex and index data where it already is, several meshes can
+  // share the buffers. index_buffer may be null to draw without indices,
+  // index_offset is in bytes.
+  Mesh(const std::vector<VertexAttribute> &attributes,
+       uint32_t vertex_count,
+       std::shared_ptr<Buffer> index_buffer,
+       size_t index_offset,
+       uint32_t index_count,
+       GLenum index_type);
+
+  ~Mesh();
+
+  // quantize vertices against their bounds, see PackedVertex
+  static std::vector<PackedVertex> pack_vertices(const Vertex *vertices,
+                                                 uint32_t vertex_count,
+                                                 glm::vec3 &position_offset,
+                                                 glm::vec3 &position_scale);
+
+  // the narrowest index type that can address vertex_count vertices
+  static GLenum index_type_for(uint32_t vertex_count);
+  static size_t index_size(GLenum index_type);
+
+  // draw the full detail level
   void draw();
+  void draw_lod(size_t lod);
+  // Draw the meshlets in the view frustum, and with cull_backfaces only
+  // those with triangles facing the camera. Meshes without meshlets are
+  // drawn whole.
+  void draw_culled(const glm::mat4 &model_view,
+                   const glm::mat4 &projection,
+                   bool cull_backfaces,
+                   MeshletCullStats *stats = nullptr);
+
+  void set_meshlets(std::vector<Meshlet> meshlets);
+  const std::vector<Meshlet> &meshlets() const;
+
+  // level 0 is the full detail, meshlets only cover that one
+  void set_lods(std::vector<MeshLod> lods);
+  const std::vector<MeshLod> &lods() const;
+  // The coarsest level whose error covers at most max_pixel_error pixels,
+  // pixel_size is the height of a pixel at distance 1 from the camera.
+  size_t select_lod(const glm::mat4 &model_view,
+                    float pixel_size,
+                    float max_pixel_error) const;
+
+  // Bounds in model space. Meshes drawing data in place are unbounded
+  // unless they are given bounds.
+  const Aabb &bounds() const;
+  void set_bounds(const Aabb &bounds);
+
+  bool packed() const;
+  // pooled meshes of the same format and chunk share their vertex array
+  GLuint vertex_array() const;
+  GLenum index_type() const;
+  const glm::vec3 &position_offset() const;
+  const glm::vec3 &position_scale() const;
 
 private:
+  void init_buffers(const void *vertices,
+                    size_t vertex_size,
+                    uint32_t vertex_count,
+                    const void *indices,
+                    uint32_t index_count,
+                    GLenum index_type,
+                    GeometryPool::FormatSetup format,
+                    GeometryPool *pool);
+  static void vertex_attributes();
+  static void packed_vertex_attributes();
+
+  MeshLod lod_range(size_t lod) const;
+
   uint32_t _draw_count = 0;
+  bool _indexed = false;
+  GLenum _index_type = GL_UNSIGNED_INT;
+  size_t _index_offset = 0;
+  GLint _base_vertex = 0;
+  bool _packed = false;
+  Aabb _bounds = Aabb::unbounded();
+  // bounding sphere in model space
+  glm::vec3 _bounds_center{0.0f};
+  float _bounds_radius = 0.0f;
+  glm::vec3 _position_offset{0.0f};
+  glm::vec3 _position_scale{1.0f};
+
+  std::vector<Meshlet> _meshlets;
+  std::vector<MeshLod> _lods;
+  // ranges that survived culling, kept to avoid allocating every frame
+  std::vector<GLsizei> _range_counts;
+  std::vector<const void *> _range_offsets;
+  std::vector<GLint> _range_base_vertices;
 
+  GLuint _vertex_array = 0;
   std::unique_ptr<VertexArray> _vao{};
-  std::unique_ptr<Buffer> _vertex_buffer{};
-  std::unique_ptr<Buffer> _index_buffer{};
+  std::shared_ptr<Buffer> _vertex_buffer{};
+  std::shared_ptr<Buffer> _index_buffer{};
+  // buffers of attributes that do not live in _vertex_buffer
+  std::vector<std::shared_ptr<Buffer>> _attribute_buffers;
+  GeometryPool *_pool = nullptr;
+  GeometryPool::Allocation _allocation{};
 };
\ No newline at end of file
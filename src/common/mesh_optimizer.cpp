@@ -0,0 +1,947 @@
+#include "mesh_optimizer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <glm/glm.hpp>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+#include <unordered_set>
+
+float VertexCacheStats::acmr() const {
+  return triangle_count == 0 ? 0.0f
+                             : (float)vertices_transformed / triangle_count;
+}
+
+float VertexCacheStats::atvr() const {
+  return vertex_count == 0 ? 0.0f : (float)vertices_transformed / vertex_count;
+}
+
+VertexCacheStats &VertexCacheStats::operator+=(const VertexCacheStats &other) {
+  vertices_transformed += other.vertices_transformed;
+  triangle_count += other.triangle_count;
+  vertex_count += other.vertex_count;
+  return *this;
+}
+
+VertexCacheStats analyze_vertex_cache(const uint32_t *indices,
+                                      size_t index_count,
+                                      size_t vertex_count,
+                                      int cache_size) {
+  VertexCacheStats stats;
+  stats.triangle_count = index_count / 3;
+
+  // a vertex is in the cache while it was pushed less than cache_size
+  // misses ago
+  std::vector<size_t> pushed_at(vertex_count, 0);
+  std::vector<uint8_t> referenced(vertex_count, 0);
+  size_t misses = 0;
+  for (size_t i = 0; i < index_count; i++) {
+    auto v = indices[i];
+    if (!referenced[v] || misses - pushed_at[v] >= (size_t)cache_size) {
+      pushed_at[v] = misses++;
+    }
+    referenced[v] = 1;
+  }
+  stats.vertices_transformed = misses;
+  stats.vertex_count = std::count(referenced.begin(), referenced.end(), 1);
+  return stats;
+}
+
+namespace {
+const int MAX_CACHE_SIZE = 32;
+
+float vertex_score(int cache_position, uint32_t live_triangles) {
+  if (live_triangles == 0) {
+    // no triangle left to emit, the vertex should not attract anything
+    return -1.0f;
+  }
+  float score = 0.0f;
+  if (cache_position >= 0) {
+    if (cache_position < 3) {
+      // the last triangle's vertices, scored lower so the strip does not
+      // just turn around on itself
+      score = 0.75f;
+    } else {
+      auto scale = 1.0f / (MAX_CACHE_SIZE - 3);
+      score = std::pow(1.0f - (cache_position - 3) * scale, 1.5f);
+    }
+  }
+  // prefer vertices with few triangles left so they leave the mesh early
+  return score + 2.0f / std::sqrt((float)live_triangles);
+}
+} // namespace
+
+void optimize_vertex_cache(uint32_t *indices,
+                           size_t index_count,
+                           size_t vertex_count) {
+  auto triangle_count = index_count / 3;
+  if (triangle_count == 0) {
+    return;
+  }
+
+  // triangles adjacent to every vertex, emitted ones are swapped to the back
+  std::vector<uint32_t> live(vertex_count, 0);
+  for (size_t i = 0; i < triangle_count * 3; i++) {
+    live[indices[i]]++;
+  }
+  std::vector<uint32_t> offsets(vertex_count + 1, 0);
+  for (size_t v = 0; v < vertex_count; v++) {
+    offsets[v + 1] = offsets[v] + live[v];
+  }
+  std::vector<uint32_t> adjacency(triangle_count * 3);
+  {
+    auto fill = offsets;
+    for (size_t t = 0; t < triangle_count; t++) {
+      for (int k = 0; k < 3; k++) {
+        adjacency[fill[indices[t * 3 + k]]++] = (uint32_t)t;
+      }
+    }
+  }
+
+  std::vector<int> cache_position(vertex_count, -1);
+  std::vector<float> scores(vertex_count);
+  for (size_t v = 0; v < vertex_count; v++) {
+    scores[v] = vertex_score(-1, live[v]);
+  }
+  std::vector<float> triangle_scores(triangle_count);
+  for (size_t t = 0; t < triangle_count; t++) {
+    auto tri = &indices[t * 3];
+    triangle_scores[t] = scores[tri[0]] + scores[tri[1]] + scores[tri[2]];
+  }
+
+  std::vector<uint32_t> result(triangle_count * 3);
+  std::vector<uint8_t> emitted(triangle_count, 0);
+  uint32_t cache[MAX_CACHE_SIZE + 3];
+  uint32_t new_cache[MAX_CACHE_SIZE + 3];
+  int cache_count = 0;
+  size_t next_unemitted = 0;
+
+  auto best = (size_t)(
+      std::max_element(triangle_scores.begin(), triangle_scores.end()) -
+      triangle_scores.begin());
+  for (size_t out = 0; out < triangle_count; out++) {
+    if (best == ~size_t(0)) {
+      // nothing adjacent to the cache is left, continue in input order
+      while (emitted[next_unemitted]) {
+        next_unemitted++;
+      }
+      best = next_unemitted;
+    }
+
+    auto tri = &indices[best * 3];
+    std::memcpy(&result[out * 3], tri, 3 * sizeof(uint32_t));
+    emitted[best] = 1;
+
+    int new_count = 0;
+    for (int k = 0; k < 3; k++) {
+      auto v = tri[k];
+      auto begin = adjacency.begin() + offsets[v];
+      auto end = begin + live[v];
+      std::iter_swap(std::find(begin, end, (uint32_t)best), end - 1);
+      live[v]--;
+      new_cache[new_count++] = v;
+    }
+    for (int i = 0; i < cache_count; i++) {
+      auto v = cache[i];
+      if (v != tri[0] && v != tri[1] && v != tri[2]) {
+        new_cache[new_count++] = v;
+      }
+    }
+
+    // rescore everything that was or is in the cache and pick the best
+    // triangle among their neighbours
+    for (int i = MAX_CACHE_SIZE; i < new_count; i++) {
+      cache_position[new_cache[i]] = -1;
+      scores[new_cache[i]] = vertex_score(-1, live[new_cache[i]]);
+    }
+    cache_count = std::min(new_count, MAX_CACHE_SIZE);
+    for (int i = 0; i < cache_count; i++) {
+      auto v = new_cache[i];
+      cache[i] = v;
+      cache_position[v] = i;
+      scores[v] = vertex_score(i, live[v]);
+    }
+
+    best = ~size_t(0);
+    float best_score = -1.0f;
+    for (int i = 0; i < new_count; i++) {
+      auto v = new_cache[i];
+      for (uint32_t j = 0; j < live[v]; j++) {
+        auto t = adjacency[offsets[v] + j];
+        auto adjacent = &indices[t * 3];
+        auto score =
+            scores[adjacent[0]] + scores[adjacent[1]] + scores[adjacent[2]];
+        triangle_scores[t] = score;
+        if (score > best_score) {
+          best_score = score;
+          best = t;
+        }
+      }
+    }
+  }
+
+  std::memcpy(indices, result.data(), result.size() * sizeof(uint32_t));
+}
+
+void optimize_overdraw(uint32_t *indices,
+                       size_t index_count,
+                       const float *positions,
+                       size_t vertex_count,
+                       size_t position_stride,
+                       float threshold) {
+  auto triangle_count = index_count / 3;
+  if (triangle_count == 0) {
+    return;
+  }
+  auto position = [&](uint32_t v) {
+    auto p = (const float *)((const uint8_t *)positions + v * position_stride);
+    return glm::vec3(p[0], p[1], p[2]);
+  };
+
+  // split where a triangle misses the cache with all its vertices, the
+  // cache is effectively cold there so reordering costs little
+  const int cache_size = 16;
+  std::vector<uint32_t> cluster_starts;
+  {
+    std::vector<size_t> pushed_at(vertex_count, 0);
+    std::vector<uint8_t> referenced(vertex_count, 0);
+    size_t misses = 0;
+    for (size_t t = 0; t < triangle_count; t++) {
+      int triangle_misses = 0;
+      for (int k = 0; k < 3; k++) {
+        auto v = indices[t * 3 + k];
+        if (!referenced[v] || misses - pushed_at[v] >= (size_t)cache_size) {
+          pushed_at[v] = misses++;
+          triangle_misses++;
+        }
+        referenced[v] = 1;
+      }
+      if (t == 0 || triangle_misses == 3) {
+        cluster_starts.push_back((uint32_t)t);
+      }
+    }
+  }
+  auto cluster_count = cluster_starts.size();
+  if (cluster_count < 2) {
+    return;
+  }
+  cluster_starts.push_back((uint32_t)triangle_count);
+
+  // area weighted centroid and normal of every cluster
+  std::vector<glm::vec3> centroids(cluster_count);
+  std::vector<glm::vec3> normals(cluster_count);
+  glm::vec3 mesh_centroid{0.0f};
+  float mesh_area = 0.0f;
+  for (size_t c = 0; c < cluster_count; c++) {
+    glm::vec3 centroid{0.0f};
+    glm::vec3 normal{0.0f};
+    float area = 0.0f;
+    for (auto t = cluster_starts[c]; t < cluster_starts[c + 1]; t++) {
+      auto p0 = position(indices[t * 3 + 0]);
+      auto p1 = position(indices[t * 3 + 1]);
+      auto p2 = position(indices[t * 3 + 2]);
+      auto n = glm::cross(p1 - p0, p2 - p0);
+      auto a = glm::length(n);
+      centroid += (p0 + p1 + p2) * (a / 3.0f);
+      normal += n;
+      area += a;
+    }
+    mesh_centroid += centroid;
+    mesh_area += area;
+    centroids[c] = area > 0.0f ? centroid / area : centroid;
+    auto length = glm::length(normal);
+    normals[c] = length > 0.0f ? normal / length : normal;
+  }
+  if (mesh_area > 0.0f) {
+    mesh_centroid /= mesh_area;
+  }
+
+  std::vector<float> sort_keys(cluster_count);
+  for (size_t c = 0; c < cluster_count; c++) {
+    sort_keys[c] = glm::dot(centroids[c] - mesh_centroid, normals[c]);
+  }
+  std::vector<uint32_t> order(cluster_count);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return sort_keys[a] > sort_keys[b];
+  });
+
+  std::vector<uint32_t> result;
+  result.reserve(triangle_count * 3);
+  for (auto c : order) {
+    result.insert(result.end(),
+                  indices + cluster_starts[c] * 3,
+                  indices + cluster_starts[c + 1] * 3);
+  }
+
+  auto before =
+      analyze_vertex_cache(indices, triangle_count * 3, vertex_count).acmr();
+  auto after =
+      analyze_vertex_cache(result.data(), result.size(), vertex_count).acmr();
+  if (after <= before * threshold) {
+    std::memcpy(indices, result.data(), result.size() * sizeof(uint32_t));
+  }
+}
+
+std::vector<uint32_t> optimize_vertex_fetch_remap(uint32_t *indices,
+                                                  size_t index_count,
+                                                  size_t vertex_count,
+                                                  size_t &unique_count) {
+  std::vector<uint32_t> remap(vertex_count, ~0u);
+  uint32_t next = 0;
+  for (size_t i = 0; i < index_count; i++) {
+    auto &v = remap[indices[i]];
+    if (v == ~0u) {
+      v = next++;
+    }
+    indices[i] = v;
+  }
+  unique_count = next;
+  return remap;
+}
+
+std::vector<size_t> split_by_vertex_count(const uint32_t *indices,
+                                          size_t index_count,
+                                          size_t vertex_count,
+                                          size_t max_vertices) {
+  std::vector<size_t> starts{0};
+  // range a vertex was last seen in, offset by one so 0 means never
+  std::vector<size_t> seen_in(vertex_count, 0);
+  size_t range_vertices = 0;
+  for (size_t t = 0; t + 2 < index_count; t += 3) {
+    int added = 0;
+    for (int k = 0; k < 3; k++) {
+      added += seen_in[indices[t + k]] != starts.size();
+    }
+    if (range_vertices + added > max_vertices) {
+      starts.push_back(t);
+      range_vertices = 0;
+    }
+    for (int k = 0; k < 3; k++) {
+      auto &seen = seen_in[indices[t + k]];
+      if (seen != starts.size()) {
+        seen = starts.size();
+        range_vertices++;
+      }
+    }
+  }
+  return starts;
+}
+
+namespace {
+template <int N>
+bool nearly_equal(const glm::vec<N, float> &a,
+                  const glm::vec<N, float> &b,
+                  float epsilon) {
+  // written so NaNs never compare equal
+  for (int c = 0; c < N; c++) {
+    if (!(std::abs(a[c] - b[c]) <= epsilon)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool can_weld(const Mesh::Vertex &a,
+              const Mesh::Vertex &b,
+              const WeldSettings &settings) {
+  return nearly_equal(a.position, b.position, settings.position_epsilon) &&
+         nearly_equal(a.normal, b.normal, settings.normal_epsilon) &&
+         nearly_equal(a.tangent, b.tangent, settings.tangent_epsilon) &&
+         nearly_equal(a.uv0, b.uv0, settings.uv_epsilon) &&
+         nearly_equal(a.uv1, b.uv1, settings.uv_epsilon) &&
+         nearly_equal(a.color, b.color, settings.color_epsilon);
+}
+
+uint64_t hash_cell(const glm::ivec3 &cell) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (int c = 0; c < 3; c++) {
+    h = (h ^ (uint32_t)cell[c]) * 0x100000001b3ull;
+  }
+  return h;
+}
+} // namespace
+
+std::vector<uint32_t> weld_vertices_remap(const Mesh::Vertex *vertices,
+                                          size_t vertex_count,
+                                          WeldSettings *settings,
+                                          size_t &unique_count) {
+  WeldSettings default_settings{};
+  if (settings == nullptr) {
+    settings = &default_settings;
+  }
+
+  // Cells are twice the position epsilon wide, so everything close enough
+  // to a vertex lies in one of the 8 cells around it. Without an epsilon
+  // the cell is the exact position.
+  auto epsilon = settings->position_epsilon;
+  auto cell_size = 2.0f * epsilon;
+  auto cell_of = [&](const glm::vec3 &p) {
+    if (epsilon <= 0.0f) {
+      glm::ivec3 bits;
+      // +0.0f folds -0 into 0
+      auto q = p + 0.0f;
+      std::memcpy(&bits, &q, sizeof(bits));
+      return bits;
+    }
+    return glm::ivec3(glm::floor(p / cell_size));
+  };
+
+  // representatives are chained per cell hash, collisions only cost
+  // extra comparisons
+  std::unordered_map<uint64_t, uint32_t> heads;
+  heads.reserve(vertex_count);
+  std::vector<uint32_t> next(vertex_count, ~0u);
+  std::vector<uint32_t> remap(vertex_count);
+  uint32_t unique = 0;
+
+  for (size_t i = 0; i < vertex_count; i++) {
+    auto &v = vertices[i];
+    auto low = cell_of(v.position - epsilon);
+    auto high = cell_of(v.position + epsilon);
+
+    auto match = ~0u;
+    for (int z = low.z; z <= high.z && match == ~0u; z++) {
+      for (int y = low.y; y <= high.y && match == ~0u; y++) {
+        for (int x = low.x; x <= high.x && match == ~0u; x++) {
+          auto it = heads.find(hash_cell(glm::ivec3(x, y, z)));
+          if (it == heads.end()) {
+            continue;
+          }
+          for (auto r = it->second; r != ~0u; r = next[r]) {
+            if (can_weld(v, vertices[r], *settings)) {
+              match = r;
+              break;
+            }
+          }
+        }
+      }
+    }
+
+    if (match != ~0u) {
+      remap[i] = remap[match];
+      continue;
+    }
+    remap[i] = unique++;
+    auto it = heads.emplace(hash_cell(cell_of(v.position)), (uint32_t)i);
+    if (!it.second) {
+      next[i] = it.first->second;
+      it.first->second = (uint32_t)i;
+    }
+  }
+  unique_count = unique;
+  return remap;
+}
+
+namespace {
+const size_t MESHLET_MAX_VERTICES = 64;
+const size_t MESHLET_MAX_TRIANGLES = 124;
+
+template <typename Index, typename Position>
+Meshlet meshlet_bounds(const Index *indices,
+                       size_t first_triangle,
+                       size_t triangle_count,
+                       const Position &position) {
+  Meshlet meshlet{};
+  meshlet.index_offset = (uint32_t)(first_triangle * 3);
+  meshlet.triangle_count = (uint32_t)triangle_count;
+  auto tris = indices + first_triangle * 3;
+
+  glm::vec3 min(std::numeric_limits<float>::max());
+  glm::vec3 max(-std::numeric_limits<float>::max());
+  for (size_t i = 0; i < triangle_count * 3; i++) {
+    auto p = position(tris[i]);
+    min = glm::min(min, p);
+    max = glm::max(max, p);
+  }
+  meshlet.center = (min + max) * 0.5f;
+  for (size_t i = 0; i < triangle_count * 3; i++) {
+    meshlet.radius = std::max(
+        meshlet.radius, glm::length(position(tris[i]) - meshlet.center));
+  }
+
+  // unit normals, zero for degenerate triangles which are never visible
+  std::vector<glm::vec3> normals(triangle_count, glm::vec3(0.0f));
+  glm::vec3 axis(0.0f);
+  for (size_t t = 0; t < triangle_count; t++) {
+    auto p0 = position(tris[t * 3 + 0]);
+    auto n = glm::cross(position(tris[t * 3 + 1]) - p0,
+                        position(tris[t * 3 + 2]) - p0);
+    auto length = glm::length(n);
+    if (length > 0.0f) {
+      normals[t] = n / length;
+      axis += normals[t];
+    }
+  }
+  meshlet.cone_cutoff = 1.0f;
+  auto axis_length = glm::length(axis);
+  if (axis_length == 0.0f) {
+    return meshlet;
+  }
+  axis /= axis_length;
+  float min_dot = 1.0f;
+  for (auto &n : normals) {
+    if (n != glm::vec3(0.0f)) {
+      min_dot = std::min(min_dot, glm::dot(axis, n));
+    }
+  }
+  // cones wider than about 85 degrees cull too little to be worth it
+  if (min_dot <= 0.1f) {
+    return meshlet;
+  }
+
+  // move the apex back along the axis until it is behind every triangle
+  float max_t = 0.0f;
+  for (size_t t = 0; t < triangle_count; t++) {
+    auto &n = normals[t];
+    if (n != glm::vec3(0.0f)) {
+      auto p0 = position(tris[t * 3 + 0]);
+      max_t = std::max(
+          max_t, glm::dot(meshlet.center - p0, n) / glm::dot(axis, n));
+    }
+  }
+  meshlet.cone_apex = meshlet.center - axis * max_t;
+  meshlet.cone_axis = axis;
+  meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+  return meshlet;
+}
+
+template <typename Index>
+std::vector<Meshlet> build_meshlets_impl(const Index *indices,
+                                         size_t index_count,
+                                         const float *positions,
+                                         size_t vertex_count,
+                                         size_t position_stride) {
+  auto position = [&](Index v) {
+    auto p = (const float *)((const uint8_t *)positions + v * position_stride);
+    return glm::vec3(p[0], p[1], p[2]);
+  };
+
+  std::vector<Meshlet> meshlets;
+  // meshlet a vertex was last added to
+  std::vector<size_t> added_to(vertex_count, ~size_t(0));
+  size_t first_triangle = 0;
+  size_t meshlet_vertices = 0;
+  auto triangle_count = index_count / 3;
+  for (size_t t = 0; t < triangle_count; t++) {
+    auto tri = &indices[t * 3];
+    size_t added = 0;
+    for (int k = 0; k < 3; k++) {
+      added += added_to[tri[k]] != meshlets.size();
+    }
+    if (meshlet_vertices + added > MESHLET_MAX_VERTICES ||
+        t - first_triangle == MESHLET_MAX_TRIANGLES) {
+      meshlets.push_back(meshlet_bounds(
+          indices, first_triangle, t - first_triangle, position));
+      first_triangle = t;
+      meshlet_vertices = 0;
+    }
+    for (int k = 0; k < 3; k++) {
+      if (added_to[tri[k]] != meshlets.size()) {
+        added_to[tri[k]] = meshlets.size();
+        meshlet_vertices++;
+      }
+    }
+  }
+  if (first_triangle < triangle_count) {
+    meshlets.push_back(meshlet_bounds(
+        indices, first_triangle, triangle_count - first_triangle, position));
+  }
+  return meshlets;
+}
+} // namespace
+
+std::vector<Meshlet> build_meshlets(const uint32_t *indices,
+                                    size_t index_count,
+                                    const float *positions,
+                                    size_t vertex_count,
+                                    size_t position_stride) {
+  return build_meshlets_impl(
+      indices, index_count, positions, vertex_count, position_stride);
+}
+
+std::vector<Meshlet> build_meshlets(const uint16_t *indices,
+                                    size_t index_count,
+                                    const float *positions,
+                                    size_t vertex_count,
+                                    size_t position_stride) {
+  return build_meshlets_impl(
+      indices, index_count, positions, vertex_count, position_stride);
+}
+
+namespace {
+enum class VertexKind {
+  Manifold, // collapses onto any neighbour
+  Border,   // on an open edge, collapses along it
+  Seam,     // two wedges with different attributes, collapses along the seam
+  Locked,   // anything more complex, never moves
+};
+
+struct Quadric {
+  // symmetric 4x4 matrix, upper triangle
+  double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+  double weight;
+
+  Quadric &operator+=(const Quadric &q) {
+    a00 += q.a00, a01 += q.a01, a02 += q.a02, a03 += q.a03;
+    a11 += q.a11, a12 += q.a12, a13 += q.a13;
+    a22 += q.a22, a23 += q.a23, a33 += q.a33;
+    weight += q.weight;
+    return *this;
+  }
+
+  // weighted squared distance to the planes, divided by the total weight
+  float error(const glm::vec3 &p) const {
+    double x = p.x, y = p.y, z = p.z;
+    auto e = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x +
+             a11 * y * y + 2 * a12 * y * z + 2 * a13 * y + a22 * z * z +
+             2 * a23 * z + a33;
+    return weight > 0.0 ? (float)std::max(e / weight, 0.0) : 0.0f;
+  }
+};
+
+Quadric plane_quadric(const glm::vec3 &n, float d, float weight) {
+  double a = n.x, b = n.y, c = n.z, w = weight;
+  return Quadric{a * a * w,
+                 a * b * w,
+                 a * c * w,
+                 a * d * w,
+                 b * b * w,
+                 b * c * w,
+                 b * d * w,
+                 c * c * w,
+                 c * d * w,
+                 (double)d * d * w,
+                 w};
+}
+
+// open edges get an extra plane through them, perpendicular to the surface
+const float BORDER_WEIGHT = 10.0f;
+
+uint64_t edge_key(uint32_t a, uint32_t b) {
+  return (uint64_t)a << 32 | b;
+}
+
+struct PositionHash {
+  size_t operator()(const glm::vec3 &p) const {
+    uint32_t bits[3];
+    std::memcpy(bits, &p, sizeof(bits));
+    return (size_t)hash_cell(glm::ivec3(bits[0], bits[1], bits[2]));
+  }
+};
+
+struct Collapse {
+  uint32_t from;
+  uint32_t to;
+  float error;
+};
+} // namespace
+
+std::vector<uint32_t> simplify(const uint32_t *indices,
+                               size_t index_count,
+                               const Mesh::Vertex *vertices,
+                               size_t vertex_count,
+                               size_t target_index_count,
+                               float &result_error) {
+  std::vector<uint32_t> result(indices, indices + index_count / 3 * 3);
+  result_error = 0.0f;
+  if (result.size() <= target_index_count) {
+    return result;
+  }
+
+  // vertices at the same position are wedges of one logical vertex, the
+  // first of them stands for all
+  std::vector<uint32_t> rep(vertex_count);
+  {
+    std::unordered_map<glm::vec3, uint32_t, PositionHash> first;
+    first.reserve(vertex_count);
+    for (uint32_t v = 0; v < vertex_count; v++) {
+      // +0.0f folds -0 into 0
+      rep[v] = first.emplace(vertices[v].position + 0.0f, v).first->second;
+    }
+  }
+  auto pos = [&](uint32_t v) { return vertices[v].position; };
+
+  // rebuilt after every pass, collapses close some edges and open others
+  std::unordered_map<uint64_t, uint32_t> position_edges;
+  std::unordered_set<uint64_t> wedge_edges;
+  auto update_edges = [&]() {
+    position_edges.clear();
+    wedge_edges.clear();
+    for (size_t i = 0; i < result.size(); i += 3) {
+      for (int k = 0; k < 3; k++) {
+        auto a = result[i + k], b = result[i + (k + 1) % 3];
+        position_edges[edge_key(rep[a], rep[b])]++;
+        wedge_edges.insert(edge_key(a, b));
+      }
+    }
+  };
+  update_edges();
+  auto is_open = [&](uint32_t a, uint32_t b) {
+    return position_edges.count(edge_key(rep[b], rep[a])) == 0;
+  };
+  auto is_seam = [&](uint32_t a, uint32_t b) {
+    return !is_open(a, b) && wedge_edges.count(edge_key(b, a)) == 0;
+  };
+
+  std::vector<VertexKind> kinds(vertex_count, VertexKind::Manifold);
+  std::vector<Quadric> quadrics(vertex_count, Quadric{});
+  {
+    std::vector<uint8_t> wedge_seen(vertex_count, 0);
+    std::vector<uint32_t> wedge_count(vertex_count, 0);
+    std::vector<uint32_t> open_count(vertex_count, 0);
+    // distinct neighbours across seam edges, ~1u when there are more than 2
+    std::vector<glm::uvec2> seam_neighbours(vertex_count, glm::uvec2(~0u));
+    auto add_seam_neighbour = [&](uint32_t r, uint32_t n) {
+      auto &s = seam_neighbours[r];
+      if (s.x == ~0u || s.x == n) {
+        s.x = n;
+      } else if (s.y == ~0u || s.y == n) {
+        s.y = n;
+      } else {
+        s = glm::uvec2(~1u);
+      }
+    };
+
+    for (size_t i = 0; i < result.size(); i += 3) {
+      auto tri = &result[i];
+      auto p0 = pos(tri[0]);
+      auto n = glm::cross(pos(tri[1]) - p0, pos(tri[2]) - p0);
+      auto area = glm::length(n);
+      if (area > 0.0f) {
+        n /= area;
+        auto q = plane_quadric(n, -glm::dot(n, p0), area * 0.5f);
+        for (int k = 0; k < 3; k++) {
+          quadrics[rep[tri[k]]] += q;
+        }
+      }
+
+      for (int k = 0; k < 3; k++) {
+        auto a = tri[k], b = tri[(k + 1) % 3];
+        if (!wedge_seen[a]) {
+          wedge_seen[a] = 1;
+          wedge_count[rep[a]]++;
+        }
+        auto open = is_open(a, b);
+        if (!open && !is_seam(a, b)) {
+          continue;
+        }
+        if (open) {
+          open_count[rep[a]]++;
+          open_count[rep[b]]++;
+        } else {
+          add_seam_neighbour(rep[a], rep[b]);
+          add_seam_neighbour(rep[b], rep[a]);
+        }
+        // keep borders and seams in place
+        auto edge = pos(b) - pos(a);
+        auto length = glm::length(edge);
+        if (area > 0.0f && length > 0.0f) {
+          auto plane_normal = glm::normalize(glm::cross(edge, n));
+          auto q = plane_quadric(plane_normal,
+                                 -glm::dot(plane_normal, pos(a)),
+                                 length * length * BORDER_WEIGHT);
+          quadrics[rep[a]] += q;
+          quadrics[rep[b]] += q;
+        }
+      }
+    }
+
+    for (uint32_t v = 0; v < vertex_count; v++) {
+      if (rep[v] != v) {
+        continue;
+      }
+      auto seam = seam_neighbours[v];
+      if (wedge_count[v] > 2 || seam.x == ~1u) {
+        kinds[v] = VertexKind::Locked;
+      } else if (open_count[v] > 0) {
+        // a simple border has one edge in and one edge out
+        kinds[v] = wedge_count[v] == 1 && open_count[v] == 2 &&
+                           seam.x == ~0u
+                       ? VertexKind::Border
+                       : VertexKind::Locked;
+      } else if (seam.x != ~0u) {
+        kinds[v] = wedge_count[v] == 2 && seam.y != ~0u ? VertexKind::Seam
+                                                        : VertexKind::Locked;
+      }
+    }
+  }
+
+  auto can_collapse = [&](uint32_t a, uint32_t b) {
+    switch (kinds[rep[a]]) {
+    case VertexKind::Manifold:
+      return true;
+    case VertexKind::Border:
+      return is_open(a, b) || is_open(b, a);
+    case VertexKind::Seam:
+      return is_seam(a, b) || is_seam(b, a);
+    default:
+      return false;
+    }
+  };
+
+  std::vector<uint32_t> offsets(vertex_count + 1);
+  std::vector<uint32_t> adjacency;
+  std::vector<Collapse> collapses;
+  std::vector<uint8_t> touched(vertex_count);
+  std::vector<uint32_t> remap(vertex_count);
+  float max_error = 0.0f;
+
+  while (result.size() > target_index_count) {
+    // triangles around every wedge
+    std::fill(offsets.begin(), offsets.end(), 0);
+    for (auto v : result) {
+      offsets[v + 1]++;
+    }
+    for (size_t v = 0; v < vertex_count; v++) {
+      offsets[v + 1] += offsets[v];
+    }
+    adjacency.resize(result.size());
+    {
+      auto fill = offsets;
+      for (size_t i = 0; i < result.size(); i++) {
+        adjacency[fill[result[i]]++] = (uint32_t)(i / 3);
+      }
+    }
+    // wedges of every logical vertex that are still referenced
+    std::unordered_multimap<uint32_t, uint32_t> wedges;
+    for (uint32_t v = 0; v < vertex_count; v++) {
+      if (offsets[v + 1] > offsets[v] && rep[v] != v) {
+        wedges.emplace(rep[v], v);
+      }
+    }
+    auto for_each_wedge = [&](uint32_t r, const auto &func) {
+      if (offsets[r + 1] > offsets[r]) {
+        func(r);
+      }
+      auto range = wedges.equal_range(r);
+      for (auto it = range.first; it != range.second; ++it) {
+        func(it->second);
+      }
+    };
+
+    collapses.clear();
+    for (size_t i = 0; i < result.size(); i += 3) {
+      for (int k = 0; k < 3; k++) {
+        auto a = result[i + k], b = result[i + (k + 1) % 3];
+        auto ra = rep[a], rb = rep[b];
+        // interior edges are seen from both sides, take them once
+        if (!is_open(a, b) && ra > rb) {
+          continue;
+        }
+        Collapse best{0, 0, std::numeric_limits<float>::max()};
+        for (auto [from, to] : {std::make_pair(a, b), std::make_pair(b, a)}) {
+          if (!can_collapse(from, to)) {
+            continue;
+          }
+          auto q = quadrics[rep[from]];
+          q += quadrics[rep[to]];
+          auto error = q.error(pos(to));
+          if (error < best.error) {
+            best = Collapse{rep[from], rep[to], error};
+          }
+        }
+        if (best.error < std::numeric_limits<float>::max()) {
+          collapses.push_back(best);
+        }
+      }
+    }
+    if (collapses.empty()) {
+      break;
+    }
+    std::sort(collapses.begin(), collapses.end(), [](auto &x, auto &y) {
+      return x.error < y.error;
+    });
+
+    std::fill(touched.begin(), touched.end(), 0);
+    std::iota(remap.begin(), remap.end(), 0);
+    auto triangles_left = result.size() / 3;
+    auto target_triangles = target_index_count / 3;
+    size_t applied = 0;
+    for (auto &c : collapses) {
+      if (triangles_left <= target_triangles) {
+        break;
+      }
+      if (touched[c.from] || touched[c.to]) {
+        continue;
+      }
+
+      // every wedge moves onto the wedge of the target it shares a triangle
+      // with, that keeps seams intact; also reject folding triangles over
+      bool valid = true;
+      size_t removed = 0;
+      std::vector<std::pair<uint32_t, uint32_t>> moves;
+      auto target = pos(c.to);
+      for_each_wedge(c.from, [&](uint32_t w) {
+        auto moved_to = ~0u;
+        for (auto j = offsets[w]; j < offsets[w + 1] && valid; j++) {
+          auto tri = &result[adjacency[j] * 3];
+          int k = tri[0] == w ? 0 : tri[1] == w ? 1 : 2;
+          auto b = tri[(k + 1) % 3], d = tri[(k + 2) % 3];
+          if (rep[b] == c.to || rep[d] == c.to) {
+            moved_to = rep[b] == c.to ? b : d;
+            removed++;
+            continue;
+          }
+          auto before = glm::cross(pos(b) - pos(w), pos(d) - pos(w));
+          auto after = glm::cross(pos(b) - target, pos(d) - target);
+          // turning by more than 60 degrees counts too, or triangles fold
+          // over a little at a time across passes
+          auto alignment = glm::dot(before, after);
+          if (alignment <= 0.0f ||
+              alignment * alignment <= 0.25f * glm::dot(before, before) *
+                                           glm::dot(after, after)) {
+            valid = false;
+          }
+        }
+        if (moved_to == ~0u) {
+          valid = false;
+        }
+        moves.emplace_back(w, moved_to);
+      });
+      if (!valid) {
+        continue;
+      }
+
+      for (auto [w, to] : moves) {
+        remap[w] = to;
+      }
+      quadrics[c.to] += quadrics[c.from];
+      // the flip test of later collapses in this pass reads the positions
+      // of their neighbours before the pass, so none of them may move
+      for_each_wedge(c.from, [&](uint32_t w) {
+        for (auto j = offsets[w]; j < offsets[w + 1]; j++) {
+          auto tri = &result[adjacency[j] * 3];
+          for (int k = 0; k < 3; k++) {
+            touched[rep[tri[k]]] = 1;
+          }
+        }
+      });
+      // wedges share their triangles with the target on both sides
+      triangles_left -= std::min(removed, triangles_left);
+      max_error = std::max(max_error, c.error);
+      applied++;
+    }
+    if (applied == 0) {
+      break;
+    }
+
+    size_t out = 0;
+    for (size_t i = 0; i < result.size(); i += 3) {
+      auto a = remap[result[i]], b = remap[result[i + 1]],
+           d = remap[result[i + 2]];
+      if (rep[a] == rep[b] || rep[b] == rep[d] || rep[a] == rep[d]) {
+        continue;
+      }
+      result[out++] = a;
+      result[out++] = b;
+      result[out++] = d;
+    }
+    result.resize(out);
+    update_edges();
+  }
+
+  result_error = std::sqrt(max_error);
+  return result;
+}
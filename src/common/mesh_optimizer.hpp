@@ -0,0 +1,118 @@
+#pragma once
+
+#include "mesh.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct VertexCacheStats {
+  size_t vertices_transformed = 0;
+  size_t triangle_count = 0;
+  size_t vertex_count = 0;
+
+  // average cache miss ratio, transformed vertices per triangle
+  float acmr() const;
+  // average transform to vertex ratio, 1 is optimal
+  float atvr() const;
+
+  VertexCacheStats &operator+=(const VertexCacheStats &other);
+};
+
+// simulate a FIFO post-transform cache as found on most GPUs
+VertexCacheStats analyze_vertex_cache(const uint32_t *indices,
+                                      size_t index_count,
+                                      size_t vertex_count,
+                                      int cache_size = 16);
+
+// reorder triangles for post-transform cache hits, Forsyth's linear speed
+// algorithm with an LRU cache model
+void optimize_vertex_cache(uint32_t *indices,
+                           size_t index_count,
+                           size_t vertex_count);
+
+// Reorder clusters of a cache optimized triangle list so outward facing
+// clusters, which tend to occlude the rest, are drawn first. The order is
+// view independent. Clusters break where the cache would be flushed anyway,
+// the cache optimized order is kept if the ACMR grows by more than threshold.
+void optimize_overdraw(uint32_t *indices,
+                       size_t index_count,
+                       const float *positions,
+                       size_t vertex_count,
+                       size_t position_stride,
+                       float threshold = 1.05f);
+
+// Renumber vertices in the order they are first referenced and rewrite the
+// indices. Returns the new index of every vertex, ~0u for unreferenced
+// ones, and the number of referenced vertices in unique_count.
+std::vector<uint32_t> optimize_vertex_fetch_remap(uint32_t *indices,
+                                                  size_t index_count,
+                                                  size_t vertex_count,
+                                                  size_t &unique_count);
+
+// Split a triangle list into consecutive ranges that reference at most
+// max_vertices distinct vertices each, returns the first index of every
+// range. Works best on cache optimized lists, whose triangles share
+// vertices with their neighbours.
+std::vector<size_t> split_by_vertex_count(const uint32_t *indices,
+                                          size_t index_count,
+                                          size_t vertex_count,
+                                          size_t max_vertices);
+
+// Cut a triangle list into meshlets of consecutive triangles, see Meshlet.
+// The triangles are not reordered, cache optimized lists give meshlets that
+// share most of their vertices.
+std::vector<Meshlet> build_meshlets(const uint32_t *indices,
+                                    size_t index_count,
+                                    const float *positions,
+                                    size_t vertex_count,
+                                    size_t position_stride);
+std::vector<Meshlet> build_meshlets(const uint16_t *indices,
+                                    size_t index_count,
+                                    const float *positions,
+                                    size_t vertex_count,
+                                    size_t position_stride);
+
+// Simplify a triangle list towards target_index_count by collapsing edges
+// onto existing vertices in order of quadric error, so all detail levels can
+// share one vertex buffer. UV and normal seams and open borders only
+// collapse along themselves. result_error is the deviation from the input
+// surface in model units.
+std::vector<uint32_t> simplify(const uint32_t *indices,
+                               size_t index_count,
+                               const Mesh::Vertex *vertices,
+                               size_t vertex_count,
+                               size_t target_index_count,
+                               float &result_error);
+
+// largest difference per component for two vertices to be welded, 0 only
+// welds identical attributes
+struct WeldSettings {
+  float position_epsilon = 0.0f;
+  float normal_epsilon = 0.0f;
+  float tangent_epsilon = 0.0f;
+  float uv_epsilon = 0.0f;
+  float color_epsilon = 0.0f;
+};
+
+// Map every vertex to the first vertex it can be welded with, vertices are
+// hashed by position so only nearby ones are compared. Returns the new index
+// of every vertex and the number of distinct vertices in unique_count.
+std::vector<uint32_t> weld_vertices_remap(const Mesh::Vertex *vertices,
+                                          size_t vertex_count,
+                                          WeldSettings *settings,
+                                          size_t &unique_count);
+
+// move every vertex to its new index, when several vertices share an index
+// the first one is kept
+template <typename T>
+std::vector<T> remap_vertices(const std::vector<T> &vertices,
+                              const std::vector<uint32_t> &remap,
+                              size_t unique_count) {
+  std::vector<T> result(unique_count);
+  for (size_t i = vertices.size(); i-- > 0;) {
+    if (remap[i] != ~0u) {
+      result[remap[i]] = vertices[i];
+    }
+  }
+  return result;
+}
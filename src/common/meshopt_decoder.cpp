@@ -0,0 +1,660 @@
+#include "meshopt_decoder.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define MESHOPT_DECODER_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+// vertices are coded in blocks of at most 8KB and 256 vertices, every byte
+// of a vertex is a separate stream of deltas split into groups of 16
+const size_t block_max_bytes = 8192;
+const size_t block_max_vertices = 256;
+const size_t group_size = 16;
+// 4-bit values and their escaped bytes
+const size_t group_max_bytes = 24;
+// the first vertex ends the stream, padded in front to at least 32 bytes
+const size_t tail_min_size = 32;
+
+[[noreturn]] void fail(const std::string &what) {
+  throw std::runtime_error("meshopt: " + what);
+}
+
+const uint8_t *decode_group(const uint8_t *data, uint8_t *out, int bits_log2) {
+  switch (bits_log2) {
+  case 0:
+    std::memset(out, 0, group_size);
+    return data;
+  case 3:
+    std::memcpy(out, data, group_size);
+    return data + group_size;
+  }
+  // 2 or 4 bits per byte, most significant first, the all ones value is
+  // escaped with a full byte after the packed values
+  unsigned bits = 1u << bits_log2;
+  unsigned escape = (1u << bits) - 1;
+  auto extra = data + group_size * bits / 8;
+  for (size_t i = 0; i < group_size; i++) {
+    auto shift = 8 - bits - i * bits % 8;
+    auto value = (data[i * bits / 8] >> shift) & escape;
+    out[i] = value == escape ? *extra++ : (uint8_t)value;
+  }
+  return extra;
+}
+
+const uint8_t *decode_bytes(const uint8_t *data,
+                            const uint8_t *end,
+                            uint8_t *out,
+                            size_t count) {
+  // 2 bits of group mode per group, least significant first
+  size_t header_size = (count / group_size + 3) / 4;
+  if ((size_t)(end - data) < header_size) {
+    fail("vertex data is truncated");
+  }
+  auto header = data;
+  data += header_size;
+  for (size_t i = 0; i < count; i += group_size) {
+    if ((size_t)(end - data) < group_max_bytes) {
+      fail("vertex data is truncated");
+    }
+    auto group = i / group_size;
+    int bits_log2 = (header[group / 4] >> (group % 4 * 2)) & 3;
+    data = decode_group(data, out + i, bits_log2);
+  }
+  return data;
+}
+
+#ifdef MESHOPT_DECODER_SSE2
+__m128i unzigzag8(__m128i v) {
+  auto sign = _mm_sub_epi8(_mm_setzero_si128(),
+                           _mm_and_si128(v, _mm_set1_epi8(1)));
+  auto half = _mm_and_si128(_mm_srli_epi16(v, 1), _mm_set1_epi8(127));
+  return _mm_xor_si128(sign, half);
+}
+
+// Four byte streams at a time are transposed into 4 bytes of 4 vertices per
+// register, where the deltas are summed up across the vertices.
+const uint8_t *decode_vertex_block(const uint8_t *data,
+                                   const uint8_t *end,
+                                   uint8_t *vertices,
+                                   size_t vertex_count,
+                                   size_t stride,
+                                   uint8_t *last) {
+  alignas(16) uint8_t bytes[4][block_max_vertices];
+  auto aligned_count = (vertex_count + group_size - 1) & ~(group_size - 1);
+  for (size_t k = 0; k < stride; k += 4) {
+    for (auto &stream : bytes) {
+      data = decode_bytes(data, end, stream, aligned_count);
+    }
+    uint32_t previous;
+    std::memcpy(&previous, last + k, 4);
+    auto sum = _mm_set1_epi32((int)previous);
+    for (size_t i = 0; i < aligned_count; i += group_size) {
+      auto b0 = _mm_load_si128((const __m128i *)&bytes[0][i]);
+      auto b1 = _mm_load_si128((const __m128i *)&bytes[1][i]);
+      auto b2 = _mm_load_si128((const __m128i *)&bytes[2][i]);
+      auto b3 = _mm_load_si128((const __m128i *)&bytes[3][i]);
+      auto lo01 = _mm_unpacklo_epi8(b0, b1);
+      auto hi01 = _mm_unpackhi_epi8(b0, b1);
+      auto lo23 = _mm_unpacklo_epi8(b2, b3);
+      auto hi23 = _mm_unpackhi_epi8(b2, b3);
+      __m128i quads[4] = {_mm_unpacklo_epi16(lo01, lo23),
+                          _mm_unpackhi_epi16(lo01, lo23),
+                          _mm_unpacklo_epi16(hi01, hi23),
+                          _mm_unpackhi_epi16(hi01, hi23)};
+      for (size_t q = 0; q < 4; q++) {
+        auto v = unzigzag8(quads[q]);
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi8(v, sum);
+        sum = _mm_shuffle_epi32(v, 0xff);
+        for (size_t j = i + q * 4; j < i + q * 4 + 4; j++) {
+          if (j < vertex_count) {
+            auto value = (uint32_t)_mm_cvtsi128_si32(v);
+            std::memcpy(vertices + j * stride + k, &value, 4);
+          }
+          v = _mm_srli_si128(v, 4);
+        }
+      }
+    }
+    // the sums went on through the padding of the last group
+    std::memcpy(last + k, vertices + (vertex_count - 1) * stride + k, 4);
+  }
+  return data;
+}
+#else
+uint8_t unzigzag8(uint8_t v) {
+  return (uint8_t)(-(v & 1) ^ (v >> 1));
+}
+
+const uint8_t *decode_vertex_block(const uint8_t *data,
+                                   const uint8_t *end,
+                                   uint8_t *vertices,
+                                   size_t vertex_count,
+                                   size_t stride,
+                                   uint8_t *last) {
+  uint8_t bytes[block_max_vertices];
+  auto aligned_count = (vertex_count + group_size - 1) & ~(group_size - 1);
+  for (size_t k = 0; k < stride; k++) {
+    data = decode_bytes(data, end, bytes, aligned_count);
+    auto value = last[k];
+    for (size_t i = 0; i < vertex_count; i++) {
+      value += unzigzag8(bytes[i]);
+      vertices[i * stride + k] = value;
+    }
+    last[k] = value;
+  }
+  return data;
+}
+#endif
+
+void decode_vertices(uint8_t *destination,
+                     size_t count,
+                     size_t stride,
+                     const uint8_t *source,
+                     size_t size) {
+  if (stride == 0 || stride > 256 || stride % 4 != 0) {
+    fail("vertex stride " + std::to_string(stride) + " is not supported");
+  }
+  auto tail_size = std::max(stride, tail_min_size);
+  if (size < 1 + tail_size) {
+    fail("vertex data is truncated");
+  }
+  if ((source[0] & 0xf0) != 0xa0 || (source[0] & 0x0f) > 0) {
+    fail("invalid vertex data header");
+  }
+
+  auto data = source + 1;
+  auto end = source + size;
+  uint8_t last[256];
+  std::memcpy(last, end - stride, stride);
+  auto block_size = std::min((block_max_bytes / stride) & ~(group_size - 1),
+                             block_max_vertices);
+  for (size_t offset = 0; offset < count; offset += block_size) {
+    data = decode_vertex_block(data,
+                               end,
+                               destination + offset * stride,
+                               std::min(block_size, count - offset),
+                               stride,
+                               last);
+  }
+  if ((size_t)(end - data) != tail_size) {
+    fail("vertex data has a malformed tail");
+  }
+}
+
+uint32_t decode_vbyte(const uint8_t *&data) {
+  uint8_t lead = *data++;
+  if (lead < 128) {
+    return lead;
+  }
+  // groups of 7 bits, little endian, up to 5 bytes
+  uint32_t result = lead & 127;
+  for (unsigned shift = 7; shift < 35; shift += 7) {
+    uint8_t group = *data++;
+    result |= (uint32_t)(group & 127) << shift;
+    if (group < 128) {
+      break;
+    }
+  }
+  return result;
+}
+
+uint32_t decode_index(const uint8_t *&data, uint32_t last) {
+  auto v = decode_vbyte(data);
+  return last + ((v >> 1) ^ (0u - (v & 1)));
+}
+
+void write_index(uint8_t *destination, size_t i, size_t stride, uint32_t v) {
+  if (stride == 2) {
+    auto narrow = (uint16_t)v;
+    std::memcpy(destination + i * 2, &narrow, 2);
+  } else {
+    std::memcpy(destination + i * 4, &v, 4);
+  }
+}
+
+// Triangles reuse edges and vertices of recent triangles through two 16
+// entry FIFOs, the decoder must push to them exactly like the encoder.
+class TriangleDecoder {
+public:
+  TriangleDecoder() {
+    std::memset(_edges, 0xff, sizeof(_edges));
+    std::memset(_vertices, 0xff, sizeof(_vertices));
+  }
+
+  void push_edge(uint32_t a, uint32_t b) {
+    _edges[_edge_offset][0] = a;
+    _edges[_edge_offset][1] = b;
+    _edge_offset = (_edge_offset + 1) & 15;
+  }
+  void push_vertex(uint32_t v, bool advance = true) {
+    _vertices[_vertex_offset] = v;
+    _vertex_offset = (_vertex_offset + advance) & 15;
+  }
+  // entries count back from the newest, 0 is the newest
+  const uint32_t *edge(unsigned age) const {
+    return _edges[(_edge_offset - 1 - age) & 15];
+  }
+  uint32_t vertex(unsigned age) const {
+    return _vertices[(_vertex_offset - 1 - age) & 15];
+  }
+
+private:
+  uint32_t _edges[16][2];
+  uint32_t _vertices[16];
+  size_t _edge_offset = 0;
+  size_t _vertex_offset = 0;
+};
+
+void decode_triangles(uint8_t *destination,
+                      size_t count,
+                      size_t stride,
+                      const uint8_t *source,
+                      size_t size) {
+  if (count % 3 != 0 || (stride != 2 && stride != 4)) {
+    fail("invalid triangle index count or stride");
+  }
+  // a header, a code per triangle and a 16 byte table at the end
+  if (size < 1 + count / 3 + 16) {
+    fail("index data is truncated");
+  }
+  if ((source[0] & 0xf0) != 0xe0 || (source[0] & 0x0f) > 1) {
+    fail("invalid index data header");
+  }
+  int version = source[0] & 0x0f;
+  // version 0 has no codes for the next vertex plus or minus one
+  unsigned fifo_codes = version >= 1 ? 13 : 15;
+
+  TriangleDecoder fifo;
+  uint32_t next = 0, last = 0;
+  auto code = source + 1;
+  auto data = code + count / 3;
+  // a triangle reads at most 16 bytes of data, the table keeps all reads
+  // in bounds as long as data starts before it
+  auto data_end = source + size - 16;
+  auto table = data_end;
+  for (size_t i = 0; i < count; i += 3) {
+    if (data > data_end) {
+      fail("index data is truncated");
+    }
+    auto tri = *code++;
+    uint32_t a, b, c;
+    if (tri < 0xf0) {
+      // an edge from the FIFO and a third vertex
+      auto e = fifo.edge(tri >> 4);
+      a = e[0];
+      b = e[1];
+      unsigned fc = tri & 15;
+      if (fc < fifo_codes) {
+        c = fc == 0 ? next++ : fifo.vertex(fc);
+        fifo.push_vertex(c, fc == 0);
+      } else {
+        // 13 and 14 are the last free index minus and plus one
+        c = last = fc != 15 ? last + (fc - (fc ^ 3)) : decode_index(data, last);
+        fifo.push_vertex(c);
+      }
+      fifo.push_edge(c, b);
+      fifo.push_edge(a, c);
+    } else {
+      // a triangle of new or recent vertices without a shared edge
+      unsigned fb, fc;
+      if (tri < 0xfe) {
+        auto aux = table[tri & 15];
+        fb = aux >> 4;
+        fc = aux & 15;
+        a = next++;
+        b = fb == 0 ? next++ : fifo.vertex(fb - 1);
+        c = fc == 0 ? next++ : fifo.vertex(fc - 1);
+      } else {
+        auto aux = *data++;
+        if (aux == 0) {
+          next = 0;
+        }
+        fb = aux >> 4;
+        fc = aux & 15;
+        a = tri == 0xfe ? next++ : 0;
+        b = fb == 0 ? next++ : 0;
+        c = fc == 0 ? next++ : 0;
+        if (tri != 0xfe) {
+          a = last = decode_index(data, last);
+        }
+        if (fb == 15) {
+          b = last = decode_index(data, last);
+        } else if (fb != 0) {
+          b = fifo.vertex(fb - 1);
+        }
+        if (fc == 15) {
+          c = last = decode_index(data, last);
+        } else if (fc != 0) {
+          c = fifo.vertex(fc - 1);
+        }
+      }
+      fifo.push_vertex(a);
+      fifo.push_vertex(b, fb == 0 || fb == 15);
+      fifo.push_vertex(c, fc == 0 || fc == 15);
+      fifo.push_edge(b, a);
+      fifo.push_edge(c, b);
+      fifo.push_edge(a, c);
+    }
+    write_index(destination, i + 0, stride, a);
+    write_index(destination, i + 1, stride, b);
+    write_index(destination, i + 2, stride, c);
+  }
+  if (data != data_end) {
+    fail("index data has a malformed tail");
+  }
+}
+
+void decode_index_sequence(uint8_t *destination,
+                           size_t count,
+                           size_t stride,
+                           const uint8_t *source,
+                           size_t size) {
+  if (stride != 2 && stride != 4) {
+    fail("invalid index stride");
+  }
+  // a header, at least a byte per index and 4 bytes of padding
+  if (size < 1 + count + 4) {
+    fail("index data is truncated");
+  }
+  if ((source[0] & 0xf0) != 0xd0 || (source[0] & 0x0f) > 1) {
+    fail("invalid index sequence header");
+  }
+
+  // every index is a delta from one of two previous indices
+  uint32_t last[2] = {};
+  auto data = source + 1;
+  auto data_end = source + size - 4;
+  for (size_t i = 0; i < count; i++) {
+    if (data >= data_end) {
+      fail("index data is truncated");
+    }
+    auto v = decode_vbyte(data);
+    auto &base = last[v & 1];
+    v >>= 1;
+    base += (v >> 1) ^ (0u - (v & 1));
+    write_index(destination, i, stride, base);
+  }
+  if (data != data_end) {
+    fail("index data has a malformed tail");
+  }
+}
+
+// round to nearest with ties away from zero like the encoder expects
+int round_signed(float v) {
+  return (int)(v + (v >= 0.f ? 0.5f : -0.5f));
+}
+
+// x and y on the octahedron, z holds the scale of 1
+template <typename T> void filter_octahedral(T *data, size_t count) {
+  const float max = (float)((1 << (sizeof(T) * 8 - 1)) - 1);
+  for (size_t i = 0; i < count; i++) {
+    auto x = (float)data[i * 4 + 0];
+    auto y = (float)data[i * 4 + 1];
+    auto z = (float)data[i * 4 + 2] - std::fabs(x) - std::fabs(y);
+    auto t = std::min(z, 0.f);
+    x += x >= 0.f ? t : -t;
+    y += y >= 0.f ? t : -t;
+    auto s = max / std::sqrt(x * x + y * y + z * z);
+    data[i * 4 + 0] = (T)round_signed(x * s);
+    data[i * 4 + 1] = (T)round_signed(y * s);
+    data[i * 4 + 2] = (T)round_signed(z * s);
+  }
+}
+
+// The three smallest components, the largest one is rebuilt from them. The
+// low 2 bits of the fourth value say where the largest goes and the rest of
+// it is the scale of the others.
+void store_quaternion(int16_t *q, int x, int y, int z, int w, int largest) {
+  q[(largest + 1) & 3] = (int16_t)x;
+  q[(largest + 2) & 3] = (int16_t)y;
+  q[(largest + 3) & 3] = (int16_t)z;
+  q[(largest + 0) & 3] = (int16_t)w;
+}
+
+void filter_quaternion(int16_t *data, size_t count) {
+  const float scale = 1.f / std::sqrt(2.f);
+  for (size_t i = 0; i < count; i++) {
+    auto q = data + i * 4;
+    auto ss = scale / (float)(q[3] | 3);
+    auto x = (float)q[0] * ss;
+    auto y = (float)q[1] * ss;
+    auto z = (float)q[2] * ss;
+    auto w = std::sqrt(std::max(1.f - x * x - y * y - z * z, 0.f));
+    store_quaternion(q,
+                     round_signed(x * 32767.f),
+                     round_signed(y * 32767.f),
+                     round_signed(z * 32767.f),
+                     round_signed(w * 32767.f),
+                     q[3] & 3);
+  }
+}
+
+// 24-bit signed mantissa and 8-bit signed exponent
+void filter_exponential(uint32_t *data, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    auto m = (int32_t)(data[i] << 8) >> 8;
+    auto e = (int32_t)data[i] >> 24;
+    auto power = (uint32_t)(e + 127) << 23;
+    float f;
+    std::memcpy(&f, &power, 4);
+    f *= (float)m;
+    std::memcpy(&data[i], &f, 4);
+  }
+}
+
+#ifdef MESHOPT_DECODER_SSE2
+__m128 half_with_sign(__m128 v) {
+  auto sign = _mm_and_ps(v, _mm_set1_ps(-0.f));
+  return _mm_or_ps(_mm_set1_ps(0.5f), sign);
+}
+
+__m128i round_signed(__m128 v) {
+  return _mm_cvttps_epi32(_mm_add_ps(v, half_with_sign(v)));
+}
+
+// sign extend bits [offset, offset + width) of every 32-bit lane
+template <int offset, int width> __m128i extract(__m128i v) {
+  return _mm_srai_epi32(_mm_slli_epi32(v, 32 - offset - width), 32 - width);
+}
+
+void octahedral(__m128i xi,
+                __m128i yi,
+                __m128i zi,
+                float max,
+                __m128i &xo,
+                __m128i &yo,
+                __m128i &zo) {
+  auto sign = _mm_set1_ps(-0.f);
+  auto x = _mm_cvtepi32_ps(xi);
+  auto y = _mm_cvtepi32_ps(yi);
+  auto z = _mm_sub_ps(_mm_cvtepi32_ps(zi),
+                      _mm_add_ps(_mm_andnot_ps(sign, x), _mm_andnot_ps(sign, y)));
+  // x and y never are -0 here, their sign bit flips t
+  auto t = _mm_min_ps(z, _mm_setzero_ps());
+  x = _mm_add_ps(x, _mm_xor_ps(t, _mm_and_ps(x, sign)));
+  y = _mm_add_ps(y, _mm_xor_ps(t, _mm_and_ps(y, sign)));
+  // same order of operations as the scalar filter
+  auto l = _mm_sqrt_ps(_mm_add_ps(
+      _mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+  auto s = _mm_div_ps(_mm_set1_ps(max), l);
+  xo = round_signed(_mm_mul_ps(x, s));
+  yo = round_signed(_mm_mul_ps(y, s));
+  zo = round_signed(_mm_mul_ps(z, s));
+}
+
+size_t filter_octahedral_simd(int8_t *data, size_t count) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    auto v = _mm_loadu_si128((const __m128i *)(data + i * 4));
+    __m128i x, y, z;
+    octahedral(
+        extract<0, 8>(v), extract<8, 8>(v), extract<16, 8>(v), 127.f, x, y, z);
+    auto mask = _mm_set1_epi32(0xff);
+    auto r = _mm_and_si128(v, _mm_set1_epi32((int)0xff000000));
+    r = _mm_or_si128(r, _mm_and_si128(x, mask));
+    r = _mm_or_si128(r, _mm_slli_epi32(_mm_and_si128(y, mask), 8));
+    r = _mm_or_si128(r, _mm_slli_epi32(_mm_and_si128(z, mask), 16));
+    _mm_storeu_si128((__m128i *)(data + i * 4), r);
+  }
+  return i;
+}
+
+// two registers of two elements each, split into their xy and zw halves
+void load_shorts(const int16_t *data, __m128i &xy, __m128i &zw) {
+  auto a = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)data));
+  auto b = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(data + 8)));
+  xy = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+  zw = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+}
+
+size_t filter_octahedral_simd(int16_t *data, size_t count) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i xy, zw;
+    load_shorts(data + i * 4, xy, zw);
+    __m128i x, y, z;
+    octahedral(extract<0, 16>(xy),
+               extract<16, 16>(xy),
+               extract<0, 16>(zw),
+               32767.f,
+               x,
+               y,
+               z);
+    auto mask = _mm_set1_epi32(0xffff);
+    xy = _mm_or_si128(_mm_and_si128(x, mask), _mm_slli_epi32(y, 16));
+    zw = _mm_or_si128(_mm_and_si128(z, mask),
+                      _mm_andnot_si128(mask, zw));
+    _mm_storeu_si128((__m128i *)(data + i * 4), _mm_unpacklo_epi32(xy, zw));
+    _mm_storeu_si128((__m128i *)(data + i * 4 + 8),
+                     _mm_unpackhi_epi32(xy, zw));
+  }
+  return i;
+}
+
+size_t filter_quaternion_simd(int16_t *data, size_t count) {
+  const float scale = 1.f / std::sqrt(2.f);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i xy, zw;
+    load_shorts(data + i * 4, xy, zw);
+    auto packed = extract<16, 16>(zw);
+    auto ss = _mm_div_ps(
+        _mm_set1_ps(scale),
+        _mm_cvtepi32_ps(_mm_or_si128(packed, _mm_set1_epi32(3))));
+    auto x = _mm_mul_ps(_mm_cvtepi32_ps(extract<0, 16>(xy)), ss);
+    auto y = _mm_mul_ps(_mm_cvtepi32_ps(extract<16, 16>(xy)), ss);
+    auto z = _mm_mul_ps(_mm_cvtepi32_ps(extract<0, 16>(zw)), ss);
+    auto ww = _mm_sub_ps(_mm_set1_ps(1.f), _mm_mul_ps(x, x));
+    ww = _mm_sub_ps(_mm_sub_ps(ww, _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+    auto w = _mm_sqrt_ps(_mm_max_ps(ww, _mm_setzero_ps()));
+    auto unit = _mm_set1_ps(32767.f);
+    // where the largest component goes differs per element
+    alignas(16) int32_t out[4][4];
+    _mm_store_si128((__m128i *)out[0], round_signed(_mm_mul_ps(x, unit)));
+    _mm_store_si128((__m128i *)out[1], round_signed(_mm_mul_ps(y, unit)));
+    _mm_store_si128((__m128i *)out[2], round_signed(_mm_mul_ps(z, unit)));
+    _mm_store_si128((__m128i *)out[3], round_signed(_mm_mul_ps(w, unit)));
+    for (size_t j = 0; j < 4; j++) {
+      auto q = data + (i + j) * 4;
+      store_quaternion(
+          q, out[0][j], out[1][j], out[2][j], out[3][j], q[3] & 3);
+    }
+  }
+  return i;
+}
+
+size_t filter_exponential_simd(uint32_t *data, size_t count) {
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    auto v = _mm_loadu_si128((const __m128i *)(data + i));
+    auto m = _mm_cvtepi32_ps(extract<0, 24>(v));
+    auto e = _mm_srai_epi32(v, 24);
+    auto power = _mm_slli_epi32(_mm_add_epi32(e, _mm_set1_epi32(127)), 23);
+    auto f = _mm_mul_ps(_mm_castsi128_ps(power), m);
+    _mm_storeu_si128((__m128i *)(data + i), _mm_castps_si128(f));
+  }
+  return i;
+}
+#else
+template <typename T> size_t filter_octahedral_simd(T *, size_t) {
+  return 0;
+}
+size_t filter_quaternion_simd(int16_t *, size_t) {
+  return 0;
+}
+size_t filter_exponential_simd(uint32_t *, size_t) {
+  return 0;
+}
+#endif
+
+// the SIMD filters take whole groups of 4 values, the scalar ones the rest
+void filter(uint8_t *data, size_t count, size_t stride, MeshoptFilter filter) {
+  switch (filter) {
+  case MeshoptFilter::None:
+    break;
+  case MeshoptFilter::Octahedral:
+    if (stride == 4) {
+      auto values = reinterpret_cast<int8_t *>(data);
+      auto done = filter_octahedral_simd(values, count);
+      filter_octahedral(values + done * 4, count - done);
+    } else if (stride == 8) {
+      auto values = reinterpret_cast<int16_t *>(data);
+      auto done = filter_octahedral_simd(values, count);
+      filter_octahedral(values + done * 4, count - done);
+    } else {
+      fail("octahedral filter needs a stride of 4 or 8");
+    }
+    break;
+  case MeshoptFilter::Quaternion: {
+    if (stride != 8) {
+      fail("quaternion filter needs a stride of 8");
+    }
+    auto values = reinterpret_cast<int16_t *>(data);
+    auto done = filter_quaternion_simd(values, count);
+    filter_quaternion(values + done * 4, count - done);
+    break;
+  }
+  case MeshoptFilter::Exponential: {
+    if (stride % 4 != 0) {
+      fail("exponential filter needs a multiple of 4 stride");
+    }
+    auto values = reinterpret_cast<uint32_t *>(data);
+    auto value_count = count * stride / 4;
+    auto done = filter_exponential_simd(values, value_count);
+    filter_exponential(values + done, value_count - done);
+    break;
+  }
+  }
+}
+} // namespace
+
+void meshopt_decode(uint8_t *destination,
+                    size_t count,
+                    size_t stride,
+                    const uint8_t *source,
+                    size_t size,
+                    MeshoptMode mode,
+                    MeshoptFilter filter_mode) {
+  switch (mode) {
+  case MeshoptMode::Attributes:
+    decode_vertices(destination, count, stride, source, size);
+    filter(destination, count, stride, filter_mode);
+    return;
+  case MeshoptMode::Triangles:
+    decode_triangles(destination, count, stride, source, size);
+    break;
+  case MeshoptMode::Indices:
+    decode_index_sequence(destination, count, stride, source, size);
+    break;
+  }
+  if (filter_mode != MeshoptFilter::None) {
+    fail("filters only apply to attributes");
+  }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Decoders for the bitstreams of EXT_meshopt_compression, see
+// https://github.com/KhronosGroup/glTF/tree/main/extensions/2.0/Vendor/EXT_meshopt_compression
+enum class MeshoptMode {
+  // vertex codec, byteStride is a multiple of 4 up to 256
+  Attributes,
+  // index codec, count is a multiple of 3
+  Triangles,
+  // index sequence codec
+  Indices
+};
+
+// applied to attributes after decoding
+enum class MeshoptFilter { None, Octahedral, Quaternion, Exponential };
+
+// Decode count elements of stride bytes from the size bytes at source into
+// destination, which holds count * stride bytes, and run the filter over
+// them. Throws std::runtime_error on malformed data.
+void meshopt_decode(uint8_t *destination,
+                    size_t count,
+                    size_t stride,
+                    const uint8_t *source,
+                    size_t size,
+                    MeshoptMode mode,
+                    MeshoptFilter filter);
@@ -0,0 +1,331 @@
+#include "mipmap.hpp"
+#include "block_compression.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define MIPMAP_SSE2
+#include <emmintrin.h>
+#endif
+
+int mip_level_count(int width, int height) {
+  int count = 1;
+  while (width > 1 || height > 1) {
+    width = std::max(width / 2, 1);
+    height = std::max(height / 2, 1);
+    count++;
+  }
+  return count;
+}
+
+namespace {
+size_t component_size(GLenum type) {
+  switch (type) {
+  case GL_UNSIGNED_BYTE:
+    return 1;
+  case GL_UNSIGNED_SHORT:
+    return 2;
+  case GL_FLOAT:
+    return 4;
+  default:
+    throw std::runtime_error("unsupported texel type for mip chain");
+  }
+}
+
+float srgb_to_linear(float v) {
+  return v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+}
+
+float linear_to_srgb(float v) {
+  return v <= 0.0031308f ? v * 12.92f
+                         : 1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f;
+}
+
+// converts stored texels to four linear floats and back
+class TexelCodec {
+public:
+  TexelCodec(GLenum type, int channels, bool srgb)
+      : _type(type), _channels(channels), _srgb(srgb && type != GL_FLOAT) {
+    // the last channel of two and four channel images is alpha
+    _color_channels = channels == 2 || channels == 4 ? channels - 1 : channels;
+    if (type == GL_UNSIGNED_BYTE) {
+      for (int i = 0; i < 256; i++) {
+        _unorm[i] = (float)i / 255.0f;
+        _srgb_unorm[i] = srgb_to_linear(_unorm[i]);
+      }
+      // encoding picks the closest byte by searching the decoded values
+      for (int i = 0; i < 255; i++) {
+        _srgb_midpoints[i] = (_srgb_unorm[i] + _srgb_unorm[i + 1]) * 0.5f;
+      }
+    }
+  }
+
+  size_t texel_size() const {
+    return component_size(_type) * _channels;
+  }
+
+  void decode(const uint8_t *texel, float *out) const {
+    for (int c = 0; c < 4; c++) {
+      out[c] = c < _channels ? decode_component(texel, c) : 0.0f;
+    }
+  }
+
+  void encode(const float *in, uint8_t *texel) const {
+    for (int c = 0; c < _channels; c++) {
+      auto srgb = _srgb && c < _color_channels;
+      switch (_type) {
+      case GL_UNSIGNED_BYTE: {
+        auto v = std::clamp(in[c], 0.0f, 1.0f);
+        texel[c] = srgb ? (uint8_t)(std::upper_bound(_srgb_midpoints,
+                                                     _srgb_midpoints + 255,
+                                                     v) -
+                                    _srgb_midpoints)
+                        : (uint8_t)std::lround(v * 255.0f);
+        break;
+      }
+      case GL_UNSIGNED_SHORT: {
+        auto v = std::clamp(in[c], 0.0f, 1.0f);
+        reinterpret_cast<uint16_t *>(texel)[c] =
+            (uint16_t)std::lround((srgb ? linear_to_srgb(v) : v) * 65535.0f);
+        break;
+      }
+      default:
+        reinterpret_cast<float *>(texel)[c] = in[c];
+        break;
+      }
+    }
+  }
+
+private:
+  float decode_component(const uint8_t *texel, int c) const {
+    auto srgb = _srgb && c < _color_channels;
+    switch (_type) {
+    case GL_UNSIGNED_BYTE:
+      return srgb ? _srgb_unorm[texel[c]] : _unorm[texel[c]];
+    case GL_UNSIGNED_SHORT: {
+      auto v = (float)reinterpret_cast<const uint16_t *>(texel)[c] / 65535.0f;
+      return srgb ? srgb_to_linear(v) : v;
+    }
+    default:
+      return reinterpret_cast<const float *>(texel)[c];
+    }
+  }
+
+  GLenum _type;
+  int _channels;
+  int _color_channels;
+  bool _srgb;
+  float _unorm[256];
+  float _srgb_unorm[256];
+  float _srgb_midpoints[255];
+};
+
+// 2x2 box filter of two source rows of four float texels, odd edges clamp to
+// the last texel
+void average_rows(const float *row0,
+                  const float *row1,
+                  int src_width,
+                  float *dst,
+                  int dst_width) {
+  for (int x = 0; x < dst_width; x++) {
+    int x0 = std::min(x * 2, src_width - 1) * 4;
+    int x1 = std::min(x * 2 + 1, src_width - 1) * 4;
+#ifdef MIPMAP_SSE2
+    auto sum = _mm_add_ps(
+        _mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)),
+        _mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+    _mm_storeu_ps(dst + x * 4, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+    for (int c = 0; c < 4; c++) {
+      dst[x * 4 + c] =
+          (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]) * 0.25f;
+    }
+#endif
+  }
+}
+
+// averaged normals are shorter than 1, which darkens lighting in the distance
+void renormalize(float *texels, int count) {
+  for (int i = 0; i < count; i++) {
+    auto texel = texels + i * 4;
+    float n[3];
+    float length = 0.0f;
+    for (int c = 0; c < 3; c++) {
+      n[c] = texel[c] * 2.0f - 1.0f;
+      length += n[c] * n[c];
+    }
+    if (length < 1e-12f) {
+      continue;
+    }
+    length = std::sqrt(length);
+    for (int c = 0; c < 3; c++) {
+      texel[c] = n[c] / length * 0.5f + 0.5f;
+    }
+  }
+}
+
+float alpha_coverage(const std::vector<float> &texels,
+                     float cutoff,
+                     float scale) {
+  size_t passed = 0;
+  for (size_t i = 3; i < texels.size(); i += 4) {
+    if (texels[i] * scale >= cutoff) {
+      passed++;
+    }
+  }
+  return (float)passed / (float)(texels.size() / 4);
+}
+
+// alpha scale that brings the coverage of a level closest to the target
+float alpha_coverage_scale(const std::vector<float> &texels,
+                           float cutoff,
+                           float target) {
+  float low = 0.0f, high = 8.0f;
+  for (int i = 0; i < 12; i++) {
+    auto mid = (low + high) * 0.5f;
+    if (alpha_coverage(texels, cutoff, mid) < target) {
+      low = mid;
+    } else {
+      high = mid;
+    }
+  }
+  // coverage is a step function, take the closer side of the step
+  auto low_error = std::abs(alpha_coverage(texels, cutoff, low) - target);
+  auto high_error = std::abs(alpha_coverage(texels, cutoff, high) - target);
+  return low_error < high_error ? low : high;
+}
+
+// split rows into tasks large enough to amortize scheduling
+void parallel_rows(int rows, const std::function<void(int, int)> &func) {
+  const int rows_per_task = 16;
+  auto tasks = (size_t)((rows + rows_per_task - 1) / rows_per_task);
+  ThreadPool::global().parallel_for(tasks, [&](size_t task) {
+    auto begin = (int)task * rows_per_task;
+    func(begin, std::min(begin + rows_per_task, rows));
+  });
+}
+} // namespace
+
+MipChain mip_chain_layout(GLenum type,
+                          int channels,
+                          GLenum compressed_format,
+                          int width,
+                          int height,
+                          int level_count) {
+  MipChain chain{};
+  chain.type = type;
+  chain.channels = channels;
+  chain.compressed_format = compressed_format;
+
+  size_t offset = 0;
+  for (int i = 0; i < level_count; i++) {
+    MipLevel level{};
+    level.width = std::max(width >> i, 1);
+    level.height = std::max(height >> i, 1);
+    level.offset = offset;
+    if (compressed_format == GL_NONE) {
+      level.size =
+          component_size(type) * channels * level.width * level.height;
+    } else {
+      level.size = compressed_block_bytes(compressed_format) *
+                   ((level.width + 3) / 4) * ((level.height + 3) / 4);
+    }
+    offset += level.size;
+    chain.levels.push_back(level);
+  }
+  return chain;
+}
+
+MipChain build_mip_chain(const uint8_t *data,
+                         GLenum type,
+                         int width,
+                         int height,
+                         int channels,
+                         MipSettings *settings) {
+  MipSettings default_settings{};
+  if (settings == nullptr) {
+    settings = &default_settings;
+  }
+
+  int count = mip_level_count(width, height);
+  auto chain = mip_chain_layout(type, channels, GL_NONE, width, height, count);
+  chain.data.resize(chain.size());
+  std::memcpy(chain.data.data(), data, chain.levels[0].size);
+  if (count == 1) {
+    return chain;
+  }
+
+  TexelCodec codec(type, channels, settings->srgb);
+  auto texel_size = codec.texel_size();
+  auto keep_coverage = settings->preserve_alpha_coverage && channels == 4;
+  float target_coverage = 0.0f;
+  if (keep_coverage) {
+    size_t passed = 0;
+    float texel[4];
+    for (size_t i = 0; i < (size_t)width * height; i++) {
+      codec.decode(data + i * texel_size, texel);
+      if (texel[3] >= settings->alpha_cutoff) {
+        passed++;
+      }
+    }
+    target_coverage = (float)passed / (float)((size_t)width * height);
+  }
+
+  // the previous and current level as linear floats, level 0 is decoded
+  // row by row instead
+  std::vector<float> src, dst;
+  for (int i = 1; i < count; i++) {
+    auto &src_level = chain.levels[i - 1];
+    auto &level = chain.levels[i];
+    dst.resize((size_t)level.width * level.height * 4);
+    parallel_rows(level.height, [&](int begin, int end) {
+      std::vector<float> rows[2];
+      for (int y = begin; y < end; y++) {
+        int src_y[] = {std::min(y * 2, src_level.height - 1),
+                       std::min(y * 2 + 1, src_level.height - 1)};
+        const float *row[2];
+        for (int r = 0; r < 2; r++) {
+          if (i == 1) {
+            rows[r].resize((size_t)src_level.width * 4);
+            auto src_row = data + (size_t)src_y[r] * width * texel_size;
+            for (int x = 0; x < src_level.width; x++) {
+              codec.decode(src_row + x * texel_size, &rows[r][x * 4]);
+            }
+            row[r] = rows[r].data();
+          } else {
+            row[r] = src.data() + (size_t)src_y[r] * src_level.width * 4;
+          }
+        }
+        auto dst_row = dst.data() + (size_t)y * level.width * 4;
+        average_rows(row[0], row[1], src_level.width, dst_row, level.width);
+        if (settings->normal_map) {
+          renormalize(dst_row, level.width);
+        }
+      }
+    });
+
+    // the scale only applies to the stored level, each level is filtered
+    // from the unscaled one above
+    auto alpha_scale =
+        keep_coverage ? alpha_coverage_scale(
+                            dst, settings->alpha_cutoff, target_coverage)
+                      : 1.0f;
+    auto dst_data = chain.data.data() + level.offset;
+    parallel_rows(level.height, [&](int begin, int end) {
+      for (int y = begin; y < end; y++) {
+        for (int x = 0; x < level.width; x++) {
+          auto index = (size_t)y * level.width + x;
+          float texel[4];
+          std::copy(&dst[index * 4], &dst[index * 4] + 4, texel);
+          texel[3] *= alpha_scale;
+          codec.encode(texel, dst_data + index * texel_size);
+        }
+      }
+    });
+    std::swap(src, dst);
+  }
+  return chain;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <cstdint>
+#include <vector>
+
+struct MipLevel {
+  int width;
+  int height;
+  size_t offset;
+  size_t size;
+};
+
+// all levels of a texture down to 1x1 packed into one allocation, level 0
+// first
+struct MipChain {
+  GLenum type;
+  int channels;
+  // GL_NONE for plain texels, otherwise the levels hold 4x4 blocks of this
+  // compressed format
+  GLenum compressed_format = GL_NONE;
+  std::vector<MipLevel> levels;
+  std::vector<uint8_t> data;
+
+  const uint8_t *level_data(size_t level) const {
+    return data.data() + levels[level].offset;
+  }
+
+  // bytes of all levels
+  size_t size() const {
+    return levels.back().offset + levels.back().size;
+  }
+
+  // rows of blocks for compressed chains, rows of texels otherwise
+  int row_count(size_t level) const {
+    auto height = levels[level].height;
+    return compressed_format == GL_NONE ? height : (height + 3) / 4;
+  }
+
+  size_t row_size(size_t level) const {
+    return levels[level].size / row_count(level);
+  }
+};
+
+struct MipSettings {
+  // color channels are sRGB encoded, they are filtered in linear space
+  bool srgb = false;
+  // texels are tangent space normals in [0, 1], renormalized on every level
+  bool normal_map = false;
+  // Scale alpha of smaller levels so the same fraction of texels passes
+  // alpha_cutoff as on level 0. Keeps alpha tested foliage from thinning out
+  // in the distance.
+  bool preserve_alpha_coverage = false;
+  float alpha_cutoff = 0.5f;
+};
+
+int mip_level_count(int width, int height);
+
+// levels of a chain without allocating its data
+MipChain mip_chain_layout(GLenum type,
+                          int channels,
+                          GLenum compressed_format,
+                          int width,
+                          int height,
+                          int level_count);
+
+// Data is tightly packed texels of GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT or
+// GL_FLOAT. Every level is a 2x2 box filter of the one above, computed in
+// linear float precision on the global thread pool.
+MipChain build_mip_chain(const uint8_t *data,
+                         GLenum type,
+                         int width,
+                         int height,
+                         int channels,
+                         MipSettings *settings = nullptr);
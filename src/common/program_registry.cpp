@@ -0,0 +1,51 @@
+#include "program_registry.hpp"
+
+ProgramRegistry::ProgramRegistry(ProgramReloader *reloader)
+    : _reloader(reloader) {}
+
+ProgramRegistry::Entry &
+ProgramRegistry::entry(const fs::path &vert_file,
+                       const fs::path &frag_file,
+                       const std::vector<std::string> &defines) {
+  // paths and defines can not contain line breaks
+  auto key = vert_file.generic_string() + '\n' + frag_file.generic_string();
+  for (auto &define : defines) {
+    key += '\n' + define;
+  }
+  auto &entry = _entries[key];
+  if (entry.build == nullptr && entry.program == nullptr) {
+    entry.build = ProgramBuild::start_from_files(vert_file, frag_file, defines);
+  }
+  return entry;
+}
+
+void ProgramRegistry::request(const fs::path &vert_file,
+                              const fs::path &frag_file,
+                              const std::vector<std::string> &defines) {
+  entry(vert_file, frag_file, defines);
+}
+
+std::shared_ptr<Program>
+ProgramRegistry::get(const fs::path &vert_file,
+                     const fs::path &frag_file,
+                     const std::vector<std::string> &defines) {
+  auto &entry = this->entry(vert_file, frag_file, defines);
+  if (entry.program != nullptr) {
+    _shared_count++;
+    return entry.program;
+  }
+  auto build = std::move(entry.build);
+  entry.program = build->take();
+  if (_reloader != nullptr) {
+    _reloader->watch(entry.program);
+  }
+  return entry.program;
+}
+
+size_t ProgramRegistry::program_count() const {
+  return _entries.size();
+}
+
+size_t ProgramRegistry::shared_count() const {
+  return _shared_count;
+}
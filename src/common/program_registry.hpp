@@ -0,0 +1,46 @@
+#pragma once
+
+#include "program_reloader.hpp"
+#include "shader.hpp"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Hands out one shared program per stage files and defines, so materials
+// using the same shaders compile and link them once and share their cached
+// locations and bindings. Programs stay alive with the registry.
+class ProgramRegistry {
+public:
+  // programs are watched by reloader when it is given
+  explicit ProgramRegistry(ProgramReloader *reloader = nullptr);
+
+  // Start building a program unless it is built or building already.
+  // Programs requested before any of them is taken build in parallel.
+  void request(const fs::path &vert_file,
+               const fs::path &frag_file,
+               const std::vector<std::string> &defines = {});
+  // the shared program, waits for its build when it is not done
+  std::shared_ptr<Program> get(const fs::path &vert_file,
+                               const fs::path &frag_file,
+                               const std::vector<std::string> &defines = {});
+
+  // distinct programs built
+  size_t program_count() const;
+  // gets served with a program built before
+  size_t shared_count() const;
+
+private:
+  struct Entry {
+    std::unique_ptr<ProgramBuild> build;
+    std::shared_ptr<Program> program;
+  };
+
+  Entry &entry(const fs::path &vert_file,
+               const fs::path &frag_file,
+               const std::vector<std::string> &defines);
+
+  ProgramReloader *_reloader;
+  std::unordered_map<std::string, Entry> _entries;
+  size_t _shared_count = 0;
+};
@@ -0,0 +1,88 @@
+#include "program_reloader.hpp"
+#include <algorithm>
+#include <iostream>
+
+namespace {
+// the time of missing files never matches an existing one
+fs::file_time_type write_time(const fs::path &name) {
+  std::error_code ec;
+  auto time = fs::last_write_time(Data::resolve(name), ec);
+  return ec ? fs::file_time_type::min() : time;
+}
+} // namespace
+
+ProgramReloader::ProgramReloader(std::chrono::milliseconds poll_interval)
+    : _poll_interval(poll_interval) {}
+
+void ProgramReloader::watch(const std::shared_ptr<Program> &program) {
+  if (program->vert_file().empty()) {
+    return;
+  }
+  for (auto &watch : _watches) {
+    if (watch.program.lock() == program) {
+      return;
+    }
+  }
+  // the times are filled in by files_changed
+  Watch watch{program, {}, {}, nullptr};
+  files_changed(watch);
+  _watches.push_back(std::move(watch));
+}
+
+bool ProgramReloader::files_changed(Watch &watch) {
+  auto program = watch.program.lock();
+  auto vert_time = write_time(program->vert_file());
+  auto frag_time = write_time(program->frag_file());
+  bool changed = vert_time != watch.vert_time || frag_time != watch.frag_time;
+  watch.vert_time = vert_time;
+  watch.frag_time = frag_time;
+  return changed;
+}
+
+void ProgramReloader::update() {
+  _watches.erase(std::remove_if(_watches.begin(),
+                                _watches.end(),
+                                [](const Watch &watch) {
+                                  return watch.program.expired();
+                                }),
+                 _watches.end());
+
+  for (auto &watch : _watches) {
+    if (watch.build == nullptr || !watch.build->done()) {
+      continue;
+    }
+    auto program = watch.program.lock();
+    try {
+      auto rebuilt = watch.build->take();
+      program->replace(*rebuilt);
+      std::cout << "reloaded " << program->vert_file().string() << " "
+                << program->frag_file().string() << std::endl;
+    } catch (std::exception &e) {
+      std::cout << "warn: failed to reload program: " << e.what()
+                << std::endl;
+    }
+    watch.build.reset();
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  if (now < _next_poll) {
+    return;
+  }
+  _next_poll = now + _poll_interval;
+  for (auto &watch : _watches) {
+    // a file changing again while building restarts the build
+    if (!files_changed(watch)) {
+      continue;
+    }
+    auto program = watch.program.lock();
+    try {
+      watch.build = ProgramBuild::start_from_files(
+          program->vert_file(), program->frag_file(), program->defines());
+    } catch (std::exception &e) {
+      // editors may replace files by deleting them first
+      std::cout << "warn: failed to reload program: " << e.what()
+                << std::endl;
+      watch.build.reset();
+    }
+  }
+}
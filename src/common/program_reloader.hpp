@@ -0,0 +1,39 @@
+#pragma once
+
+#include "shader.hpp"
+#include <chrono>
+#include <memory>
+#include <vector>
+
+// Rebuilds programs whose stage files in the data folder changed and swaps
+// them into the same Program objects once linked, so users keep their
+// pointers and only check Program::generation. Builds are polled, a frame
+// never waits on the driver where KHR_parallel_shader_compile is supported.
+// Programs failing to build keep their last version.
+class ProgramReloader {
+public:
+  explicit ProgramReloader(
+      std::chrono::milliseconds poll_interval = std::chrono::milliseconds(250));
+
+  // Programs made from sources are ignored. Programs are dropped once all
+  // other owners released them.
+  void watch(const std::shared_ptr<Program> &program);
+
+  // call once per frame on the GL thread
+  void update();
+
+private:
+  struct Watch {
+    std::weak_ptr<Program> program;
+    fs::file_time_type vert_time;
+    fs::file_time_type frag_time;
+    std::unique_ptr<ProgramBuild> build;
+  };
+
+  // whether the stage files changed since last time, updates the times
+  static bool files_changed(Watch &watch);
+
+  std::chrono::milliseconds _poll_interval;
+  std::chrono::steady_clock::time_point _next_poll;
+  std::vector<Watch> _watches;
+};
@@ -0,0 +1,123 @@
+#include "render_queue.hpp"
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+const int pass_bits = 4;
+const int program_bits = 12;
+const int state_bits = 4;
+const int material_bits = 12;
+
+// float bits ordered like the floats they hold when compared as unsigned
+uint32_t sortable_depth(float depth) {
+  uint32_t bits;
+  std::memcpy(&bits, &depth, sizeof(bits));
+  return (bits & 0x80000000u) != 0 ? ~bits : bits | 0x80000000u;
+}
+
+StateChanges count_state_changes(const std::vector<DrawPacket> &packets) {
+  StateChanges changes{};
+  for (size_t i = 0; i < packets.size(); i++) {
+    auto &packet = packets[i];
+    auto *last = i > 0 ? &packets[i - 1] : nullptr;
+    changes.programs += last == nullptr || last->program != packet.program;
+    changes.states += last == nullptr || last->state != packet.state;
+    changes.materials += last == nullptr || last->material != packet.material;
+  }
+  return changes;
+}
+} // namespace
+
+void RenderQueue::clear() {
+  _packets.clear();
+  _sorted_packets.clear();
+  _program_ids.clear();
+  _state_ids.clear();
+  _material_ids.clear();
+}
+
+void RenderQueue::add(const DrawPacket &packet) {
+  if (packet.pass >= (1u << pass_bits)) {
+    throw std::runtime_error("render queue pass out of range");
+  }
+  _packets.push_back(packet);
+}
+
+uint32_t RenderQueue::compact_id(std::unordered_map<uint32_t, uint32_t> &ids,
+                                 uint32_t id,
+                                 int bits) {
+  auto it = ids.find(id);
+  if (it != ids.end()) {
+    return it->second;
+  }
+  // ids past the budget share the last one, which only costs sort quality
+  auto last = (1u << bits) - 1;
+  if (ids.size() >= last) {
+    return last;
+  }
+  auto compact = (uint32_t)ids.size();
+  ids.emplace(id, compact);
+  return compact;
+}
+
+uint64_t RenderQueue::sort_key(const DrawPacket &packet) {
+  uint64_t state_key =
+      (uint64_t)compact_id(_program_ids, packet.program, program_bits)
+      << (state_bits + material_bits);
+  state_key |= (uint64_t)compact_id(_state_ids, packet.state, state_bits)
+               << material_bits;
+  state_key |= compact_id(_material_ids, packet.material, material_bits);
+
+  uint64_t key = (uint64_t)packet.pass << (64 - pass_bits);
+  uint64_t depth = sortable_depth(packet.depth);
+  if (packet.back_to_front) {
+    return key | (uint64_t)(uint32_t)~depth << 28 | state_key;
+  }
+  return key | state_key << 32 | depth;
+}
+
+void RenderQueue::sort() {
+  _entries.resize(_packets.size());
+  for (size_t i = 0; i < _packets.size(); i++) {
+    _entries[i] = SortEntry{sort_key(_packets[i]), (uint32_t)i};
+  }
+
+  // least significant byte first, each pass is stable
+  _scratch.resize(_entries.size());
+  for (int shift = 0; shift < 64 && !_entries.empty(); shift += 8) {
+    size_t offsets[256] = {};
+    for (auto &entry : _entries) {
+      offsets[(entry.key >> shift) & 0xff]++;
+    }
+    // nothing to reorder when all keys share the byte
+    if (offsets[(_entries[0].key >> shift) & 0xff] == _entries.size()) {
+      continue;
+    }
+    size_t offset = 0;
+    for (auto &count : offsets) {
+      auto bucket_size = count;
+      count = offset;
+      offset += bucket_size;
+    }
+    for (auto &entry : _entries) {
+      _scratch[offsets[(entry.key >> shift) & 0xff]++] = entry;
+    }
+    _entries.swap(_scratch);
+  }
+
+  _sorted_packets.resize(_entries.size());
+  for (size_t i = 0; i < _entries.size(); i++) {
+    _sorted_packets[i] = _packets[_entries[i].packet];
+  }
+  _stats.submitted = count_state_changes(_packets);
+  _stats.sorted = count_state_changes(_sorted_packets);
+  _packets.swap(_sorted_packets);
+}
+
+const std::vector<DrawPacket> &RenderQueue::packets() const {
+  return _packets;
+}
+
+const RenderQueueStats &RenderQueue::stats() const {
+  return _stats;
+}
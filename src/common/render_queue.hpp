@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+struct DrawPacket {
+  // passes draw in increasing order, at most 16
+  uint32_t pass = 0;
+  // For blended passes. Otherwise packets are grouped by program, state and
+  // material and drawn front to back within a group.
+  bool back_to_front = false;
+  // any ids, packets with equal ids share the state they stand for
+  uint32_t program = 0;
+  // fixed function state like face culling
+  uint32_t state = 0;
+  uint32_t material = 0;
+  // distance from the camera
+  float depth = 0.0f;
+  // what the caller draws, e.g. an index into a list of its own
+  uint32_t item = 0;
+};
+
+// changes between consecutive packets, the first packet changes everything
+struct StateChanges {
+  size_t programs = 0;
+  size_t states = 0;
+  size_t materials = 0;
+};
+
+struct RenderQueueStats {
+  StateChanges submitted;
+  StateChanges sorted;
+};
+
+// Collects draw packets of a frame and orders them by 64-bit sort keys to
+// avoid state changes. Keys are, from the most significant bits, the pass,
+// then program, state, material and depth, or depth first for packets drawn
+// back to front.
+class RenderQueue {
+public:
+  void clear();
+  void add(const DrawPacket &packet);
+  // radix sort by key, packets of equal keys keep their order
+  void sort();
+
+  // in submission order until sorted
+  const std::vector<DrawPacket> &packets() const;
+  // of the last sort
+  const RenderQueueStats &stats() const;
+
+private:
+  struct SortEntry {
+    uint64_t key;
+    uint32_t packet;
+  };
+
+  // compact ids of bits bits in the order of first use, the ones that do
+  // not fit all get the largest
+  static uint32_t compact_id(std::unordered_map<uint32_t, uint32_t> &ids,
+                             uint32_t id,
+                             int bits);
+  uint64_t sort_key(const DrawPacket &packet);
+
+  std::vector<DrawPacket> _packets;
+  std::vector<DrawPacket> _sorted_packets;
+  std::vector<SortEntry> _entries;
+  std::vector<SortEntry> _scratch;
+  std::unordered_map<uint32_t, uint32_t> _program_ids;
+  std::unordered_map<uint32_t, uint32_t> _state_ids;
+  std::unordered_map<uint32_t, uint32_t> _material_ids;
+  RenderQueueStats _stats{};
+};
@@ -1,14 +1,25 @@
 #include "shader.hpp"
+#include "utils.hpp"
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
 #include <optional>
 #include <sstream>
 #include <stdexcept>
+#include <utility>
 #include <vector>
 
-static GLuint compile_shader(const char *text, GLenum type, const char *name) {
+// length < 0 means text is null terminated
+static GLuint start_compile(const char *text, GLint length, GLenum type) {
   GLuint shader = glCreateShader(type);
-  glShaderSource(shader, 1, &text, NULL);
+  glShaderSource(shader, 1, &text, length < 0 ? NULL : &length);
   glCompileShader(shader);
+  return shader;
+}
 
+// blocks until the shader is compiled
+static void check_compiled(GLuint shader, const char *name) {
   GLint is_compiled = 0;
   glGetShaderiv(shader, GL_COMPILE_STATUS, &is_compiled);
   if (is_compiled == GL_FALSE) {
@@ -22,21 +33,34 @@ static GLuint compile_shader(const char *text, GLenum type, const char *name) {
     std::stringstream ss;
     ss << "failed to compile shader \""
        << (name == nullptr ? "<unknown>" : name) << "\": " << error_log.data();
+    throw std::runtime_error(ss.str());
+  }
+}
 
+static GLuint compile_shader(const char *text,
+                             GLint length,
+                             GLenum type,
+                             const char *name) {
+  GLuint shader = start_compile(text, length, type);
+  try {
+    check_compiled(shader, name);
+  } catch (std::exception &) {
     glDeleteShader(shader); // Don't leak the shader.
-    throw std::runtime_error(ss.str());
+    throw;
   }
   return shader;
 }
 
 Shader::Shader(const char *text, GLenum stage, const char *name) {
-  _id = compile_shader(text, stage, name);
+  _id = compile_shader(text, -1, stage, name);
 }
 
 Shader::Shader(const fs::path &name, GLenum stage) {
-  auto data = Data::load(name);
-  data.push_back(0);
-  _id = compile_shader((const char *)data.data(), stage, name.string().c_str());
+  auto file = Data::map(name);
+  _id = compile_shader((const char *)file.data(),
+                       (GLint)file.size(),
+                       stage,
+                       name.string().c_str());
 }
 
 Shader::~Shader() {
@@ -47,13 +71,23 @@ GLuint Shader::get() const {
   return _id;
 }
 
-static GLuint link_program(const GLuint *shaders, uint32_t shader_count) {
+// retrievable programs can be read back with glGetProgramBinary
+static GLuint start_link(const GLuint *shaders,
+                         uint32_t shader_count,
+                         bool retrievable) {
   GLuint program = glCreateProgram();
   for (uint32_t i = 0; i < shader_count; i++) {
     glAttachShader(program, shaders[i]);
   }
+  if (retrievable) {
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
   glLinkProgram(program);
+  return program;
+}
 
+// blocks until the program is linked
+static void check_linked(GLuint program) {
   int success;
   // check for linking errors
   glGetProgramiv(program, GL_LINK_STATUS, &success);
@@ -65,16 +99,168 @@ static GLuint link_program(const GLuint *shaders, uint32_t shader_count) {
 
     std::stringstream ss;
     ss << "failed to link program: " << error_log.data();
-    glDeleteProgram(program);
     throw std::runtime_error(ss.str());
   }
+}
+
+static GLuint link_program(const GLuint *shaders, uint32_t shader_count) {
+  GLuint program = start_link(shaders, shader_count, false);
+  try {
+    check_linked(program);
+  } catch (std::exception &) {
+    glDeleteProgram(program);
+    throw;
+  }
   return program;
 }
 
+namespace {
+// bump whenever the layout of binary files changes
+const uint32_t BINARY_VERSION = 1;
+const char BINARY_MAGIC[8] = {'O', 'G', 'L', 'P', 'R', 'O', 'G', 'B'};
+
+// followed by size bytes of program binary
+struct BinaryHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t format;
+  uint64_t key;
+  uint64_t size;
+};
+
+// text with "#define <define>" lines inserted after its #version line, which
+// has to come before anything but comments and white space
+std::string add_defines(const char *text,
+                        size_t length,
+                        const std::vector<std::string> &defines) {
+  std::string source(text, length);
+  if (defines.empty()) {
+    return source;
+  }
+  size_t pos = 0;
+  auto version = source.find("#version");
+  if (version != std::string::npos) {
+    pos = source.find('\n', version);
+    pos = pos == std::string::npos ? source.size() : pos + 1;
+  }
+  std::string block = pos == source.size() ? "\n" : "";
+  for (auto &define : defines) {
+    block += "#define " + define + "\n";
+  }
+  return source.insert(pos, block);
+}
+
+bool parallel_compile_supported() {
+  return GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+}
+
+bool binary_cache_supported() {
+  if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary) {
+    return false;
+  }
+  GLint format_count = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+  return format_count > 0;
+}
+
+// binaries are only loaded by the driver that linked them
+uint64_t driver_hash() {
+  uint64_t hash = 0;
+  for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+    auto str = (const char *)glGetString(name);
+    if (str != nullptr) {
+      hash = hash_bytes(str, std::strlen(str), hash);
+    }
+  }
+  return hash;
+}
+
+fs::path binary_file(uint64_t key) {
+  std::stringstream ss;
+  ss << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+  return Data::cache_path() / "programs" / ss.str();
+}
+
+// program linked from the binary stored under key, 0 if there is none
+GLuint load_binary(uint64_t key) {
+  auto path = binary_file(key);
+  std::error_code ec;
+  if (!fs::exists(path, ec)) {
+    return 0;
+  }
+  MappedFile file;
+  try {
+    file = MappedFile(path);
+  } catch (std::exception &) {
+    return 0;
+  }
+  BinaryHeader header{};
+  if (file.size() < sizeof(header)) {
+    return 0;
+  }
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (std::memcmp(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC)) != 0 ||
+      header.version != BINARY_VERSION || header.key != key ||
+      header.size != file.size() - sizeof(header)) {
+    return 0;
+  }
+
+  GLuint program = glCreateProgram();
+  glProgramBinary(program,
+                  header.format,
+                  file.data() + sizeof(header),
+                  (GLsizei)header.size);
+  GLint success = 0;
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
+  if (!success) {
+    // drivers reject binaries of other builds even when their version string
+    // stays the same, the binary is replaced after compiling from source
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+void store_binary(uint64_t key, GLuint program) {
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) {
+    return;
+  }
+  std::vector<uint8_t> binary(length);
+  GLenum format{};
+  glGetProgramBinary(program, length, &length, &format, binary.data());
+
+  BinaryHeader header{};
+  std::memcpy(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+  header.version = BINARY_VERSION;
+  header.format = format;
+  header.key = key;
+  header.size = (uint64_t)length;
+
+  auto path = binary_file(key);
+  fs::create_directories(path.parent_path());
+  auto tmp_path = path;
+  tmp_path += ".tmp";
+  {
+    std::ofstream ofs(tmp_path, std::ios::binary | std::ios::trunc);
+    ofs.write((const char *)&header, sizeof(header));
+    ofs.write((const char *)binary.data(), length);
+    ofs.close();
+    if (!ofs) {
+      throw std::runtime_error("failed to write " + tmp_path.string());
+    }
+  }
+  fs::rename(tmp_path, path);
+}
+} // namespace
+
 Program::Program(const GLuint *shaders, uint32_t count) {
   _id = link_program(shaders, count);
 }
 
+Program::Program(GLuint id) : _id(id) {}
+
 Program::~Program() {
   glDeleteProgram(_id);
 }
@@ -83,22 +269,194 @@ GLuint Program::get() const {
   return _id;
 }
 
-std::unique_ptr<Program> Program::create_from_source(const char *vert_source,
-                                                     const char *frag_source) {
-  auto vert_shader =
-      std::make_unique<Shader>(vert_source, GL_VERTEX_SHADER, "vert");
-  auto frag_shader =
-      std::make_unique<Shader>(frag_source, GL_FRAGMENT_SHADER, "frag");
-  GLuint shaders[] = {vert_shader->get(), frag_shader->get()};
+const fs::path &Program::vert_file() const {
+  return _vert_file;
+}
+
+const fs::path &Program::frag_file() const {
+  return _frag_file;
+}
 
-  return std::make_unique<Program>(shaders, 2);
+const std::vector<std::string> &Program::defines() const {
+  return _defines;
 }
 
-std::unique_ptr<Program> Program::create_from_files(const fs::path &vert_file,
-                                                    const fs::path &frag_file) {
-  auto vert_shader = std::make_unique<Shader>(vert_file, GL_VERTEX_SHADER);
-  auto frag_shader = std::make_unique<Shader>(frag_file, GL_FRAGMENT_SHADER);
-  GLuint shaders[] = {vert_shader->get(), frag_shader->get()};
+GLint Program::uniform_location(const std::string &name) {
+  auto it = _uniform_locations.find(name);
+  if (it == _uniform_locations.end()) {
+    it = _uniform_locations
+             .emplace(name, glGetUniformLocation(_id, name.c_str()))
+             .first;
+  }
+  return it->second;
+}
+
+void Program::bind_uniform_block(const std::string &name, GLuint binding) {
+  auto added = _block_bindings.emplace(name, binding);
+  if (!added.second && added.first->second == binding) {
+    return;
+  }
+  added.first->second = binding;
+  GLuint index = glGetUniformBlockIndex(_id, name.c_str());
+  if (index != GL_INVALID_INDEX) {
+    glUniformBlockBinding(_id, index, binding);
+  }
+}
+
+void Program::bind_sampler(const std::string &name, GLint unit) {
+  auto added = _sampler_units.emplace(name, unit);
+  if (!added.second && added.first->second == unit) {
+    return;
+  }
+  added.first->second = unit;
+  // GL 3.3 only sets uniforms of the current program
+  GLint current = 0;
+  glGetIntegerv(GL_CURRENT_PROGRAM, &current);
+  glUseProgram(_id);
+  glUniform1i(uniform_location(name), unit);
+  glUseProgram(current);
+}
+
+void Program::apply_bindings() {
+  for (auto &[name, binding] : _block_bindings) {
+    GLuint index = glGetUniformBlockIndex(_id, name.c_str());
+    if (index != GL_INVALID_INDEX) {
+      glUniformBlockBinding(_id, index, binding);
+    }
+  }
+  if (_sampler_units.empty()) {
+    return;
+  }
+  GLint current = 0;
+  glGetIntegerv(GL_CURRENT_PROGRAM, &current);
+  glUseProgram(_id);
+  for (auto &[name, unit] : _sampler_units) {
+    glUniform1i(uniform_location(name), unit);
+  }
+  glUseProgram(current);
+}
+
+void Program::replace(Program &other) {
+  std::swap(_id, other._id);
+  _generation++;
+  _uniform_locations.clear();
+  apply_bindings();
+}
+
+uint32_t Program::generation() const {
+  return _generation;
+}
 
-  return std::make_unique<Program>(shaders, 2);
+std::unique_ptr<Program>
+Program::create_from_source(const char *vert_source,
+                            const char *frag_source,
+                            const std::vector<std::string> &defines) {
+  return ProgramBuild::start_from_source(vert_source, frag_source, defines)
+      ->take();
+}
+
+std::unique_ptr<Program>
+Program::create_from_files(const fs::path &vert_file,
+                           const fs::path &frag_file,
+                           const std::vector<std::string> &defines) {
+  return ProgramBuild::start_from_files(vert_file, frag_file, defines)->take();
+}
+
+std::unique_ptr<ProgramBuild>
+ProgramBuild::start_from_source(const char *vert_source,
+                                const char *frag_source,
+                                const std::vector<std::string> &defines) {
+  std::unique_ptr<ProgramBuild> build(new ProgramBuild());
+  build->_vert_name = "vert";
+  build->_frag_name = "frag";
+  build->_defines = defines;
+  build->start(add_defines(vert_source, std::strlen(vert_source), defines),
+               add_defines(frag_source, std::strlen(frag_source), defines));
+  return build;
+}
+
+std::unique_ptr<ProgramBuild>
+ProgramBuild::start_from_files(const fs::path &vert_file,
+                               const fs::path &frag_file,
+                               const std::vector<std::string> &defines) {
+  std::unique_ptr<ProgramBuild> build(new ProgramBuild());
+  build->_vert_name = vert_file.string();
+  build->_frag_name = frag_file.string();
+  build->_vert_file = vert_file;
+  build->_frag_file = frag_file;
+  build->_defines = defines;
+  auto vert = Data::map(vert_file);
+  auto frag = Data::map(frag_file);
+  build->start(add_defines((const char *)vert.data(), vert.size(), defines),
+               add_defines((const char *)frag.data(), frag.size(), defines));
+  return build;
+}
+
+ProgramBuild::~ProgramBuild() {
+  glDeleteShader(_vert);
+  glDeleteShader(_frag);
+  glDeleteProgram(_program);
+}
+
+void ProgramBuild::start(const std::string &vert_source,
+                         const std::string &frag_source) {
+  if (GLEW_KHR_parallel_shader_compile) {
+    // let the driver pick the number of threads
+    glMaxShaderCompilerThreadsKHR(0xffffffff);
+  } else if (GLEW_ARB_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsARB(0xffffffff);
+  }
+
+  // the sources already contain the defines
+  _use_cache = binary_cache_supported();
+  if (_use_cache) {
+    _key = hash_bytes(vert_source.data(), vert_source.size(), driver_hash());
+    _key = hash_bytes(frag_source.data(), frag_source.size(), _key);
+    _program = load_binary(_key);
+    if (_program != 0) {
+      return;
+    }
+  }
+
+  _vert = start_compile(vert_source.c_str(), -1, GL_VERTEX_SHADER);
+  _frag = start_compile(frag_source.c_str(), -1, GL_FRAGMENT_SHADER);
+  GLuint shaders[] = {_vert, _frag};
+  _program = start_link(shaders, 2, _use_cache);
+}
+
+bool ProgramBuild::done() const {
+  if (_program == 0 || !parallel_compile_supported()) {
+    return true;
+  }
+  GLint completed = GL_FALSE;
+  glGetProgramiv(_program, GL_COMPLETION_STATUS_KHR, &completed);
+  return completed == GL_TRUE;
+}
+
+std::unique_ptr<Program> ProgramBuild::take() {
+  if (_program == 0) {
+    throw std::runtime_error("program build already taken");
+  }
+  std::unique_ptr<Program> program(new Program(std::exchange(_program, 0)));
+  program->_vert_file = _vert_file;
+  program->_frag_file = _frag_file;
+  program->_defines = _defines;
+  if (_vert == 0) {
+    // loaded from the binary cache
+    return program;
+  }
+
+  // a stage failing to compile fails the link, its log tells more
+  check_compiled(_vert, _vert_name.c_str());
+  check_compiled(_frag, _frag_name.c_str());
+  check_linked(program->get());
+  if (_use_cache) {
+    try {
+      store_binary(_key, program->get());
+    } catch (std::exception &e) {
+      std::cout << "warn: failed to cache program binary: " << e.what()
+                << std::endl;
+    }
+  }
+  return program;
 }
@@ -2,6 +2,10 @@
 
 #include "data.hpp"
 #include <GL/glew.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 class Shader {
 public:
@@ -20,14 +24,92 @@ public:
   Program(const GLuint *shaders, uint32_t count);
   ~Program();
 
-  static std::unique_ptr<Program> create_from_source(const char *vert_source,
-                                                     const char *frag_source);
-  static std::unique_ptr<Program> create_from_files(const fs::path &vert_file,
-                                                    const fs::path &frag_file);
+  // Programs made from sources are linked once per driver: the linked binary
+  // is kept in the cache folder and loaded on later runs. defines are
+  // inserted as "#define <define>" after the #version line of every stage.
+  static std::unique_ptr<Program>
+  create_from_source(const char *vert_source,
+                     const char *frag_source,
+                     const std::vector<std::string> &defines = {});
+  static std::unique_ptr<Program>
+  create_from_files(const fs::path &vert_file,
+                    const fs::path &frag_file,
+                    const std::vector<std::string> &defines = {});
 
   GLuint get() const;
 
+  // stage files in the data folder the program was made from, empty for
+  // programs made from sources
+  const fs::path &vert_file() const;
+  const fs::path &frag_file() const;
+  const std::vector<std::string> &defines() const;
+
+  // queried once and again after replace, -1 for inactive uniforms
+  GLint uniform_location(const std::string &name);
+  // Block bindings and sampler units are state of the program, they are set
+  // again after replace. Binding the same again does nothing.
+  void bind_uniform_block(const std::string &name, GLuint binding);
+  void bind_sampler(const std::string &name, GLint unit);
+
+  // Take over the linked program of other. Locations queried from the
+  // program before have to be queried again, generation tells when.
+  void replace(Program &other);
+  uint32_t generation() const;
+
 private:
-  void init(GLuint *shaders, uint32_t count);
+  friend class ProgramBuild;
+  explicit Program(GLuint id);
+  void apply_bindings();
+
   GLuint _id{};
-};
\ No newline at end of file
+  fs::path _vert_file;
+  fs::path _frag_file;
+  std::vector<std::string> _defines;
+  uint32_t _generation = 0;
+  std::unordered_map<std::string, GLint> _uniform_locations;
+  std::unordered_map<std::string, GLuint> _block_bindings;
+  std::unordered_map<std::string, GLint> _sampler_units;
+};
+
+// Compiles and links a program without waiting on the driver. Statuses are
+// only queried by take, so the builds of several programs started before
+// taking any of them run in parallel on drivers with
+// KHR_parallel_shader_compile. Without it done is always true and take
+// blocks until the program is linked.
+class ProgramBuild {
+public:
+  static std::unique_ptr<ProgramBuild>
+  start_from_source(const char *vert_source,
+                    const char *frag_source,
+                    const std::vector<std::string> &defines = {});
+  static std::unique_ptr<ProgramBuild>
+  start_from_files(const fs::path &vert_file,
+                   const fs::path &frag_file,
+                   const std::vector<std::string> &defines = {});
+  ~ProgramBuild();
+
+  ProgramBuild(const ProgramBuild &) = delete;
+  ProgramBuild &operator=(const ProgramBuild &) = delete;
+
+  // whether take returns without blocking
+  bool done() const;
+  // The linked program, throws std::runtime_error with the log of the
+  // failing stage. Can only be called once.
+  std::unique_ptr<Program> take();
+
+private:
+  ProgramBuild() = default;
+  void start(const std::string &vert_source, const std::string &frag_source);
+
+  std::string _vert_name;
+  std::string _frag_name;
+  fs::path _vert_file;
+  fs::path _frag_file;
+  std::vector<std::string> _defines;
+  // whether the linked binary is stored under key
+  bool _use_cache = false;
+  uint64_t _key{};
+  GLuint _vert{};
+  GLuint _frag{};
+  GLuint _program{};
+};
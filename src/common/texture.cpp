@@ -1,16 +1,18 @@
 #include "texture.hpp"
+#include "mipmap.hpp"
+#include <algorithm>
 #include <sstream>
 #include <stb_image.h>
 
 Texture2D::Texture2D(const fs::path &name, TextureSettings *settings) {
-  auto full_path = Data::resolve(name).string();
+  auto file = Data::map(name);
   stbi_set_flip_vertically_on_load(true);
   int width, height, channels;
-  unsigned char *data =
-      stbi_load(full_path.c_str(), &width, &height, &channels, 0);
+  unsigned char *data = stbi_load_from_memory(
+      file.data(), (int)file.size(), &width, &height, &channels, 0);
   if (!data) {
     std::stringstream ss;
-    ss << "failed to load image " << full_path;
+    ss << "failed to load image " << Data::resolve(name).string();
     throw std::runtime_error(ss.str());
   }
   init(data, GL_UNSIGNED_BYTE, width, height, channels, settings);
@@ -18,7 +20,25 @@ Texture2D::Texture2D(const fs::path &name, TextureSettings *settings) {
   stbi_image_free(data);
 }
 
-void Texture2D::init(uint8_t *data,
+namespace {
+int format_to_channels(GLenum format) {
+  switch (format) {
+  case GL_R:
+  case GL_RED:
+    return 1;
+  case GL_RG:
+    return 2;
+  case GL_RGB:
+    return 3;
+  case GL_RGBA:
+    return 4;
+  default:
+    return 0;
+  }
+}
+} // namespace
+
+void Texture2D::init(const uint8_t *data,
                      GLenum data_type,
                      int width,
                      int height,
@@ -27,17 +47,20 @@ void Texture2D::init(uint8_t *data,
                      TextureSettings *settings) {
   _width = width;
   _height = height;
-  TextureSettings default_settings{};
+  init_sampler(settings);
 
-  if (settings == nullptr) {
-    settings = &default_settings;
+  auto channels = format_to_channels(format);
+  if (data != nullptr && channels > 0 &&
+      (data_type == GL_UNSIGNED_BYTE || data_type == GL_UNSIGNED_SHORT ||
+       data_type == GL_FLOAT)) {
+    auto chain = build_mip_chain(data, data_type, width, height, channels);
+    init_levels(chain, chain.data.data(), internal_format);
+    return;
   }
-  glGenTextures(1, &_tex_id);
-  glBindTexture(GL_TEXTURE_2D, _tex_id);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, settings->wrap_s);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, settings->wrap_t);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, settings->min_filter);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, settings->max_filter);
+
+  // render targets have no texels to filter, only allocate the levels
+  _format = format;
+  _levels = mip_level_count(width, height);
   glTexImage2D(GL_TEXTURE_2D,
                0,
                internal_format,
@@ -50,12 +73,21 @@ void Texture2D::init(uint8_t *data,
   glGenerateMipmap(GL_TEXTURE_2D);
 }
 
-void Texture2D::init(uint8_t *data,
-                     GLenum data_type,
-                     int width,
-                     int height,
-                     int channels,
-                     TextureSettings *settings) {
+void Texture2D::init_sampler(TextureSettings *settings) {
+  TextureSettings default_settings{};
+
+  if (settings == nullptr) {
+    settings = &default_settings;
+  }
+  glGenTextures(1, &_tex_id);
+  glBindTexture(GL_TEXTURE_2D, _tex_id);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, settings->wrap_s);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, settings->wrap_t);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, settings->min_filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, settings->max_filter);
+}
+
+GLenum Texture2D::channels_to_format(int channels) {
   GLenum format = GL_RGBA;
   if (channels == 1) {
     format = GL_R;
@@ -66,10 +98,118 @@ void Texture2D::init(uint8_t *data,
   if (channels == 3) {
     format = GL_RGB;
   }
+  return format;
+}
+
+void Texture2D::init(const uint8_t *data,
+                     GLenum data_type,
+                     int width,
+                     int height,
+                     int channels,
+                     TextureSettings *settings) {
+  auto format = channels_to_format(channels);
   init(data, data_type, width, height, format, format, settings);
 }
 
-Texture2D::Texture2D(uint8_t *data,
+Texture2D::Texture2D(const MipChain &chain,
+                     const uint8_t *texels,
+                     TextureSettings *settings) {
+  init_sampler(settings);
+  init_levels(chain, texels, channels_to_format(chain.channels));
+}
+
+std::unique_ptr<Texture2D>
+Texture2D::create_streamed(const MipChain &chain, TextureSettings *settings) {
+  std::unique_ptr<Texture2D> texture(new Texture2D());
+  texture->init_sampler(settings);
+  texture->init_levels(
+      chain, nullptr, channels_to_format(chain.channels));
+  texture->set_base_level(texture->_levels - 1);
+  return texture;
+}
+
+void Texture2D::reallocate(const MipChain &chain, const uint8_t *texels) {
+  glBindTexture(GL_TEXTURE_2D, _tex_id);
+  init_levels(chain, texels, channels_to_format(chain.channels));
+  set_base_level(texels == nullptr ? _levels - 1 : 0);
+}
+
+void Texture2D::init_levels(const MipChain &chain,
+                            const uint8_t *texels,
+                            GLenum internal_format) {
+  _width = chain.levels[0].width;
+  _height = chain.levels[0].height;
+  _levels = (int)chain.levels.size();
+  _format = channels_to_format(chain.channels);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (int i = 0; i < _levels; i++) {
+    auto &level = chain.levels[i];
+    auto data = texels == nullptr ? nullptr : texels + level.offset;
+    if (chain.compressed_format != GL_NONE) {
+      glCompressedTexImage2D(GL_TEXTURE_2D,
+                             i,
+                             chain.compressed_format,
+                             level.width,
+                             level.height,
+                             0,
+                             (GLsizei)level.size,
+                             data);
+    } else {
+      glTexImage2D(GL_TEXTURE_2D,
+                   i,
+                   internal_format,
+                   level.width,
+                   level.height,
+                   0,
+                   _format,
+                   chain.type,
+                   data);
+    }
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, _levels - 1);
+}
+
+void Texture2D::upload_rows(const MipChain &chain,
+                            int level,
+                            int row,
+                            int row_count,
+                            const void *data) {
+  auto &mip = chain.levels[level];
+  glBindTexture(GL_TEXTURE_2D, _tex_id);
+  if (chain.compressed_format != GL_NONE) {
+    // rows are rows of 4x4 blocks, the last one may be cut off
+    auto y = row * 4;
+    glCompressedTexSubImage2D(GL_TEXTURE_2D,
+                              level,
+                              0,
+                              y,
+                              mip.width,
+                              std::min(row_count * 4, mip.height - y),
+                              chain.compressed_format,
+                              (GLsizei)(chain.row_size(level) * row_count),
+                              data);
+    return;
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexSubImage2D(GL_TEXTURE_2D,
+                  level,
+                  0,
+                  row,
+                  mip.width,
+                  row_count,
+                  _format,
+                  chain.type,
+                  data);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void Texture2D::set_base_level(int level) {
+  glBindTexture(GL_TEXTURE_2D, _tex_id);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+}
+
+Texture2D::Texture2D(const uint8_t *data,
                      GLenum data_type,
                      int width,
                      int height,
@@ -78,7 +218,7 @@ Texture2D::Texture2D(uint8_t *data,
   init(data, data_type, width, height, channels, settings);
 }
 
-Texture2D::Texture2D(uint8_t *data,
+Texture2D::Texture2D(const uint8_t *data,
                      GLenum data_type,
                      int width,
                      int height,
@@ -103,3 +243,7 @@ int Texture2D::width() const {
 int Texture2D::height() const {
   return _height;
 }
+
+int Texture2D::levels() const {
+  return _levels;
+}
@@ -1,8 +1,10 @@
 #pragma once
 
 #include "data.hpp"
+#include "mipmap.hpp"
 #include <GL/glew.h>
 #include <glm/glm.hpp>
+#include <memory>
 
 struct TextureSettings {
   GLenum wrap_s = GL_MIRRORED_REPEAT;
@@ -15,14 +17,14 @@ struct TextureSettings {
 class Texture2D {
 public:
   Texture2D(const fs::path &name, TextureSettings *settings = nullptr);
-  Texture2D(uint8_t *data,
+  Texture2D(const uint8_t *data,
             GLenum data_type,
             int width,
             int height,
             int channels,
             TextureSettings *settings = nullptr);
 
-  Texture2D(uint8_t *data,
+  Texture2D(const uint8_t *data,
             GLenum data_type,
             int width,
             int height,
@@ -30,25 +32,63 @@ public:
             GLenum format,
             TextureSettings *settings = nullptr);
 
+  // Upload every level of a prebuilt chain, texels are laid out as described
+  // by chain.levels. Compressed chains are uploaded as is.
+  Texture2D(const MipChain &chain,
+            const uint8_t *texels,
+            TextureSettings *settings = nullptr);
+
+  // Allocate all levels of chain without uploading texels. Only levels at or
+  // above the base level are sampled, which starts at the smallest level and
+  // is lowered with set_base_level as finer levels arrive.
+  static std::unique_ptr<Texture2D>
+  create_streamed(const MipChain &chain, TextureSettings *settings = nullptr);
+
   ~Texture2D();
 
+  // Replace every level with those of chain and keep the texture object and
+  // its sampler state, so a placeholder can be filled in where it is bound.
+  // Without texels the levels are only allocated, as in create_streamed.
+  void reallocate(const MipChain &chain, const uint8_t *texels);
+
   GLuint get() const;
 
   int width() const;
   int height() const;
+  int levels() const;
+
+  // rows are counted as in MipChain::row_count, data may be an offset into
+  // the bound pixel unpack buffer
+  void upload_rows(const MipChain &chain,
+                   int level,
+                   int row,
+                   int row_count,
+                   const void *data);
+  void set_base_level(int level);
+
+  static GLenum channels_to_format(int channels);
 
 private:
+  Texture2D() = default;
+
   GLuint _tex_id;
   int _width, _height;
+  int _levels = 1;
+  GLenum _format = GL_RGBA;
+
+  void init_sampler(TextureSettings *settings);
+  void init_levels(const MipChain &chain,
+                   const uint8_t *texels,
+                   GLenum internal_format);
 
-  void init(uint8_t *data,
+  void init(const uint8_t *data,
             GLenum data_type,
             int width,
             int height,
             int channels,
             TextureSettings *settings = nullptr);
 
-  void init(uint8_t *data,
+  void init(const uint8_t *data,
             GLenum data_type,
             int width,
             int height,
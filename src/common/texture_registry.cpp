@@ -0,0 +1,44 @@
+#include "texture_registry.hpp"
+#include <algorithm>
+
+TextureRegistry::Handle TextureRegistry::acquire(
+    uint64_t key,
+    size_t bytes,
+    const std::function<std::unique_ptr<Texture2D>()> &create) {
+  auto &entry = _entries[key];
+  if (auto texture = entry.texture.lock()) {
+    _saved_bytes += entry.bytes;
+    _shared_count++;
+    return texture;
+  }
+  Handle texture = create();
+  entry = Entry{texture, bytes};
+
+  if (_entries.size() >= _sweep_size) {
+    for (auto it = _entries.begin(); it != _entries.end();) {
+      it = it->second.texture.expired() ? _entries.erase(it) : std::next(it);
+    }
+    _sweep_size = std::max<size_t>(64, _entries.size() * 2);
+  }
+  return texture;
+}
+
+bool TextureRegistry::contains(uint64_t key) const {
+  auto it = _entries.find(key);
+  return it != _entries.end() && !it->second.texture.expired();
+}
+
+size_t TextureRegistry::saved_bytes() const {
+  return _saved_bytes;
+}
+
+size_t TextureRegistry::shared_count() const {
+  return _shared_count;
+}
+
+size_t TextureRegistry::live_count() const {
+  return (size_t)std::count_if(
+      _entries.begin(), _entries.end(), [](const auto &entry) {
+        return !entry.second.texture.expired();
+      });
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "texture.hpp"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+// Shares textures by a key of their content, so identical textures of
+// different materials and scenes are uploaded once. The registry keeps no
+// texture alive by itself: a texture is freed with its last handle and made
+// again when its key is acquired after that.
+class TextureRegistry {
+public:
+  using Handle = std::shared_ptr<Texture2D>;
+
+  // The live texture stored under key, or the one create makes, which is
+  // stored under key from then on. bytes is what uploading it costs and is
+  // counted as saved whenever it is shared.
+  Handle acquire(uint64_t key,
+                 size_t bytes,
+                 const std::function<std::unique_ptr<Texture2D>()> &create);
+  // whether acquire would share a texture for key
+  bool contains(uint64_t key) const;
+
+  // bytes of uploads skipped by sharing
+  size_t saved_bytes() const;
+  size_t shared_count() const;
+  // textures with handles left
+  size_t live_count() const;
+
+private:
+  struct Entry {
+    std::weak_ptr<Texture2D> texture;
+    size_t bytes;
+  };
+
+  std::unordered_map<uint64_t, Entry> _entries;
+  size_t _saved_bytes = 0;
+  size_t _shared_count = 0;
+  // entries of freed textures are swept whenever the map doubles
+  size_t _sweep_size = 64;
+};
@@ -0,0 +1,161 @@
+#include "texture_streamer.hpp"
+#include <algorithm>
+#include <cstring>
+
+TextureStreamer::TextureStreamer(size_t budget_per_frame, uint32_t ring_size)
+    : _budget(budget_per_frame), _slots(std::max<uint32_t>(ring_size, 1)) {
+  for (auto &slot : _slots) {
+    glGenBuffers(1, &slot.pbo);
+  }
+}
+
+TextureStreamer::~TextureStreamer() {
+  for (auto &slot : _slots) {
+    if (slot.fence != nullptr) {
+      glDeleteSync(slot.fence);
+    }
+    glDeleteBuffers(1, &slot.pbo);
+  }
+}
+
+void TextureStreamer::enqueue(Texture2D *texture, MipChain chain) {
+  auto smallest = (int)chain.levels.size() - 1;
+  texture->upload_rows(chain,
+                       smallest,
+                       0,
+                       chain.row_count(smallest),
+                       chain.level_data(smallest));
+  texture->set_base_level(smallest);
+  if (smallest == 0) {
+    return;
+  }
+
+  auto request = std::make_unique<Request>();
+  request->texture = texture;
+  request->chain = std::move(chain);
+  request->level = smallest - 1;
+  request->row = 0;
+  for (int i = 0; i < smallest; i++) {
+    _pending_bytes += request->chain.levels[i].size;
+  }
+  _requests.emplace_back(std::move(request));
+}
+
+size_t TextureStreamer::row_size(const Request &request) const {
+  return request.chain.row_size(request.level);
+}
+
+void TextureStreamer::update() {
+  if (_requests.empty()) {
+    return;
+  }
+
+  auto &slot = _slots[_next_slot];
+  if (slot.fence != nullptr) {
+    // never stall the frame, try again next time if the GPU still reads
+    // from this buffer
+    auto status = glClientWaitSync(slot.fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+      return;
+    }
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+  }
+  _next_slot = (_next_slot + 1) % (uint32_t)_slots.size();
+
+  // a single row has to fit even if it is larger than the budget
+  size_t capacity = _budget;
+  for (auto &request : _requests) {
+    capacity = std::max(capacity, row_size(*request));
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+  if (slot.capacity < capacity) {
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+    slot.capacity = capacity;
+  }
+  auto mapped = static_cast<uint8_t *>(
+      glMapBufferRange(GL_PIXEL_UNPACK_BUFFER,
+                       0,
+                       slot.capacity,
+                       GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+  if (mapped == nullptr) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return;
+  }
+
+  struct Upload {
+    Request *request;
+    int level;
+    int row;
+    int row_count;
+    size_t offset;
+  };
+  std::vector<Upload> uploads;
+  size_t used = 0;
+  while (used < _budget) {
+    // the smallest pending level of all textures goes first
+    auto level_size = [](Request *r) { return r->chain.levels[r->level].size; };
+    Request *request = nullptr;
+    for (auto &r : _requests) {
+      if (r->level >= 0 &&
+          (request == nullptr || level_size(r.get()) < level_size(request))) {
+        request = r.get();
+      }
+    }
+    if (request == nullptr) {
+      break;
+    }
+
+    auto rows = request->chain.row_count(request->level);
+    auto row_bytes = row_size(*request);
+    auto row_count = std::min((int)((slot.capacity - used) / row_bytes),
+                              rows - request->row);
+    if (row_count <= 0) {
+      break;
+    }
+
+    auto bytes = row_bytes * row_count;
+    std::memcpy(mapped + used,
+                request->chain.level_data(request->level) +
+                    row_bytes * request->row,
+                bytes);
+    uploads.push_back(
+        Upload{request, request->level, request->row, row_count, used});
+    used += bytes;
+    _pending_bytes -= bytes;
+    request->row += row_count;
+    if (request->row == rows) {
+      request->level--;
+      request->row = 0;
+    }
+  }
+  glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+  for (auto &upload : uploads) {
+    auto &request = *upload.request;
+    request.texture->upload_rows(request.chain,
+                                 upload.level,
+                                 upload.row,
+                                 upload.row_count,
+                                 reinterpret_cast<const void *>(upload.offset));
+    if (upload.row + upload.row_count ==
+        request.chain.row_count(upload.level)) {
+      request.texture->set_base_level(upload.level);
+    }
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  _requests.erase(std::remove_if(_requests.begin(),
+                                 _requests.end(),
+                                 [](auto &r) { return r->level < 0; }),
+                  _requests.end());
+}
+
+bool TextureStreamer::idle() const {
+  return _requests.empty();
+}
+
+size_t TextureStreamer::pending_bytes() const {
+  return _pending_bytes;
+}
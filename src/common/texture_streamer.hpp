@@ -0,0 +1,49 @@
+#pragma once
+
+#include "mipmap.hpp"
+#include "texture.hpp"
+#include <memory>
+#include <vector>
+
+// Streams mip chains into textures through a ring of pixel buffer objects.
+// Coarse levels of every texture go first, so a texture is sampled with
+// whatever levels are resident and sharpens as finer ones arrive. At most
+// budget bytes are uploaded per update.
+class TextureStreamer {
+public:
+  explicit TextureStreamer(size_t budget_per_frame = 8 << 20,
+                           uint32_t ring_size = 3);
+  ~TextureStreamer();
+
+  // The smallest level is uploaded immediately, so the texture is complete
+  // on return. The texture must outlive the streamer.
+  void enqueue(Texture2D *texture, MipChain chain);
+
+  // call once per frame on the GL thread
+  void update();
+
+  bool idle() const;
+  size_t pending_bytes() const;
+
+private:
+  struct Request {
+    Texture2D *texture;
+    MipChain chain;
+    int level;
+    int row;
+  };
+
+  struct Slot {
+    GLuint pbo{};
+    size_t capacity{};
+    GLsync fence{};
+  };
+
+  size_t row_size(const Request &request) const;
+
+  size_t _budget;
+  std::vector<Slot> _slots;
+  uint32_t _next_slot = 0;
+  std::vector<std::unique_ptr<Request>> _requests;
+  size_t _pending_bytes = 0;
+};
@@ -0,0 +1,111 @@
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+ThreadPool::ThreadPool(size_t thread_count) {
+  thread_count = std::max<size_t>(thread_count, 1);
+  _workers.reserve(thread_count);
+  for (size_t i = 0; i < thread_count; i++) {
+    _workers.emplace_back([this] { worker_loop(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stopping = true;
+  }
+  _cv.notify_all();
+  for (auto &worker : _workers) {
+    worker.join();
+  }
+}
+
+ThreadPool &ThreadPool::global() {
+  static ThreadPool pool(std::thread::hardware_concurrency());
+  return pool;
+}
+
+size_t ThreadPool::thread_count() const {
+  return _workers.size();
+}
+
+void ThreadPool::worker_loop() {
+  while (true) {
+    std::packaged_task<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _cv.wait(lock, [this] { return _stopping || !_tasks.empty(); });
+      if (_tasks.empty()) {
+        return;
+      }
+      task = std::move(_tasks.front());
+      _tasks.pop();
+    }
+    task();
+  }
+}
+
+std::future<void> ThreadPool::submit(std::function<void()> task) {
+  std::packaged_task<void()> packaged(std::move(task));
+  auto future = packaged.get_future();
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _tasks.push(std::move(packaged));
+  }
+  _cv.notify_one();
+  return future;
+}
+
+void ThreadPool::parallel_for(size_t count,
+                              const std::function<void(size_t)> &func) {
+  if (count == 0) {
+    return;
+  }
+
+  // helpers may start after the loop is already drained, so the state they
+  // touch must outlive this call
+  struct State {
+    std::function<void(size_t)> func;
+    size_t count;
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> done{0};
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::exception_ptr error;
+  };
+  auto state = std::make_shared<State>();
+  state->func = func;
+  state->count = count;
+
+  auto run = [state] {
+    size_t i;
+    while ((i = state->next.fetch_add(1)) < state->count) {
+      try {
+        state->func(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (!state->error) {
+          state->error = std::current_exception();
+        }
+      }
+      if (state->done.fetch_add(1) + 1 == state->count) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->cv.notify_all();
+      }
+    }
+  };
+
+  auto helper_count = std::min(count - 1, thread_count());
+  for (size_t i = 0; i < helper_count; i++) {
+    submit(run);
+  }
+  run();
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->cv.wait(lock, [&] { return state->done.load() == state->count; });
+  if (state->error) {
+    std::rethrow_exception(state->error);
+  }
+}
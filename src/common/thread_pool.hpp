@@ -0,0 +1,35 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+  explicit ThreadPool(size_t thread_count);
+  ~ThreadPool();
+
+  // shared pool sized to the number of hardware threads
+  static ThreadPool &global();
+
+  std::future<void> submit(std::function<void()> task);
+
+  // run func(i) for i in [0, count). The calling thread takes part in the
+  // work, so it is safe to call from inside a pool task.
+  void parallel_for(size_t count, const std::function<void(size_t)> &func);
+
+  size_t thread_count() const;
+
+private:
+  void worker_loop();
+
+  std::vector<std::thread> _workers;
+  std::queue<std::packaged_task<void()>> _tasks;
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  bool _stopping = false;
+};
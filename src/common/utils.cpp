@@ -1,4 +1,5 @@
 #include "utils.hpp"
+#include <cstring>
 
 glm::vec3 polar_to_cartesian(float yaw, float pitch) {
   float y = cosf(pitch);
@@ -7,3 +8,45 @@ glm::vec3 polar_to_cartesian(float yaw, float pitch) {
   float z = sinPitch * sinf(yaw);
   return glm::vec3(x, y, z);
 }
+
+namespace {
+uint64_t mix64(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+} // namespace
+
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed) {
+  const uint64_t prime = 0x9e3779b97f4a7c15ULL;
+  auto bytes = static_cast<const uint8_t *>(data);
+  // four independent lanes so the multiplies can overlap
+  uint64_t lanes[4] = {seed ^ prime, seed + prime, ~seed, seed * prime};
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    for (int l = 0; l < 4; l++) {
+      uint64_t v;
+      std::memcpy(&v, bytes + i + l * 8, sizeof(v));
+      lanes[l] = (lanes[l] ^ v) * prime;
+      lanes[l] = (lanes[l] << 31) | (lanes[l] >> 33);
+    }
+  }
+  uint64_t h = size;
+  for (auto lane : lanes) {
+    h = mix64(h ^ lane);
+  }
+  for (; i + 8 <= size; i += 8) {
+    uint64_t v;
+    std::memcpy(&v, bytes + i, sizeof(v));
+    h = mix64(h ^ v);
+  }
+  if (i < size) {
+    uint64_t v = 0;
+    std::memcpy(&v, bytes + i, size - i);
+    h = mix64(h ^ v ^ prime);
+  }
+  return h;
+}
@@ -1,10 +1,15 @@
 #pragma once
 
+#include <cstdint>
 #include <glm/glm.hpp>
 #include <queue>
 
 glm::vec3 polar_to_cartesian(float yaw, float pitch);
 
+// fast non-cryptographic 64 bit hash, stable across runs and platforms with
+// the same endianness
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed = 0);
+
 template <typename T> class FixSizeQueue {
 public:
   FixSizeQueue(size_t max_size) : _max_size(max_size) {}